@@ -0,0 +1,139 @@
+#include "AudioBlockTracker.h"
+#include "Util.h"
+
+volatile AUDIO_BLOCK_TRACKER::OWNER AUDIO_BLOCK_TRACKER::s_owners[MAX_BLOCKS];
+volatile uint32_t                   AUDIO_BLOCK_TRACKER::s_ownership_errors = 0;
+
+int AUDIO_BLOCK_TRACKER::s_window_samples   = 0;
+int AUDIO_BLOCK_TRACKER::s_window_min_used  = 0;
+int AUDIO_BLOCK_TRACKER::s_baseline_used    = -1;
+int AUDIO_BLOCK_TRACKER::s_rising_windows   = 0;
+
+void AUDIO_BLOCK_TRACKER::set_owner( const audio_block_t* block, OWNER owner )
+{
+  if( block == nullptr || block->memory_pool_index >= MAX_BLOCKS )
+  {
+    return;
+  }
+
+  s_owners[block->memory_pool_index] = owner;
+}
+
+void AUDIO_BLOCK_TRACKER::transfer( const audio_block_t* block, OWNER from, OWNER to )
+{
+  if( block == nullptr || block->memory_pool_index >= MAX_BLOCKS )
+  {
+    return;
+  }
+
+  volatile OWNER& owner = s_owners[block->memory_pool_index];
+  if( owner != from )
+  {
+    s_ownership_errors = s_ownership_errors + 1;
+    ASSERT_MSG( false, "AUDIO_BLOCK_TRACKER::transfer() block not held by the owner" );
+  }
+  owner = to;
+}
+
+AUDIO_BLOCK_TRACKER::CENSUS AUDIO_BLOCK_TRACKER::census()
+{
+  CENSUS census;
+  for( int b = 0; b < MAX_BLOCKS; ++b )
+  {
+    ++census.m_blocks[static_cast<int>(s_owners[b])];
+  }
+  census.m_pool_used = AudioMemoryUsage();
+
+  return census;
+}
+
+uint32_t AUDIO_BLOCK_TRACKER::ownership_errors()
+{
+  return s_ownership_errors;
+}
+
+bool AUDIO_BLOCK_TRACKER::sample_pool()
+{
+  const int used = AudioMemoryUsage();
+  if( s_window_samples == 0 || used < s_window_min_used )
+  {
+    s_window_min_used = used;
+  }
+
+  if( ++s_window_samples < POOL_SAMPLES_PER_WINDOW )
+  {
+    return false;
+  }
+
+  if( s_baseline_used >= 0 && s_window_min_used > s_baseline_used )
+  {
+    ++s_rising_windows;
+  }
+  else
+  {
+    s_rising_windows = 0;
+  }
+
+  s_baseline_used   = s_window_min_used;
+  s_window_samples  = 0;
+
+  return s_rising_windows >= LEAK_TREND_WINDOWS;
+}
+
+void AUDIO_BLOCK_TRACKER::print_census( const CENSUS& census )
+{
+  DEBUG_TEXT( "Audio blocks used:" );
+  DEBUG_TEXT( census.m_pool_used );
+  DEBUG_TEXT( " max:" );
+  DEBUG_TEXT( AudioMemoryUsageMax() );
+  DEBUG_TEXT( " baseline:" );
+  DEBUG_TEXT( s_baseline_used );
+  for( int o = 1; o < NUM_OWNERS; ++o )
+  {
+    DEBUG_TEXT( " " );
+    DEBUG_TEXT( owner_name( static_cast<OWNER>(o) ) );
+    DEBUG_TEXT( ":" );
+    DEBUG_TEXT( census.m_blocks[o] );
+  }
+  DEBUG_TEXT( " ownership errors:" );
+  DEBUG_TEXT_LINE( s_ownership_errors );
+}
+
+const char* AUDIO_BLOCK_TRACKER::owner_name( OWNER owner )
+{
+  switch( owner )
+  {
+    case OWNER::NONE:
+    {
+      return "none";
+    }
+    case OWNER::SD_READ:
+    {
+      return "SD read";
+    }
+    case OWNER::PLAY_QUEUE:
+    {
+      return "play queue";
+    }
+    case OWNER::CURRENT_PLAY:
+    {
+      return "current play";
+    }
+    case OWNER::JUST_PLAYED:
+    {
+      return "just played";
+    }
+    case OWNER::TRANSMIT:
+    {
+      return "transmit";
+    }
+    case OWNER::RECORD_QUEUE:
+    {
+      return "record queue";
+    }
+    default:
+    {
+      return "unknown";
+    }
+  }
+}
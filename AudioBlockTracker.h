@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Audio.h>
+#include "CompileSwitches.h"
+
+// Records which part of the recorder holds each audio block from the pool, keyed by the block's pool index.
+// A block leaked by overwriting the pointer which held it keeps its owner, so it shows up as a census count the owner
+// can't account for (see SD_AUDIO_RECORDER::check_block_ownership()). A transfer from an owner which doesn't hold the
+// block counts as an ownership error.
+// The pool usage is also sampled, and the lowest usage in each window taken as the baseline - a baseline which keeps
+// rising is a slow leak somewhere in the graph, even from blocks which aren't tracked.
+// Enable with TRACK_AUDIO_BLOCKS in CompileSwitches.h, otherwise the AUDIO_BLOCK_* macros compile to nothing.
+
+class AUDIO_BLOCK_TRACKER
+{
+public:
+
+  enum class OWNER : uint8_t
+  {
+    NONE,                             // in the pool, or held by the graph
+    SD_READ,                          // SD read in flight
+    PLAY_QUEUE,
+    CURRENT_PLAY,                     // SD_AUDIO_RECORDER::m_current_play_block
+    JUST_PLAYED,                      // SD_AUDIO_RECORDER::m_just_played_block
+    TRANSMIT,                         // being filled in the interrupt
+    RECORD_QUEUE,
+    NUM_OWNERS,
+  };
+
+  static constexpr const int      NUM_OWNERS              = static_cast<int>(OWNER::NUM_OWNERS);
+  static constexpr const int      MAX_BLOCKS              = 512;    // pool indices above this aren't tracked
+  static constexpr const int      POOL_SAMPLES_PER_WINDOW = 30;
+  static constexpr const int      LEAK_TREND_WINDOWS      = 4;      // consecutive rising windows before reporting
+
+  struct CENSUS
+  {
+    uint16_t          m_blocks[NUM_OWNERS]  = {};
+    uint16_t          m_pool_used           = 0;
+  };
+
+  static void         set_owner( const audio_block_t* block, OWNER owner );
+  static void         transfer( const audio_block_t* block, OWNER from, OWNER to );
+
+  static CENSUS       census();                   // with audio interrupts disabled, to be consistent with the owners
+  static uint32_t     ownership_errors();
+
+  static bool         sample_pool();              // periodically from the main loop, true at the end of each rising window
+
+  static void         print_census( const CENSUS& census );
+  static const char*  owner_name( OWNER owner );
+
+private:
+
+  static volatile OWNER     s_owners[MAX_BLOCKS];
+  static volatile uint32_t  s_ownership_errors;
+
+  static int                s_window_samples;
+  static int                s_window_min_used;
+  static int                s_baseline_used;      // -1 until the first window completes
+  static int                s_rising_windows;
+};
+
+#ifdef TRACK_AUDIO_BLOCKS
+#define AUDIO_BLOCK_OWNER(block, owner) AUDIO_BLOCK_TRACKER::set_owner( block, AUDIO_BLOCK_TRACKER::OWNER::owner )
+#define AUDIO_BLOCK_TRANSFER(block, from, to) AUDIO_BLOCK_TRACKER::transfer( block, AUDIO_BLOCK_TRACKER::OWNER::from, AUDIO_BLOCK_TRACKER::OWNER::to )
+#else
+#define AUDIO_BLOCK_OWNER(block, owner)
+#define AUDIO_BLOCK_TRANSFER(block, from, to)
+#endif
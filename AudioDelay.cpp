@@ -0,0 +1,82 @@
+#include "Util.h"
+#include "AudioDelay.h"
+#include "AudioProfiler.h"
+
+AUDIO_DELAY::AUDIO_DELAY() :
+  AudioStream(1, m_input_queue_array),
+  m_ring(),
+  m_write_pos(0),
+  m_delay(1.0f),
+  m_target_delay(1.0f)
+{
+
+}
+
+void AUDIO_DELAY::update()
+{
+  ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::DELAY );
+
+  audio_block_t* in_block = receiveReadOnly();
+
+  audio_block_t* out_block = allocate();
+  if( out_block == nullptr )
+  {
+    if( in_block != nullptr )
+    {
+      release( in_block );
+    }
+    return;
+  }
+
+  const float target_delay  = m_target_delay;
+  float delay               = m_delay;
+  int write_pos             = m_write_pos;
+
+  for( int s = 0; s < AUDIO_BLOCK_SAMPLES; ++s )
+  {
+    delay += ( target_delay - delay ) * DELAY_SMOOTHING;
+
+    // read before writing, so a delay of 1 is the previous sample
+    float read_pos = write_pos - delay;
+    if( read_pos < 0.0f )
+    {
+      read_pos += RING_SIZE;
+    }
+
+    int read_index          = trunc_to_int( read_pos );
+    const float frac        = read_pos - read_index;
+    if( read_index >= RING_SIZE )
+    {
+      // a tiny negative position rounds up to RING_SIZE when wrapped
+      read_index -= RING_SIZE;
+    }
+    const int next_index    = read_index + 1 < RING_SIZE ? read_index + 1 : 0;
+
+    const float sample      = m_ring[read_index] + ( ( m_ring[next_index] - m_ring[read_index] ) * frac );
+    out_block->data[s]      = round_to_int( sample );
+
+    // keep running when there's no input, so the tail still plays out
+    m_ring[write_pos]       = in_block != nullptr ? in_block->data[s] : 0;
+    if( ++write_pos >= RING_SIZE )
+    {
+      write_pos = 0;
+    }
+  }
+
+  m_delay     = delay;
+  m_write_pos = write_pos;
+
+  if( in_block != nullptr )
+  {
+    release( in_block );
+  }
+
+  transmit( out_block );
+  release( out_block );
+}
+
+void AUDIO_DELAY::set_delay_time_ms( float delay_time_ms )
+{
+  const float delay_samples = ( delay_time_ms * AUDIO_SAMPLE_RATE_EXACT ) / 1000.0f;
+  m_target_delay = clamp( delay_samples, 1.0f, static_cast<float>(MAX_DELAY_SAMPLES) );
+}
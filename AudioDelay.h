@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Audio.h>
+
+// Delay line with its own sample ring, rather than holding audio blocks from the shared AudioMemory() pool like
+// AudioEffectDelay (500ms is around 170 blocks, which the SD queues compete for).
+// The read head is fractional and glides towards the set delay time, so turning the dial bends the pitch instead of
+// jumping between taps (zipper noise).
+
+class AUDIO_DELAY : public AudioStream
+{
+public:
+
+  static constexpr const int    MAX_DELAY_TIME_MS   = 500;
+  static constexpr const int    MAX_DELAY_SAMPLES   = static_cast<int>( ( MAX_DELAY_TIME_MS * AUDIO_SAMPLE_RATE_EXACT ) / 1000.0f );
+  static constexpr const int    RING_SIZE           = MAX_DELAY_SAMPLES + 2;   // room for the interpolated sample after the oldest
+  static constexpr const float  DELAY_SMOOTHING     = 0.0005f;                 // per sample, approx 45ms time constant
+
+  AUDIO_DELAY();
+
+  virtual void        update() override;
+
+  void                set_delay_time_ms( float delay_time_ms );
+
+private:
+
+  audio_block_t*      m_input_queue_array[1];
+
+  int16_t             m_ring[RING_SIZE];
+  int                 m_write_pos;
+  float               m_delay;                // in samples, moves towards m_target_delay
+  volatile float      m_target_delay;
+};
@@ -0,0 +1,201 @@
+#include <utility/dspinst.h>
+
+#include "Util.h"
+#include "AudioOutputStage.h"
+#include "AudioProfiler.h"
+
+constexpr const int32_t UNITY_GAIN = 65536;
+
+// unconnected or inactive inputs read as silence
+static const int16_t silence[AUDIO_BLOCK_SAMPLES] __attribute__((aligned(4))) = {};
+
+AUDIO_OUTPUT_STAGE::AUDIO_OUTPUT_STAGE() :
+  AudioStream(NUM_INPUTS, m_input_queue_array),
+  m_input_gain(UNITY_GAIN),
+  m_looper_mix(0),
+  m_delay_feedback(0),
+  m_delay_mix(0)
+{
+
+}
+
+AUDIO_OUTPUT_STAGE::RAMPED_GAIN::RAMPED_GAIN( int32_t gain ) :
+  m_target(gain),
+  m_current(gain)
+{
+
+}
+
+void AUDIO_OUTPUT_STAGE::update()
+{
+  ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::OUTPUT_STAGE );
+
+  GAINS start;
+  start.m_input_gain          = m_input_gain.m_current;
+  start.m_looper_mix          = m_looper_mix.m_current;
+  start.m_delay_feedback      = m_delay_feedback.m_current;
+  start.m_delay_mix           = m_delay_mix.m_current;
+
+  // targets are read once, the setters may be called during the update
+  GAINS target;
+  target.m_input_gain         = m_input_gain.m_target;
+  target.m_looper_mix         = m_looper_mix.m_target;
+  target.m_delay_feedback     = m_delay_feedback.m_target;
+  target.m_delay_mix          = m_delay_mix.m_target;
+
+  // at a steady unity gain the input block is passed straight to the recorder, otherwise it's gained in place
+  const bool pass_input       = start.m_input_gain == UNITY_GAIN && target.m_input_gain == UNITY_GAIN;
+  audio_block_t* audio_block  = pass_input ? receiveReadOnly( INPUT_AUDIO ) : receiveWritable( INPUT_AUDIO );
+
+  // the recorder keeps the looper block for overdubbing, so it's only read
+  audio_block_t* looper_block = receiveReadOnly( INPUT_LOOPER );
+
+  // the sample player and delay line only send their blocks here, so the output and send are written over them
+  audio_block_t* samples_block  = receiveWritable( INPUT_SAMPLES );
+  audio_block_t* delay_block    = receiveWritable( INPUT_DELAY_RETURN );
+
+  auto samples = []( const audio_block_t* block ) -> const int16_t*
+  {
+    return block != nullptr ? block->data : silence;
+  };
+
+  const int16_t* audio_in     = samples( audio_block );
+  const int16_t* looper_in    = samples( looper_block );
+  const int16_t* samples_in   = samples( samples_block );
+  const int16_t* delay_in     = samples( delay_block );
+
+  audio_block_t* out_block    = samples_block != nullptr ? samples_block : allocate();
+  audio_block_t* send_block   = delay_block != nullptr ? delay_block : allocate();
+
+  if( out_block == nullptr || send_block == nullptr )
+  {
+    audio_block_t* blocks[] = { audio_block, looper_block, out_block, send_block };
+    for( audio_block_t* block : blocks )
+    {
+      if( block != nullptr )
+      {
+        release( block );
+      }
+    }
+    return;
+  }
+
+  // nothing to record without an input block
+  int16_t* record             = !pass_input && audio_block != nullptr ? audio_block->data : nullptr;
+
+  mix_block( audio_in, looper_in, samples_in, delay_in, out_block->data, send_block->data, record, start, target );
+
+  // land exactly on the targets, the steps are truncated
+  m_input_gain.m_current      = target.m_input_gain;
+  m_looper_mix.m_current      = target.m_looper_mix;
+  m_delay_feedback.m_current  = target.m_delay_feedback;
+  m_delay_mix.m_current       = target.m_delay_mix;
+
+  transmit( out_block, OUTPUT_MAIN );
+  transmit( send_block, OUTPUT_DELAY_SEND );
+  transmit( out_block, OUTPUT_RESAMPLE );
+  release( out_block );
+  release( send_block );
+
+  if( audio_block != nullptr )
+  {
+    transmit( audio_block, OUTPUT_RECORD );
+    release( audio_block );
+  }
+
+  if( looper_block != nullptr )
+  {
+    release( looper_block );
+  }
+}
+
+void AUDIO_OUTPUT_STAGE::set_input_gain( float gain )
+{
+  m_input_gain.m_target = to_fixed_gain( gain );
+}
+
+void AUDIO_OUTPUT_STAGE::set_looper_mix( float mix )
+{
+  m_looper_mix.m_target = to_fixed_gain( mix );
+}
+
+void AUDIO_OUTPUT_STAGE::set_delay_feedback( float feedback )
+{
+  m_delay_feedback.m_target = to_fixed_gain( feedback );
+}
+
+void AUDIO_OUTPUT_STAGE::set_delay_mix( float mix )
+{
+  m_delay_mix.m_target = to_fixed_gain( mix );
+}
+
+void AUDIO_OUTPUT_STAGE::mix_block( const int16_t* audio_in, const int16_t* looper_in, const int16_t* samples_in, const int16_t* delay_in,
+                                    int16_t* out, int16_t* send, int16_t* record, const GAINS& start, const GAINS& target )
+{
+  int32_t input_gain                  = start.m_input_gain;
+  int32_t looper_mix                  = start.m_looper_mix;
+  int32_t delay_feedback              = start.m_delay_feedback;
+  int32_t delay_mix                   = start.m_delay_mix;
+
+  const int32_t input_gain_step       = ramp_step( input_gain, target.m_input_gain );
+  const int32_t looper_mix_step       = ramp_step( looper_mix, target.m_looper_mix );
+  const int32_t delay_feedback_step   = ramp_step( delay_feedback, target.m_delay_feedback );
+  const int32_t delay_mix_step        = ramp_step( delay_mix, target.m_delay_mix );
+
+  const uint32_t* audio_words         = reinterpret_cast<const uint32_t*>( audio_in );
+  const uint32_t* looper_words        = reinterpret_cast<const uint32_t*>( looper_in );
+  const uint32_t* samples_words       = reinterpret_cast<const uint32_t*>( samples_in );
+  const uint32_t* delay_words         = reinterpret_cast<const uint32_t*>( delay_in );
+
+  uint32_t* out_words                 = reinterpret_cast<uint32_t*>( out );
+  uint32_t* send_words                = reinterpret_cast<uint32_t*>( send );
+  uint32_t* record_words              = reinterpret_cast<uint32_t*>( record );
+
+  // each word holds 2 samples - b is the bottom half, t the top
+  for( int i = 0; i < AUDIO_BLOCK_SAMPLES / 2; ++i )
+  {
+    input_gain              += input_gain_step;
+    looper_mix              += looper_mix_step;
+    delay_feedback          += delay_feedback_step;
+    delay_mix               += delay_mix_step;
+
+    const int32_t input_mix = UNITY_GAIN - looper_mix;
+    const int32_t dry_mix   = UNITY_GAIN - delay_mix;
+
+    const uint32_t audio    = audio_words[i];
+    const uint32_t delay    = delay_words[i];
+    const uint32_t looper   = signed_add_16_and_16( looper_words[i], samples_words[i] );
+
+    const int32_t gained_b  = signed_saturate_rshift( signed_multiply_32x16b( input_gain, audio ), 16, 0 );
+    const int32_t gained_t  = signed_saturate_rshift( signed_multiply_32x16t( input_gain, audio ), 16, 0 );
+    const uint32_t gained   = pack_16b_16b( gained_t, gained_b );
+
+    const int32_t dry_b     = signed_saturate_rshift( signed_multiply_32x16b( input_mix, gained ) + signed_multiply_32x16b( looper_mix, looper ), 16, 0 );
+    const int32_t dry_t     = signed_saturate_rshift( signed_multiply_32x16t( input_mix, gained ) + signed_multiply_32x16t( looper_mix, looper ), 16, 0 );
+    const uint32_t dry      = pack_16b_16b( dry_t, dry_b );
+
+    const int32_t send_b    = signed_saturate_rshift( dry_b + signed_multiply_32x16b( delay_feedback, delay ), 16, 0 );
+    const int32_t send_t    = signed_saturate_rshift( dry_t + signed_multiply_32x16t( delay_feedback, delay ), 16, 0 );
+
+    const int32_t out_b     = signed_saturate_rshift( signed_multiply_32x16b( dry_mix, dry ) + signed_multiply_32x16b( delay_mix, delay ), 16, 0 );
+    const int32_t out_t     = signed_saturate_rshift( signed_multiply_32x16t( dry_mix, dry ) + signed_multiply_32x16t( delay_mix, delay ), 16, 0 );
+
+    send_words[i]           = pack_16b_16b( send_t, send_b );
+    out_words[i]            = pack_16b_16b( out_t, out_b );
+
+    if( record_words != nullptr )
+    {
+      record_words[i]       = gained;
+    }
+  }
+}
+
+int32_t AUDIO_OUTPUT_STAGE::to_fixed_gain( float gain )
+{
+  return round_to_int( clamp( gain, 0.0f, 1.0f ) * UNITY_GAIN );
+}
+
+int32_t AUDIO_OUTPUT_STAGE::ramp_step( int32_t current, int32_t target )
+{
+  return ( target - current ) / ( AUDIO_BLOCK_SAMPLES / 2 );
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Audio.h>
+
+// Input gain, looper mix, delay feedback send and delay mix in a single node, replacing an AudioAmplifier and three
+// AudioMixer4s. One pass over the block, two samples at a time with the Cortex-M4 saturating DSP instructions, and no
+// intermediate blocks passed between nodes.
+//
+//  gained input  = input * input_gain                                           -> OUTPUT_RECORD
+//  dry           = gained input * (1 - looper_mix) + (looper + samples) * looper_mix
+//  delay send    = dry + delay return * delay_feedback                         -> OUTPUT_DELAY_SEND
+//  output        = dry * (1 - delay_mix) + delay return * delay_mix            -> OUTPUT_MAIN, OUTPUT_RESAMPLE
+// Gain changes are ramped linearly across the next block, to avoid zipper noise.
+// The outputs are written in place over the writable input blocks - record over the input, output over the samples and
+// send over the delay return - so an update only allocates a block for an output whose input sent nothing.
+// OUTPUT_RESAMPLE is the output block itself, so the recorder can bounce the output mix into the loop without another
+// block or copy.
+
+class AUDIO_OUTPUT_STAGE : public AudioStream
+{
+public:
+
+  static constexpr const int INPUT_AUDIO          = 0;
+  static constexpr const int INPUT_LOOPER         = 1;
+  static constexpr const int INPUT_SAMPLES        = 2;
+  static constexpr const int INPUT_DELAY_RETURN   = 3;
+  static constexpr const int NUM_INPUTS           = 4;
+
+  static constexpr const int OUTPUT_MAIN          = 0;
+  static constexpr const int OUTPUT_DELAY_SEND    = 1;
+  static constexpr const int OUTPUT_RECORD        = 2;
+  static constexpr const int OUTPUT_RESAMPLE      = 3;
+
+  // 16.16 fixed point, as used by AudioMixer4
+  struct GAINS
+  {
+    int32_t           m_input_gain;
+    int32_t           m_looper_mix;
+    int32_t           m_delay_feedback;
+    int32_t           m_delay_mix;
+  };
+
+  AUDIO_OUTPUT_STAGE();
+
+  virtual void        update() override;
+
+  // 0..1
+  void                set_input_gain( float gain );
+  void                set_looper_mix( float mix );
+  void                set_delay_feedback( float feedback );
+  void                set_delay_mix( float mix );
+
+  // the block processing of update(), ramping from the start to the target gains - record may be null
+  // each output may be one of the inputs, every pair of samples is read before it's written
+  // public for DSP_BENCHMARK
+  static void         mix_block( const int16_t* audio_in, const int16_t* looper_in, const int16_t* samples_in, const int16_t* delay_in,
+                                 int16_t* out, int16_t* send, int16_t* record, const GAINS& start, const GAINS& target );
+
+private:
+
+  audio_block_t*      m_input_queue_array[NUM_INPUTS];
+
+  struct RAMPED_GAIN
+  {
+    volatile int32_t  m_target;
+    int32_t           m_current;    // only touched by update()
+
+    RAMPED_GAIN( int32_t gain );
+  };
+
+  RAMPED_GAIN         m_input_gain;
+  RAMPED_GAIN         m_looper_mix;
+  RAMPED_GAIN         m_delay_feedback;
+  RAMPED_GAIN         m_delay_mix;
+
+  static int32_t      to_fixed_gain( float gain );
+  static int32_t      ramp_step( int32_t current, int32_t target );   // per pair of samples, reaching target by the end of the block
+};
@@ -0,0 +1,158 @@
+#include "AudioProfiler.h"
+#include "Util.h"
+
+AUDIO_PROFILER::STATS AUDIO_PROFILER::s_stats[NUM_SECTIONS];
+
+void AUDIO_PROFILER::begin()
+{
+  // enable the cycle counter
+  ARM_DEMCR     |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL  |= ARM_DWT_CTRL_CYCCNTENA;
+
+  reset_stats();
+}
+
+void AUDIO_PROFILER::add_sample( SECTION section, uint32_t cycles )
+{
+  STATS& stats = s_stats[static_cast<int>(section)];
+
+  ++stats.m_count;
+  stats.m_total_cycles += cycles;
+  if( cycles > stats.m_max_cycles )
+  {
+    stats.m_max_cycles = cycles;
+  }
+
+  int bin             = 0;
+  uint32_t bin_limit  = BLOCK_BUDGET_CYCLES >> ( NUM_HISTOGRAM_BINS - 1 );
+  while( bin < NUM_HISTOGRAM_BINS - 1 && cycles >= bin_limit )
+  {
+    ++bin;
+    bin_limit <<= 1;
+  }
+  ++stats.m_histogram[bin];
+}
+
+AUDIO_PROFILER::STATS AUDIO_PROFILER::stats( SECTION section )
+{
+  AudioNoInterrupts();
+  const STATS stats = s_stats[static_cast<int>(section)];
+  AudioInterrupts();
+
+  return stats;
+}
+
+void AUDIO_PROFILER::print_stats()
+{
+  DEBUG_TEXT( "Audio interrupt profile, budget (cycles): " );
+  DEBUG_TEXT_LINE( BLOCK_BUDGET_CYCLES );
+
+  for( int s = 0; s < NUM_SECTIONS; ++s )
+  {
+    const SECTION section = static_cast<SECTION>(s);
+    const STATS stats     = AUDIO_PROFILER::stats( section );
+    if( stats.m_count == 0 )
+    {
+      continue;
+    }
+
+    const float mean_cycles = static_cast<float>(stats.m_total_cycles) / stats.m_count;
+
+    DEBUG_TEXT( section_name( section ) );
+    DEBUG_TEXT( " count:" );
+    DEBUG_TEXT( stats.m_count );
+    DEBUG_TEXT( " mean:" );
+    DEBUG_TEXT( mean_cycles );
+    DEBUG_TEXT( " (" );
+    DEBUG_TEXT( 100.0f * mean_cycles / BLOCK_BUDGET_CYCLES );
+    DEBUG_TEXT( "%) max:" );
+    DEBUG_TEXT( stats.m_max_cycles );
+    DEBUG_TEXT( " (" );
+    DEBUG_TEXT( 100.0f * stats.m_max_cycles / BLOCK_BUDGET_CYCLES );
+    DEBUG_TEXT( "%) histogram:" );
+    for( int b = 0; b < NUM_HISTOGRAM_BINS; ++b )
+    {
+      DEBUG_TEXT( " " );
+      DEBUG_TEXT( stats.m_histogram[b] );
+    }
+    DEBUG_TEXT_LINE( "" );
+  }
+}
+
+void AUDIO_PROFILER::reset_stats()
+{
+  AudioNoInterrupts();
+  for( STATS& stats : s_stats )
+  {
+    stats = STATS();
+  }
+  AudioInterrupts();
+}
+
+const char* AUDIO_PROFILER::section_name( SECTION section )
+{
+  switch( section )
+  {
+    case SECTION::RECORDER_PLAY:
+    {
+      return "recorder PLAY";
+    }
+    case SECTION::RECORDER_RECORD_INITIAL:
+    {
+      return "recorder RECORD_INITIAL";
+    }
+    case SECTION::RECORDER_RECORD_PLAY:
+    {
+      return "recorder RECORD_PLAY/OVERDUB";
+    }
+    case SECTION::RECORDER_PLAYING_SLOW:
+    {
+      return "  playing <1x";
+    }
+    case SECTION::RECORDER_PLAYING_UNITY_SPEED:
+    {
+      return "  playing 1x";
+    }
+    case SECTION::RECORDER_PLAYING_FAST:
+    {
+      return "  playing >1x";
+    }
+    case SECTION::RECORDER_CREATE_RECORD_BLOCK:
+    {
+      return "  create record block";
+    }
+    case SECTION::RECORDER_QUEUES:
+    {
+      return "  queues";
+    }
+    case SECTION::OUTPUT_STAGE:
+    {
+      return "output stage";
+    }
+    case SECTION::DELAY:
+    {
+      return "delay";
+    }
+    case SECTION::SAMPLE_PLAYER:
+    {
+      return "sample player";
+    }
+    default:
+    {
+      return "unknown";
+    }
+  }
+}
+
+AUDIO_PROFILER::SECTION AUDIO_PROFILER::playing_section( float speed )
+{
+  if( speed < 1.0f - UNITY_SPEED_TOLERANCE )
+  {
+    return SECTION::RECORDER_PLAYING_SLOW;
+  }
+  if( speed > 1.0f + UNITY_SPEED_TOLERANCE )
+  {
+    return SECTION::RECORDER_PLAYING_FAST;
+  }
+  return SECTION::RECORDER_PLAYING_UNITY_SPEED;
+}
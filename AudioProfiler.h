@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Audio.h>
+#include "CompileSwitches.h"
+
+// Cycle accurate accounting of sections of the audio interrupt, timed with the DWT cycle counter.
+// Each section keeps a count, total, running max and a histogram against the block budget (the cycles between audio
+// updates). Sections nest, so the recorder's per mode sections include its playing, record block and queue sections.
+// Enable with PROFILE_AUDIO_INTERRUPT in CompileSwitches.h, otherwise ADD_PROFILED_SECTION() compiles to nothing.
+
+class AUDIO_PROFILER
+{
+public:
+
+  enum class SECTION
+  {
+    RECORDER_PLAY,                    // SD_AUDIO_RECORDER::update() in each mode
+    RECORDER_RECORD_INITIAL,
+    RECORDER_RECORD_PLAY,             // includes overdub
+    RECORDER_PLAYING_SLOW,            // update_playing_interrupt(), by playback speed
+    RECORDER_PLAYING_UNITY_SPEED,
+    RECORDER_PLAYING_FAST,
+    RECORDER_CREATE_RECORD_BLOCK,
+    RECORDER_QUEUES,                  // taking play blocks and adding record blocks
+    OUTPUT_STAGE,
+    DELAY,
+    SAMPLE_PLAYER,
+    NUM_SECTIONS,
+  };
+
+  static constexpr const int      NUM_SECTIONS          = static_cast<int>(SECTION::NUM_SECTIONS);
+  static constexpr const int      NUM_HISTOGRAM_BINS    = 8;    // doubling, from 1/128 of the budget to over half of it
+  static constexpr const uint32_t BLOCK_BUDGET_CYCLES   = AUDIO_BLOCK_SAMPLES * ( F_CPU / AUDIO_SAMPLE_RATE_EXACT );
+  static constexpr const float    UNITY_SPEED_TOLERANCE = 0.01f;
+
+  struct STATS
+  {
+    uint32_t          m_count                           = 0;
+    uint64_t          m_total_cycles                    = 0;
+    uint32_t          m_max_cycles                      = 0;
+    uint32_t          m_histogram[NUM_HISTOGRAM_BINS]   = {};
+  };
+
+  static void         begin();
+
+  static void         add_sample( SECTION section, uint32_t cycles );   // from the audio interrupt
+
+  static STATS        stats( SECTION section );   // copy, safe from the main loop
+  static void         print_stats();
+  static void         reset_stats();
+
+  static const char*  section_name( SECTION section );
+  static SECTION      playing_section( float speed );
+
+private:
+
+  static STATS        s_stats[NUM_SECTIONS];
+};
+
+struct PROFILED_SECTION
+{
+  AUDIO_PROFILER::SECTION m_section;
+  uint32_t                m_start_cycles;
+
+  PROFILED_SECTION( AUDIO_PROFILER::SECTION section ) :
+    m_section( section ),
+    m_start_cycles( ARM_DWT_CYCCNT )
+  {
+  }
+
+  ~PROFILED_SECTION()
+  {
+    AUDIO_PROFILER::add_sample( m_section, ARM_DWT_CYCCNT - m_start_cycles );
+  }
+};
+
+#ifdef PROFILE_AUDIO_INTERRUPT
+#define ADD_PROFILED_SECTION(section) PROFILED_SECTION profiled_section( section )
+#else
+#define ADD_PROFILED_SECTION(section)
+#endif
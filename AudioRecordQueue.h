@@ -162,7 +162,7 @@ public:
     if( h == m_tail )
     {
       DEBUG_TEXT("AUDIO_RECORD_QUEUE::update() QUEUE FULL, RELEASING BLOCK:");
-      DEBUG_TEXT_LINE_MODE((int)block, HEX);
+      DEBUG_TEXT_LINE_MODE(reinterpret_cast<uintptr_t>(block), HEX);
       debug_log_stats();
       m_audio_producer.release_block_func( block );
     }
@@ -1,19 +1,83 @@
-#include <Wire.h>
-
 #include "ButtonStrip.h"
+#include "LoopProfiler.h"
 #include "Util.h"
 
  
 BUTTON_STRIP::BUTTON_STRIP( int i2c_address ) :
-  m_i2c_address( i2c_address )
+  m_i2c_address( i2c_address ),
+  m_i2c()
+{
+}
+
+void BUTTON_STRIP::begin()
+{
+  m_i2c.begin();
+}
+
+bool BUTTON_STRIP::send_led_values(uint8_t led_values)
+{
+  // one write in flight at a time, the latest values are sent when it finishes
+  if( m_led_write != I2C_ASYNC::INVALID_TRANSACTION )
+  {
+    return false;
+  }
+
+  m_led_write = m_i2c.submit_write( m_i2c_address, &led_values, 1 );
+  return m_led_write != I2C_ASYNC::INVALID_TRANSACTION;
+}
+
+void BUTTON_STRIP::update_i2c()
+{
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::BUTTON_STRIP_I2C );
+
+  m_i2c.update();
+
+  if( m_switch_read != I2C_ASYNC::INVALID_TRANSACTION && m_i2c.complete( m_switch_read ) )
+  {
+    uint8_t switch_values;
+    if( m_i2c.finish( m_switch_read, &switch_values ) == 1 )
+    {
+      m_switch_values = switch_values;
+    }
+    m_switch_read = I2C_ASYNC::INVALID_TRANSACTION;
+  }
+
+  if( m_led_write != I2C_ASYNC::INVALID_TRANSACTION && m_i2c.complete( m_led_write ) )
+  {
+    if( m_i2c.finish( m_led_write ) < 0 )
+    {
+      // try again
+      m_led_values_changed = true;
+    }
+    m_led_write = I2C_ASYNC::INVALID_TRANSACTION;
+  }
+}
+
+void BUTTON_STRIP::poll_switches( uint32_t time_ms )
 {
+  if( m_switch_read == I2C_ASYNC::INVALID_TRANSACTION && time_ms - m_switch_poll_time_stamp_ms >= m_switch_poll_time_ms )
+  {
+    m_switch_read               = m_i2c.submit_read( m_i2c_address, 1 );
+    m_switch_poll_time_stamp_ms = time_ms;
+  }
 }
 
-void BUTTON_STRIP::send_led_values(uint8_t led_values)
+void BUTTON_STRIP::set_led_values( uint8_t led_values )
 {
-  Wire.beginTransmission(m_i2c_address);
-  Wire.write(led_values);
-  Wire.endTransmission();  
+  if( led_values != m_led_values )
+  {
+    m_led_values          = led_values;
+    m_led_values_changed  = true;
+  }
+}
+
+void BUTTON_STRIP::update_leds( uint32_t time_ms )
+{
+  if( m_led_values_changed && time_ms - m_led_update_time_stamp_ms >= LED_I2C_UPDATE_TIME_MS && send_led_values( m_led_values ) )
+  {
+    m_led_values_changed        = false;
+    m_led_update_time_stamp_ms  = time_ms;
+  }
 }
 
  bool BUTTON_STRIP::update_steps( uint32_t time_ms, int overridden_segment )
@@ -47,7 +111,8 @@ void BUTTON_STRIP::send_led_values(uint8_t led_values)
 bool BUTTON_STRIP::update_free_play( uint32_t time_ms, uint32_t& activated_segment, int overridden_segment )
 {
   bool step_triggered = false;
-  bool update_leds    = update_steps( time_ms, overridden_segment ) || m_force_update;
+  bool leds_changed   = update_steps( time_ms, overridden_segment ) || m_force_update;
+  m_led_values_changed |= m_force_update;   // resend, even if unchanged
   m_force_update      = false;
   
   if( !m_buttons_locked )
@@ -76,7 +141,7 @@ bool BUTTON_STRIP::update_free_play( uint32_t time_ms, uint32_t& activated_segme
           m_step_num                = i;
           activated_segment         = i;
           step_triggered            = true;
-          update_leds               = true;
+          leds_changed              = true;
           m_next_step_time_stamp_ms = time_ms + m_step_length_ms;
   
           break; // only interested in the lowest button
@@ -84,116 +149,27 @@ bool BUTTON_STRIP::update_free_play( uint32_t time_ms, uint32_t& activated_segme
     }
   }
   
-  // read switch values
-  if( Wire.requestFrom( m_i2c_address, 1) )
-  {
-    m_switch_values = Wire.read();
-  }
+  // read switch values, ready for the next update
+  poll_switches( time_ms );
 
-  // write led values
-  if( update_leds )
+  if( leds_changed )
   {    
-    const uint8_t led_values = m_running ? (1 << m_step_num) : 0;
-    send_led_values( led_values );
+    set_led_values( m_running ? (1 << m_step_num) : 0 );
   }
+  update_leds( time_ms );
 
   return step_triggered;  
 }
 
-bool BUTTON_STRIP::update_play_sequence( uint32_t time_ms, uint32_t& activated_segment )
-{
-  bool update_leds    = update_steps( time_ms, -1 );
-  bool step_triggered = false;
-  
-  const SEQUENCE_EVENT& current_event = m_sequence_events[m_current_seq_event];
-
-  if( time_ms - m_seq_start_time_stamp >= current_event.m_time_stamp )
-  {
-    DEBUG_TEXT("triggered event:");
-    DEBUG_TEXT_LINE(current_event.m_segment);
-
-    m_step_num                = current_event.m_segment;
-    activated_segment         = current_event.m_segment;
-    step_triggered            = true;
-    update_leds               = true;
-    m_next_step_time_stamp_ms = time_ms + m_step_length_ms;
-    
-    if( ++m_current_seq_event == m_seq_num_events )
-    {
-      // loop the sequence
-      m_current_seq_event     = 0;
-      m_seq_start_time_stamp  = time_ms;
-    }
-  }
-
-  // write led values
-  if( update_leds )
-  {    
-    const uint8_t led_values = m_running ? (1 << m_step_num) : 0;
-    send_led_values( led_values );
-  }
-
-  return step_triggered;
-}
-
-void BUTTON_STRIP::record_sequence_event( uint32_t time_ms, int32_t activated_segment )
-{
-  Serial.print("record_sequence_event:");
-  Serial.println(activated_segment);
-  
-  // TODO end the sequence (with final event) when it gets full
-  ASSERT_MSG( m_seq_num_events < MAX_SEQUENCE_EVENTS, "Max events exceeded" );
-  if( m_seq_num_events >= MAX_SEQUENCE_EVENTS )
-  {
-    // no space
-    return;
-  }
-  
-  const uint32_t event_time = time_ms - m_seq_start_time_stamp;
-  SEQUENCE_EVENT& event     = m_sequence_events[ m_seq_num_events++ ];
-  event.m_time_stamp        = event_time;
-  event.m_segment           = activated_segment;
-}
-
-void BUTTON_STRIP::clear_sequence()
-{
-  m_seq_num_events          = 0;
-  m_current_seq_event       = 0;  
-}
-
 bool BUTTON_STRIP::update( uint32_t time_ms, uint32_t& activated_segment, int overridden_segment )
 {
-  bool step_triggered = false;
-
-  switch( m_mode )
-  {
-    case MODE::FREE_PLAY:
-    case MODE::RECORD_SEQ:
-    {
-      step_triggered = update_free_play( time_ms, activated_segment, overridden_segment );
+  update_i2c();
 
-      if( m_mode == MODE::RECORD_SEQ && step_triggered )
-      {
-        record_sequence_event( time_ms, activated_segment );
-      }
-      break;
-    }
-    case MODE::PLAY_SEQ:
-    {
-      step_triggered = update_play_sequence( time_ms, activated_segment );
-      
-      break;
-    }      
-  }
-  return step_triggered;
+  return update_free_play( time_ms, activated_segment, overridden_segment );
 }
 
 void BUTTON_STRIP::start_free_play_sequence( uint32_t sequence_length_ms, uint32_t current_time_ms )
 {  
-  m_mode                    = MODE::FREE_PLAY;
-
-  clear_sequence();
-  
   m_step_length_ms          = sequence_length_ms / NUM_SEGMENTS;
     
   m_running                 = true;
@@ -201,47 +177,20 @@ void BUTTON_STRIP::start_free_play_sequence( uint32_t sequence_length_ms, uint32
   m_next_step_time_stamp_ms = current_time_ms;
 }
 
-void BUTTON_STRIP::start_record_sequence( uint32_t time_ms )
-{
-  Serial.println("start_record_sequence");
-
-  clear_sequence();
-  
-  m_mode                    = MODE::RECORD_SEQ;
-  m_seq_start_time_stamp    = time_ms;
-
-  m_initial_seq_segment     = m_step_num;
-}
-
-void BUTTON_STRIP::start_sequence_playback( uint32_t time_ms )
-{
-  Serial.println("start_sequence_playback");
-  
-  m_mode                    = MODE::PLAY_SEQ;
-  
-  // record the final event
-  ++m_seq_num_events;
-  record_sequence_event( time_ms, m_initial_seq_segment );    
-
-  m_current_seq_event       = 0;
-  m_seq_start_time_stamp    = time_ms; // TODO store time offset from beginning of current segement
-}
-
 void BUTTON_STRIP::stop_sequence()
 {
   m_running       = false;
-  m_mode          = MODE::FREE_PLAY;
   m_force_update  = true; 
 }
 
-BUTTON_STRIP::MODE BUTTON_STRIP::mode() const
+void BUTTON_STRIP::lock_buttons( bool lock )
 {
-  return m_mode;
+  m_buttons_locked = lock;
 }
 
-void BUTTON_STRIP::lock_buttons( bool lock )
+void BUTTON_STRIP::set_switch_poll_time_ms( uint32_t poll_time_ms )
 {
-  m_buttons_locked = lock;
+  m_switch_poll_time_ms = poll_time_ms;
 }
 
 int BUTTON_STRIP::num_segments() const
@@ -2,24 +2,19 @@
 
 #include <stdint.h>
 
+#include "I2CAsync.h"
+
 
 class BUTTON_STRIP
 {
 public:
 
-  enum class MODE
-  {
-    FREE_PLAY,
-    RECORD_SEQ,
-    PLAY_SEQ
-  };
-
   static const constexpr int NUM_SEGMENTS               = 8;
   
 private:
   static const constexpr int32_t BUTTON_DEBOUNCE_MS     = 5;
   static const constexpr int64_t LED_I2C_UPDATE_TIME_MS = 30;
-  static const constexpr int MAX_SEQUENCE_EVENTS        = 32;
+  static const constexpr uint32_t DEFAULT_SWITCH_POLL_TIME_MS = 5;
 
   struct DEBOUNCE_DETAILS
   {
@@ -28,55 +23,51 @@ private:
     uint32_t        m_time_stamp                = 0;
   };
 
-  struct SEQUENCE_EVENT
-  {
-    uint32_t        m_time_stamp                = 0;
-    int16_t         m_segment                   = 0;
-  };
-  
   const int         m_i2c_address; 
+  I2C_ASYNC         m_i2c;
+  int               m_switch_read               = I2C_ASYNC::INVALID_TRANSACTION;
+  int               m_led_write                 = I2C_ASYNC::INVALID_TRANSACTION;
+  uint32_t          m_switch_poll_time_ms       = DEFAULT_SWITCH_POLL_TIME_MS;
+  uint32_t          m_switch_poll_time_stamp_ms = 0;
   uint8_t           m_switch_values             = 0;
   uint8_t           m_step_num                  = 0;
   
   uint32_t          m_step_length_ms            = 0;
   uint32_t          m_next_step_time_stamp_ms   = 0;
 
-  MODE              m_mode                      = MODE::FREE_PLAY;
-
   bool              m_running                   = false;
   bool              m_buttons_locked            = false;
   bool              m_force_update              = true;
 
+  uint8_t           m_led_values                = 0;
+  bool              m_led_values_changed        = false;
+  uint32_t          m_led_update_time_stamp_ms  = 0;
+
   DEBOUNCE_DETAILS  m_debounce_details[NUM_SEGMENTS];
 
-  SEQUENCE_EVENT    m_sequence_events[MAX_SEQUENCE_EVENTS];
-  uint16_t          m_current_seq_event         = 0;
-  uint16_t          m_seq_num_events            = 0;
-  uint32_t          m_seq_start_time_stamp      = 0;
-  uint8_t           m_initial_seq_segment       = 0;
 
 
-  void              send_led_values(uint8_t led_values);
+  bool              send_led_values(uint8_t led_values);
+  void              update_i2c();                       // collects finished transactions, switch values are latched for the next update
+  void              poll_switches( uint32_t time_ms );
+  void              set_led_values( uint8_t led_values );
+  void              update_leds( uint32_t time_ms );    // sends changed values, at most once per LED_I2C_UPDATE_TIME_MS
   bool              update_steps( uint32_t time_ms, int overridden );
   bool              update_free_play( uint32_t time_ms, uint32_t& activated_segment, int overridden_segment );
-  bool              update_play_sequence( uint32_t time_ms, uint32_t& activated_segment );
-  void              record_sequence_event( uint32_t time_ms, int32_t activated_segment );
   
 public:
 
   BUTTON_STRIP( int i2c_address );
+
+  void              begin();                            // after Wire.begin()
   
   bool              update( uint32_t time_ms, uint32_t& activated_segment, int overridden_segment = -1 );
   
   void              start_free_play_sequence( uint32_t sequence_length_ms, uint32_t current_time_ms );
-  void              start_record_sequence(uint32_t time_ms );
-  void              start_sequence_playback( uint32_t time_ms );
   void              stop_sequence();
-  void              clear_sequence();
-
-  MODE              mode() const;
 
   void              lock_buttons( bool lock );
+  void              set_switch_poll_time_ms( uint32_t poll_time_ms );
 
   int               num_segments() const;
 };
@@ -0,0 +1,169 @@
+#include "ClockInput.h"
+#include "Util.h"
+
+CLOCK_INPUT* CLOCK_INPUT::s_instance = nullptr;
+
+CLOCK_INPUT::CLOCK_INPUT() :
+  m_edge_cycles(),
+  m_edge_write_index(0),
+  m_edge_read_index(0),
+  m_last_edge_cycles(0),
+  m_reset_pending(false),
+  m_have_edge(false),
+  m_previous_edge_cycles(0),
+  m_predicted_edge_cycles(0),
+  m_period(0.0f),
+  m_lock_count(0),
+  m_locked(false)
+{
+
+}
+
+void CLOCK_INPUT::begin( int clock_pin, int reset_pin )
+{
+  ASSERT_MSG( s_instance == nullptr, "CLOCK_INPUT::begin() only one clock input" );
+  s_instance = this;
+
+  // enable the cycle counter
+  ARM_DEMCR     |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL  |= ARM_DWT_CTRL_CYCCNTENA;
+
+  pinMode( clock_pin, INPUT );
+  pinMode( reset_pin, INPUT );
+  attachInterrupt( digitalPinToInterrupt( clock_pin ), clock_edge_isr, RISING );
+  attachInterrupt( digitalPinToInterrupt( reset_pin ), reset_edge_isr, RISING );
+}
+
+void CLOCK_INPUT::update()
+{
+  const uint32_t write_index = m_edge_write_index;
+  if( write_index - m_edge_read_index > MAX_PENDING_EDGES )
+  {
+    // main loop stalled, the oldest edges were overwritten
+    m_edge_read_index = write_index - MAX_PENDING_EDGES;
+  }
+
+  while( m_edge_read_index != write_index )
+  {
+    process_edge( m_edge_cycles[m_edge_read_index % MAX_PENDING_EDGES] );
+    ++m_edge_read_index;
+  }
+
+  if( m_have_edge && m_period > 0.0f )
+  {
+    const float late = static_cast<int32_t>( ARM_DWT_CYCCNT - m_predicted_edge_cycles ) / CYCLES_PER_SAMPLE;
+    if( late > m_period * ( TIMEOUT_PERIODS - 1.0f ) )
+    {
+      DEBUG_TEXT_LINE( "CLOCK_INPUT stopped" );
+
+      m_have_edge   = false;
+      m_period      = 0.0f;
+      m_lock_count  = 0;
+      m_locked      = false;
+    }
+  }
+}
+
+bool CLOCK_INPUT::locked() const
+{
+  return m_locked;
+}
+
+float CLOCK_INPUT::period_samples() const
+{
+  return m_period;
+}
+
+bool CLOCK_INPUT::reset_triggered()
+{
+  if( m_reset_pending )
+  {
+    m_reset_pending = false;
+    return true;
+  }
+
+  return false;
+}
+
+uint32_t CLOCK_INPUT::num_edges() const
+{
+  return m_edge_write_index;
+}
+
+void CLOCK_INPUT::process_edge( uint32_t edge_cycles )
+{
+  if( !m_have_edge )
+  {
+    m_have_edge             = true;
+    m_previous_edge_cycles  = edge_cycles;
+    return;
+  }
+
+  const float interval = ( edge_cycles - m_previous_edge_cycles ) / CYCLES_PER_SAMPLE;
+  m_previous_edge_cycles = edge_cycles;
+
+  if( m_period == 0.0f )
+  {
+    acquire( edge_cycles, interval );
+    return;
+  }
+
+  const float error = static_cast<int32_t>( edge_cycles - m_predicted_edge_cycles ) / CYCLES_PER_SAMPLE;
+  if( fabsf( error ) > m_period * UNLOCK_ERROR )
+  {
+    // tempo change, or a missed or extra edge
+    if( m_locked )
+    {
+      DEBUG_TEXT_LINE( "CLOCK_INPUT lost lock" );
+    }
+    acquire( edge_cycles, interval );
+    return;
+  }
+
+  // move the phase part of the way to the edge, and correct the period by a smaller fraction of the error
+  const float phase_correction  = PHASE_GAIN * error;
+  m_period                      += PERIOD_GAIN * error;
+  m_predicted_edge_cycles       += static_cast<int32_t>( ( m_period + phase_correction ) * CYCLES_PER_SAMPLE );
+
+  if( fabsf( error ) < m_period * LOCK_ERROR )
+  {
+    if( !m_locked && ++m_lock_count >= LOCK_EDGES )
+    {
+      DEBUG_TEXT( "CLOCK_INPUT locked, period (samples): " );
+      DEBUG_TEXT_LINE( m_period );
+      m_locked = true;
+    }
+  }
+  else
+  {
+    m_lock_count = 0;
+  }
+}
+
+void CLOCK_INPUT::acquire( uint32_t edge_cycles, float period )
+{
+  m_period                = period;
+  m_predicted_edge_cycles = edge_cycles + static_cast<uint32_t>( period * CYCLES_PER_SAMPLE );
+  m_lock_count            = 0;
+  m_locked                = false;
+}
+
+void CLOCK_INPUT::clock_edge_isr()
+{
+  const uint32_t cycles = ARM_DWT_CYCCNT;
+
+  CLOCK_INPUT& clock = *s_instance;
+  if( clock.m_edge_write_index > 0 && cycles - clock.m_last_edge_cycles < MIN_EDGE_INTERVAL_US * ( F_CPU / 1000000 ) )
+  {
+    return;
+  }
+
+  clock.m_last_edge_cycles                                        = cycles;
+  clock.m_edge_cycles[clock.m_edge_write_index % MAX_PENDING_EDGES] = cycles;
+  clock.m_edge_write_index                                        = clock.m_edge_write_index + 1;
+}
+
+void CLOCK_INPUT::reset_edge_isr()
+{
+  s_instance->m_reset_pending = true;
+}
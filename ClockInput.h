@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Audio.h>
+
+// External clock and reset gate inputs.
+// Each rising edge is time stamped in its pin interrupt with the cycle counter, which runs from the same crystal as the
+// audio sample clock, so the stamps convert exactly to samples. update() runs the edges through a phase locked loop
+// (an alpha-beta filter on the edge timing error), which averages out the jitter of the source and of the interrupt.
+
+class CLOCK_INPUT
+{
+public:
+
+  static constexpr const int      MAX_PENDING_EDGES     = 8;
+  static constexpr const float    CYCLES_PER_SAMPLE     = F_CPU / AUDIO_SAMPLE_RATE_EXACT;
+  static constexpr const uint32_t MIN_EDGE_INTERVAL_US  = 1000;     // ignore contact bounce and ringing
+  static constexpr const float    PHASE_GAIN            = 0.25f;    // alpha - fraction of the timing error applied to the phase
+  static constexpr const float    PERIOD_GAIN           = 0.035f;   // beta - approx critically damped with PHASE_GAIN
+  static constexpr const float    LOCK_ERROR            = 0.02f;    // of the period
+  static constexpr const float    UNLOCK_ERROR          = 0.25f;    // of the period, a larger error re-acquires the clock
+  static constexpr const int      LOCK_EDGES            = 4;        // consecutive edges within LOCK_ERROR before locking
+  static constexpr const float    TIMEOUT_PERIODS       = 2.5f;     // missing edges before the clock is considered stopped
+
+  CLOCK_INPUT();
+
+  void                begin( int clock_pin, int reset_pin );
+
+  void                update();                     // from the main loop, processes the edges since the last update
+
+  bool                locked() const;
+  float               period_samples() const;       // 0 until the clock is acquired
+  bool                reset_triggered();            // true once for each reset edge
+  uint32_t            num_edges() const;
+
+private:
+
+  volatile uint32_t   m_edge_cycles[MAX_PENDING_EDGES];   // ring written by the interrupt
+  volatile uint32_t   m_edge_write_index;
+  uint32_t            m_edge_read_index;
+  volatile uint32_t   m_last_edge_cycles;
+  volatile bool       m_reset_pending;
+
+  bool                m_have_edge;
+  uint32_t            m_previous_edge_cycles;
+  uint32_t            m_predicted_edge_cycles;
+  float               m_period;                     // in samples
+  int                 m_lock_count;
+  bool                m_locked;
+
+  static CLOCK_INPUT* s_instance;                   // for the interrupt handlers
+
+  void                process_edge( uint32_t edge_cycles );
+  void                acquire( uint32_t edge_cycles, float period );
+
+  static void         clock_edge_isr();
+  static void         reset_edge_isr();
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+
+// Single producer, single consumer ring of commands.
+// The producer only writes m_head and the consumer only writes m_tail, so commands can be posted from one context and
+// processed in another (e.g. the UI and update_main_loop(), or an interrupt and the main loop) without disabling interrupts.
+
+template< typename COMMAND, int QUEUE_SIZE >
+class COMMAND_QUEUE
+{
+public:
+
+  COMMAND_QUEUE() :
+    m_queue(),
+    m_head(0),
+    m_tail(0)
+  {
+
+  }
+
+  bool push( const COMMAND& command )
+  {
+    const int next_head = ( m_head + 1 ) % QUEUE_SIZE;
+    if( next_head == m_tail )
+    {
+      // full
+      return false;
+    }
+
+    m_queue[m_head] = command;
+
+    // the command must be written before the consumer can see it
+    std::atomic_signal_fence( std::memory_order_release );
+    m_head = next_head;
+
+    return true;
+  }
+
+  bool pop( COMMAND& command )
+  {
+    if( m_tail == m_head )
+    {
+      return false;
+    }
+
+    std::atomic_signal_fence( std::memory_order_acquire );
+    command = m_queue[m_tail];
+
+    std::atomic_signal_fence( std::memory_order_release );
+    m_tail = ( m_tail + 1 ) % QUEUE_SIZE;
+
+    return true;
+  }
+
+  bool empty() const
+  {
+    return m_head == m_tail;
+  }
+
+private:
+
+  COMMAND             m_queue[QUEUE_SIZE];
+  volatile int        m_head;
+  volatile int        m_tail;
+};
@@ -2,3 +2,8 @@
 
 #define DEBUG_OUTPUT
 //#define SHOW_TIMED_SECTIONS
+//#define SHOW_SCHEDULER_STATS
+//#define PROFILE_AUDIO_INTERRUPT
+//#define PROFILE_MAIN_LOOP
+//#define BENCHMARK_DSP
+//#define TRACK_AUDIO_BLOCKS
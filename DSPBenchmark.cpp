@@ -0,0 +1,321 @@
+#include <utility/dspinst.h>
+
+#include "DSPBenchmark.h"
+#include "Util.h"
+#include "AudioOutputStage.h"
+#include "AudioRecordQueue.h"
+
+#ifdef HOST_BUILD
+#include <chrono>
+#endif
+
+namespace
+{
+  constexpr const int32_t UNITY_GAIN        = 65536;
+  constexpr const int     MAX_STAGE_BLOCKS  = 2;
+  constexpr const int     SOURCE_SIZE       = AUDIO_BLOCK_SAMPLES * 2;   // a block and the one after it
+
+  // aligned as audio block data is, the output stage kernels work on pairs of samples
+  int16_t       source_samples[SOURCE_SIZE] __attribute__((aligned(4)));
+  int16_t       output_samples[AUDIO_BLOCK_SAMPLES] __attribute__((aligned(4)));
+  audio_block_t queue_block;
+  volatile int  sink;       // consumes the output, so the kernels can't be optimised away
+
+  int16_t       stage_inputs[AUDIO_OUTPUT_STAGE::NUM_INPUTS][AUDIO_BLOCK_SAMPLES] __attribute__((aligned(4)));
+  int16_t       stage_blocks[MAX_STAGE_BLOCKS - 1][AUDIO_BLOCK_SAMPLES] __attribute__((aligned(4)));
+  int           num_stage_blocks = 0;
+
+  void fill_source()
+  {
+    // noise at about -6dB, the soft clip and interpolation costs don't depend on the material
+    uint32_t seed = 12345;
+    for( int i = 0; i < SOURCE_SIZE; ++i )
+    {
+      seed              = ( seed * 1664525 ) + 1013904223;
+      source_samples[i] = static_cast<int16_t>( seed >> 16 ) / 2;
+    }
+  }
+
+  void consume_output()
+  {
+    int sum = 0;
+    for( int i = 0; i < AUDIO_BLOCK_SAMPLES; ++i )
+    {
+      sum += output_samples[i];
+    }
+    sink = sum;
+  }
+
+  void copy_source_to_output()
+  {
+    for( int i = 0; i < AUDIO_BLOCK_SAMPLES; ++i )
+    {
+      output_samples[i] = source_samples[i];
+    }
+  }
+
+  // a block of output from update_playing_interrupt(), crossing source blocks as the speed requires
+  void varispeed_block( float speed )
+  {
+    float read_head = 0.0f;
+    int write_head  = 0;
+    while( write_head < AUDIO_BLOCK_SAMPLES )
+    {
+      DSP_UTILS::read_with_speed( source_samples, AUDIO_BLOCK_SAMPLES, output_samples, speed, read_head, write_head, AUDIO_BLOCK_SAMPLES );
+      if( read_head >= AUDIO_BLOCK_SAMPLES )
+      {
+        read_head -= AUDIO_BLOCK_SAMPLES;
+      }
+    }
+  }
+
+  //// Output stage, against the AudioAmplifier and AudioMixer4 graph it replaced
+
+  // stands in for AudioStream::allocate() - the first block allocated carries the main output of the old graph
+  int16_t* allocate_stage_block()
+  {
+    ASSERT_MSG( num_stage_blocks < MAX_STAGE_BLOCKS, "allocate_stage_block() out of blocks" );
+    const int block = num_stage_blocks++;
+    return block == 0 ? output_samples : stage_blocks[block - 1];
+  }
+
+  void prepare_stage()
+  {
+    for( int i = 0; i < AUDIO_OUTPUT_STAGE::NUM_INPUTS; ++i )
+    {
+      memcpy( stage_inputs[i], source_samples, sizeof(stage_inputs[i]) );
+    }
+    num_stage_blocks = 0;
+  }
+
+  AUDIO_OUTPUT_STAGE::GAINS stage_gains( float input_gain )
+  {
+    AUDIO_OUTPUT_STAGE::GAINS gains;
+    gains.m_input_gain      = round_to_int( input_gain * UNITY_GAIN );
+    gains.m_looper_mix      = round_to_int( 0.5f * UNITY_GAIN );
+    gains.m_delay_feedback  = round_to_int( 0.4f * UNITY_GAIN );
+    gains.m_delay_mix       = round_to_int( 0.3f * UNITY_GAIN );
+    return gains;
+  }
+
+  // the sample player's block is the output block, as the stage writes the output over it
+  void prepare_in_place_stage()
+  {
+    prepare_stage();
+    memcpy( output_samples, source_samples, sizeof(output_samples) );
+  }
+
+  // the outputs are written over the writable input blocks, as AUDIO_OUTPUT_STAGE::update() does
+  void output_stage_block( const AUDIO_OUTPUT_STAGE::GAINS& gains )
+  {
+    int16_t* audio  = stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_AUDIO];
+    int16_t* delay  = stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_DELAY_RETURN];
+    int16_t* record = gains.m_input_gain == UNITY_GAIN ? nullptr : audio;
+
+    AUDIO_OUTPUT_STAGE::mix_block( audio, stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_LOOPER], output_samples, delay,
+                                   output_samples, delay, record, gains, gains );
+  }
+
+  // the inner loops of AudioAmplifier and AudioMixer4
+  void apply_gain( int16_t* data, int32_t mult )
+  {
+    uint32_t* words = reinterpret_cast<uint32_t*>( data );
+    for( int i = 0; i < AUDIO_BLOCK_SAMPLES / 2; ++i )
+    {
+      const uint32_t pair = words[i];
+      const int32_t b     = signed_saturate_rshift( signed_multiply_32x16b( mult, pair ), 16, 0 );
+      const int32_t t     = signed_saturate_rshift( signed_multiply_32x16t( mult, pair ), 16, 0 );
+      words[i]            = pack_16b_16b( t, b );
+    }
+  }
+
+  void apply_gain_then_add( int16_t* data, const int16_t* in, int32_t mult )
+  {
+    uint32_t* words           = reinterpret_cast<uint32_t*>( data );
+    const uint32_t* in_words  = reinterpret_cast<const uint32_t*>( in );
+    for( int i = 0; i < AUDIO_BLOCK_SAMPLES / 2; ++i )
+    {
+      if( mult == UNITY_GAIN )
+      {
+        words[i]          = signed_add_16_and_16( words[i], in_words[i] );
+      }
+      else
+      {
+        const uint32_t pair = in_words[i];
+        const int32_t b     = signed_saturate_rshift( signed_multiply_32x16b( mult, pair ), 16, 0 );
+        const int32_t t     = signed_saturate_rshift( signed_multiply_32x16t( mult, pair ), 16, 0 );
+        words[i]            = signed_add_16_and_16( words[i], pack_16b_16b( t, b ) );
+      }
+    }
+  }
+
+  // receiveWritable() of a block another node also receives
+  int16_t* copy_shared_block( const int16_t* data )
+  {
+    int16_t* copy = allocate_stage_block();
+    memcpy( copy, data, AUDIO_BLOCK_SAMPLES * sizeof(int16_t) );
+    return copy;
+  }
+
+  // a channel at unity gain skips its gain pass, as AudioMixer4 does
+  void mixer_channel_0( int16_t* data, int32_t mult )
+  {
+    if( mult != UNITY_GAIN )
+    {
+      apply_gain( data, mult );
+    }
+  }
+
+  void old_graph_block( const AUDIO_OUTPUT_STAGE::GAINS& gains )
+  {
+    // input AudioAmplifier - it has the input block to itself, so applies the gain in place
+    int16_t* gained = stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_AUDIO];
+    mixer_channel_0( gained, gains.m_input_gain );
+
+    // looper mixer - the gained input also goes to the recorder, so is copied
+    int16_t* dry = copy_shared_block( gained );
+    mixer_channel_0( dry, UNITY_GAIN - gains.m_looper_mix );
+    apply_gain_then_add( dry, stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_LOOPER], gains.m_looper_mix );
+    apply_gain_then_add( dry, stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_SAMPLES], gains.m_looper_mix );
+
+    // delay feedback mixer - the dry mix also goes to the output mixer, so is copied
+    int16_t* send = copy_shared_block( dry );
+    mixer_channel_0( send, UNITY_GAIN );
+    apply_gain_then_add( send, stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_DELAY_RETURN], gains.m_delay_feedback );
+
+    // output mixer - the last to receive the dry mix, so has it to itself
+    mixer_channel_0( dry, UNITY_GAIN - gains.m_delay_mix );
+    apply_gain_then_add( dry, stage_inputs[AUDIO_OUTPUT_STAGE::INPUT_DELAY_RETURN], gains.m_delay_mix );
+  }
+}
+
+void DSP_BENCHMARK::release_block_func( audio_block_t* /*block*/ )
+{
+  // the benchmark block isn't from the pool
+}
+
+uint32_t DSP_BENCHMARK::timestamp()
+{
+#ifdef HOST_BUILD
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint32_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( now ).count() );
+#else
+  return ARM_DWT_CYCCNT;
+#endif
+}
+
+template< typename PREPARE, typename KERNEL >
+DSP_BENCHMARK::RESULT DSP_BENCHMARK::time_kernel( PREPARE prepare, KERNEL kernel )
+{
+  uint32_t min_time   = 0xFFFFFFFF;
+  uint64_t total_time = 0;
+
+  for( int i = 0; i < NUM_ITERATIONS; ++i )
+  {
+    prepare();
+
+    const uint32_t start  = timestamp();
+    kernel();
+    const uint32_t time   = timestamp() - start;
+
+    consume_output();
+
+    min_time    = min_val( min_time, time );
+    total_time  += time;
+  }
+
+  RESULT result;
+  result.m_min  = min_time;
+  result.m_mean = static_cast<uint32_t>( total_time / NUM_ITERATIONS );
+  return result;
+}
+
+void DSP_BENCHMARK::print_result( const char* kernel_name, const RESULT& result )
+{
+#ifdef HOST_BUILD
+  const char* units = "ns";
+#else
+  const char* units = "cycles";
+#endif
+
+  DEBUG_TEXT( kernel_name );
+  DEBUG_TEXT( " min:" );
+  DEBUG_TEXT( result.m_min );
+  DEBUG_TEXT( " mean:" );
+  DEBUG_TEXT( result.m_mean );
+  DEBUG_TEXT( " " );
+  DEBUG_TEXT( units );
+  DEBUG_TEXT_LINE( "/block" );
+}
+
+void DSP_BENCHMARK::run()
+{
+#ifndef HOST_BUILD
+  // enable the cycle counter
+  ARM_DEMCR     |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL  |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+
+  fill_source();
+
+  auto no_prepare = [](){};
+
+  DEBUG_TEXT( "DSP benchmark, iterations: " );
+  DEBUG_TEXT_LINE( NUM_ITERATIONS );
+
+  print_result( "read_sample_cubic", time_kernel( no_prepare, []()
+  {
+    for( int i = 0; i < AUDIO_BLOCK_SAMPLES; ++i )
+    {
+      // the interpolation at the end of the block reads the first sample of the next, as it does in the recorder
+      output_samples[i] = DSP_UTILS::read_sample_cubic( i + 0.37f, source_samples, AUDIO_BLOCK_SAMPLES + 1 );
+    }
+  } ) );
+
+  print_result( "soft_clip_sample", time_kernel( no_prepare, []()
+  {
+    for( int i = 0; i < AUDIO_BLOCK_SAMPLES; ++i )
+    {
+      output_samples[i] = DSP_UTILS::soft_clip_sample( source_samples[i], CLIP_COEFFICIENT );
+    }
+  } ) );
+
+  print_result( "overdub mix", time_kernel( copy_source_to_output, []()
+  {
+    DSP_UTILS::mix_overdub( output_samples, source_samples, AUDIO_BLOCK_SAMPLES, CLIP_COEFFICIENT );
+  } ) );
+
+  print_result( "varispeed 0.5x", time_kernel( no_prepare, [](){ varispeed_block( 0.5f ); } ) );
+  print_result( "varispeed 1x", time_kernel( no_prepare, [](){ varispeed_block( 1.0f ); } ) );
+  print_result( "varispeed 1.5x", time_kernel( no_prepare, [](){ varispeed_block( 1.5f ); } ) );
+
+  // blocks allocated is per update, the recorder holds the record block either way
+  const float input_gains[] = { 0.8f, 1.0f };
+  for( float input_gain : input_gains )
+  {
+    const AUDIO_OUTPUT_STAGE::GAINS gains = stage_gains( input_gain );
+
+    DEBUG_TEXT( "input gain " );
+    DEBUG_TEXT_LINE( input_gain );
+
+    print_result( "output stage", time_kernel( prepare_in_place_stage, [&gains](){ output_stage_block( gains ); } ) );
+    DEBUG_TEXT( "output stage blocks allocated: " );
+    DEBUG_TEXT_LINE( num_stage_blocks );
+
+    print_result( "amp and 3 mixers", time_kernel( prepare_stage, [&gains](){ old_graph_block( gains ); } ) );
+    DEBUG_TEXT( "amp and 3 mixers blocks allocated: " );
+    DEBUG_TEXT_LINE( num_stage_blocks );
+  }
+
+  DSP_BENCHMARK producer;
+  AUDIO_RECORD_QUEUE<QUEUE_SIZE, DSP_BENCHMARK> queue( producer, "benchmark" );
+  queue.start();
+
+  // the traffic through a queue for each block - added in the interrupt, read and released from the main loop
+  print_result( "queue add/read/release", time_kernel( no_prepare, [&queue]()
+  {
+    queue.add_block( &queue_block );
+    output_samples[0] = queue.read_block()->data[0];
+    queue.release_buffer();
+  } ) );
+}
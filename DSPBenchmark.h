@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Audio.h>
+#include "CompileSwitches.h"
+
+// Microbenchmarks for the audio interrupt kernels, reported per 128 sample block so optimisations have a before and
+// after number. On the Teensy each kernel is timed with the DWT cycle counter, run from setup() with BENCHMARK_DSP in
+// CompileSwitches.h. The same kernels build on the host, timed in nanoseconds, with Tools/dsp_bench.cpp.
+// Each kernel is run NUM_ITERATIONS times and the minimum is reported alongside the mean, as the minimum excludes
+// any interrupts which land in the timed section.
+
+class DSP_BENCHMARK
+{
+public:
+
+  static constexpr const int      NUM_ITERATIONS      = 1000;
+  static constexpr const int      QUEUE_SIZE          = 16;
+  static constexpr const float    CLIP_COEFFICIENT    = 0.25f;
+
+  static void         run();
+
+  //// For AUDIO_RECORD_QUEUE
+  void                release_block_func( audio_block_t* block );
+
+private:
+
+  struct RESULT
+  {
+    uint32_t          m_min                 = 0;
+    uint32_t          m_mean                = 0;
+  };
+
+  template< typename PREPARE, typename KERNEL >
+  static RESULT       time_kernel( PREPARE prepare, KERNEL kernel );
+
+  static uint32_t     timestamp();
+  static void         print_result( const char* kernel_name, const RESULT& result );
+};
@@ -0,0 +1,121 @@
+#include "DialScanner.h"
+#include "Util.h"
+
+DIAL_SCANNER* DIAL_SCANNER::s_instance = nullptr;
+
+// overrides the weak vector in the Teensy core, enabled by ADC::enableInterrupts( ADC_1 )
+extern "C" void adc1_isr()
+{
+  DIAL_SCANNER::conversion_complete_isr();
+}
+
+DIAL_SCANNER::DIAL_SCANNER() :
+  m_adc(nullptr),
+  m_timer(),
+  m_pins(),
+  m_num_pins(0),
+  m_filtered(),
+  m_current_pin(0),
+  m_scanning(false),
+  m_first_scan(true),
+  m_num_scans(0)
+{
+
+}
+
+int DIAL_SCANNER::add_pin( int pin )
+{
+  ASSERT_MSG( m_adc == nullptr, "DIAL_SCANNER::add_pin() after begin()" );
+  ASSERT_MSG( m_num_pins < MAX_PINS, "DIAL_SCANNER::add_pin() too many pins" );
+  if( m_num_pins >= MAX_PINS )
+  {
+    return -1;
+  }
+
+  m_pins[m_num_pins] = pin;
+  return m_num_pins++;
+}
+
+void DIAL_SCANNER::begin( ADC& adc )
+{
+  ASSERT_MSG( s_instance == nullptr, "DIAL_SCANNER::begin() only one scanner is supported" );
+
+  m_adc       = &adc;
+  s_instance  = this;
+
+  adc.setAveraging( HARDWARE_AVERAGING, ADC_1 );
+  adc.enableInterrupts( ADC_1 );
+
+  m_timer.begin( start_scan_interrupt, 1000000 / SCAN_RATE_HZ );
+}
+
+int DIAL_SCANNER::value( int channel ) const
+{
+  if( channel < 0 || channel >= m_num_pins )
+  {
+    return 0;
+  }
+
+  return m_filtered[channel] >> SMOOTHING_SHIFT;
+}
+
+uint32_t DIAL_SCANNER::num_scans() const
+{
+  return m_num_scans;
+}
+
+void DIAL_SCANNER::start_scan_interrupt()
+{
+  DIAL_SCANNER* scanner = s_instance;
+
+  // skip a tick rather than restarting a scan which hasn't finished
+  if( scanner == nullptr || scanner->m_scanning || scanner->m_num_pins == 0 )
+  {
+    return;
+  }
+
+  scanner->m_scanning     = true;
+  scanner->m_current_pin  = 0;
+  scanner->m_adc->startSingleRead( scanner->m_pins[0], ADC_1 );
+}
+
+void DIAL_SCANNER::conversion_complete_isr()
+{
+  if( s_instance != nullptr )
+  {
+    s_instance->conversion_complete_interrupt();
+  }
+}
+
+void DIAL_SCANNER::conversion_complete_interrupt()
+{
+  // reading the result clears the interrupt
+  const int32_t sample = m_adc->readSingle( ADC_1 );
+
+  if( !m_scanning )
+  {
+    return;
+  }
+
+  const int pin = m_current_pin;
+  if( m_first_scan )
+  {
+    m_filtered[pin] = sample << SMOOTHING_SHIFT;
+  }
+  else
+  {
+    m_filtered[pin] = m_filtered[pin] + sample - ( m_filtered[pin] >> SMOOTHING_SHIFT );
+  }
+
+  if( pin + 1 < m_num_pins )
+  {
+    m_current_pin = pin + 1;
+    m_adc->startSingleRead( m_pins[pin + 1], ADC_1 );
+  }
+  else
+  {
+    m_scanning    = false;
+    m_first_scan  = false;
+    ++m_num_scans;
+  }
+}
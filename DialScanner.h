@@ -0,0 +1,46 @@
+#pragma once
+
+#include <ADC.h>
+
+// Samples the dial pins in the background on ADC_1, so the main loop never waits on a conversion.
+// A timer interrupt starts a scan, and each conversion complete interrupt stores the result and starts the next pin.
+// Every conversion is averaged in hardware, then smoothed per pin - DIAL::update() just reads the latest value.
+
+class DIAL_SCANNER
+{
+public:
+
+  static constexpr const int MAX_PINS             = 8;
+  static constexpr const int SCAN_RATE_HZ         = 1000;
+  static constexpr const int HARDWARE_AVERAGING   = 16;
+  static constexpr const int SMOOTHING_SHIFT      = 3;      // one-pole filter of 1/8 per scan, approx 8ms time constant
+
+  DIAL_SCANNER();
+
+  int                 add_pin( int pin );       // before begin(), returns the channel to read with value()
+  void                begin( ADC& adc );
+
+  int                 value( int channel ) const;   // 16 bit
+  uint32_t            num_scans() const;
+
+  static void         conversion_complete_isr();    // called from adc1_isr()
+
+private:
+
+  ADC*                m_adc;
+  IntervalTimer       m_timer;
+
+  int                 m_pins[MAX_PINS];
+  int                 m_num_pins;
+
+  volatile int32_t    m_filtered[MAX_PINS];     // with SMOOTHING_SHIFT bits of fraction
+  volatile int        m_current_pin;
+  volatile bool       m_scanning;
+  volatile bool       m_first_scan;
+  volatile uint32_t   m_num_scans;
+
+  static DIAL_SCANNER* s_instance;              // for the interrupt handlers
+
+  static void         start_scan_interrupt();
+  void                conversion_complete_interrupt();
+};
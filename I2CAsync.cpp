@@ -0,0 +1,235 @@
+#include "I2CAsync.h"
+#include "Util.h"
+
+I2C_ASYNC* I2C_ASYNC::s_instance = nullptr;
+
+I2C_ASYNC::I2C_ASYNC() :
+  m_transactions(),
+  m_submit_index(0),
+  m_start_index(0),
+  m_active_index(-1),
+  m_start_time_us(0),
+  m_num_errors(0)
+{
+
+}
+
+void I2C_ASYNC::begin()
+{
+  ASSERT_MSG( s_instance == nullptr, "I2C_ASYNC::begin() only one I2C0 bus" );
+  ASSERT_MSG( I2C0_F != 0, "I2C_ASYNC::begin() call Wire.begin() first, to set the clock" );
+  s_instance = this;
+
+  // replaces the Wire slave handler in the RAM vector table
+  I2C0_C1 = I2C_C1_IICEN;
+  I2C0_S  = I2C_S_IICIF | I2C_S_ARBL;
+  attachInterruptVector( IRQ_I2C0, i2c0_interrupt );
+  NVIC_ENABLE_IRQ( IRQ_I2C0 );
+}
+
+int I2C_ASYNC::submit_write( uint8_t address, const uint8_t* data, int size )
+{
+  return submit( OP::WRITE, address, data, size );
+}
+
+int I2C_ASYNC::submit_read( uint8_t address, int size )
+{
+  return submit( OP::READ, address, nullptr, size );
+}
+
+int I2C_ASYNC::submit( OP op, uint8_t address, const uint8_t* data, int size )
+{
+  ASSERT_MSG( size > 0 && size <= MAX_DATA_SIZE, "I2C_ASYNC::submit() invalid size" );
+
+  TRANSACTION& transaction = m_transactions[m_submit_index];
+  if( transaction.m_status != STATUS::FREE || size <= 0 || size > MAX_DATA_SIZE )
+  {
+    return INVALID_TRANSACTION;
+  }
+
+  transaction.m_address       = address;
+  transaction.m_op            = op;
+  transaction.m_size          = size;
+  transaction.m_transferred   = 0;
+  if( data != nullptr )
+  {
+    memcpy( transaction.m_data, data, size );
+  }
+  transaction.m_status        = STATUS::PENDING;
+
+  const int index = m_submit_index;
+  m_submit_index  = ( m_submit_index + 1 ) % MAX_TRANSACTIONS;
+
+  update();
+
+  return index;
+}
+
+bool I2C_ASYNC::complete( int transaction ) const
+{
+  ASSERT_MSG( transaction >= 0 && transaction < MAX_TRANSACTIONS, "I2C_ASYNC::complete() invalid transaction" );
+
+  const STATUS status = m_transactions[transaction].m_status;
+  return status == STATUS::COMPLETE || status == STATUS::FAILED;
+}
+
+int I2C_ASYNC::finish( int transaction_index, uint8_t* data )
+{
+  if( !complete( transaction_index ) )
+  {
+    return -1;
+  }
+
+  TRANSACTION& transaction  = m_transactions[transaction_index];
+  const bool failed         = transaction.m_status == STATUS::FAILED;
+  const int transferred     = transaction.m_transferred;
+
+  if( data != nullptr && transaction.m_op == OP::READ && !failed )
+  {
+    memcpy( data, transaction.m_data, transferred );
+  }
+
+  transaction.m_status = STATUS::FREE;
+  return failed ? -1 : transferred;
+}
+
+void I2C_ASYNC::update()
+{
+  const int active_index = m_active_index;
+  if( active_index >= 0 )
+  {
+    if( micros() - m_start_time_us > TRANSACTION_TIMEOUT_US )
+    {
+      // no interrupt - device held the bus or didn't respond, release it
+      NVIC_DISABLE_IRQ( IRQ_I2C0 );
+      if( m_active_index >= 0 )
+      {
+        DEBUG_TEXT_LINE( "I2C_ASYNC transaction timed out" );
+        end( m_transactions[m_active_index], STATUS::FAILED );
+      }
+      NVIC_ENABLE_IRQ( IRQ_I2C0 );
+    }
+    return;
+  }
+
+  TRANSACTION& next = m_transactions[m_start_index];
+  if( next.m_status != STATUS::PENDING )
+  {
+    return;
+  }
+
+  // the previous stop may still be on the bus
+  if( I2C0_S & I2C_S_BUSY )
+  {
+    return;
+  }
+
+  m_start_index = ( m_start_index + 1 ) % MAX_TRANSACTIONS;
+  start( next );
+}
+
+uint32_t I2C_ASYNC::num_errors() const
+{
+  return m_num_errors;
+}
+
+void I2C_ASYNC::start( TRANSACTION& transaction )
+{
+  transaction.m_status  = STATUS::ACTIVE;
+  m_active_index        = &transaction - m_transactions;
+  m_start_time_us       = micros();
+
+  // setting MST generates the start condition, then send the address
+  const uint8_t read    = transaction.m_op == OP::READ ? 1 : 0;
+  I2C0_S                = I2C_S_IICIF | I2C_S_ARBL;
+  I2C0_C1               = I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST | I2C_C1_TX;
+  I2C0_D                = ( transaction.m_address << 1 ) | read;
+}
+
+void I2C_ASYNC::end( TRANSACTION& transaction, STATUS status )
+{
+  // clearing MST generates the stop condition
+  I2C0_C1               = I2C_C1_IICEN;
+
+  if( status == STATUS::FAILED )
+  {
+    ++m_num_errors;
+  }
+
+  transaction.m_status  = status;
+  m_active_index        = -1;
+}
+
+void I2C_ASYNC::i2c0_interrupt()
+{
+  if( s_instance != nullptr )
+  {
+    s_instance->interrupt();
+  }
+}
+
+void I2C_ASYNC::interrupt()
+{
+  const uint8_t status  = I2C0_S;
+  I2C0_S                = I2C_S_IICIF | ( status & I2C_S_ARBL );
+
+  if( m_active_index < 0 )
+  {
+    return;
+  }
+
+  TRANSACTION& transaction = m_transactions[m_active_index];
+
+  if( status & I2C_S_ARBL )
+  {
+    end( transaction, STATUS::FAILED );
+    return;
+  }
+
+  if( I2C0_C1 & I2C_C1_TX )
+  {
+    // transmitted a byte (or the address)
+    if( status & I2C_S_RXAK )
+    {
+      // not acknowledged
+      end( transaction, STATUS::FAILED );
+      return;
+    }
+
+    if( transaction.m_op == OP::WRITE )
+    {
+      if( transaction.m_transferred < transaction.m_size )
+      {
+        I2C0_D = transaction.m_data[transaction.m_transferred++];
+      }
+      else
+      {
+        end( transaction, STATUS::COMPLETE );
+      }
+      return;
+    }
+
+    // address sent for a read - switch to receive, a dummy read of D clocks in the first byte
+    I2C0_C1 = I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST | ( transaction.m_size == 1 ? I2C_C1_TXAK : 0 );
+    (void)I2C0_D;
+    return;
+  }
+
+  // received a byte
+  const int remaining = transaction.m_size - transaction.m_transferred;
+  if( remaining <= 1 )
+  {
+    // stop before reading D, so no further byte is clocked in
+    I2C0_C1 = I2C_C1_IICEN;
+    transaction.m_data[transaction.m_transferred++] = I2C0_D;
+    end( transaction, STATUS::COMPLETE );
+    return;
+  }
+
+  if( remaining == 2 )
+  {
+    // don't acknowledge the final byte
+    I2C0_C1 = I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST | I2C_C1_TXAK;
+  }
+  transaction.m_data[transaction.m_transferred++] = I2C0_D;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Queue of short I2C master transactions on I2C0, completed by the I2C interrupt rather than polled like Wire.
+// Transactions are started from update() in the main loop, one at a time in submission order, and their completion is
+// polled with complete()/finish() - so the main loop never waits on the bus.
+// Wire.begin() must be called first to set up the pins and clock, begin() then takes over the I2C0 interrupt vector.
+// From then on I2C_ASYNC owns I2C0 exclusively - Wire (unlike Wire1/Wire2, which are separate buses) mustn't be used for
+// transfers, as it would drive the same registers as the interrupt. begin() asserts this is the only I2C_ASYNC.
+// Tools/i2c_test.cpp drives the state machine against a simulated bus on the host.
+
+class I2C_ASYNC
+{
+public:
+
+  static constexpr const int      MAX_TRANSACTIONS        = 4;
+  static constexpr const int      MAX_DATA_SIZE           = 4;
+  static constexpr const uint32_t TRANSACTION_TIMEOUT_US  = 2000;   // a few bytes at 100kHz take a few hundred us
+  static constexpr const int      INVALID_TRANSACTION     = -1;
+
+  I2C_ASYNC();
+
+  void                begin();
+
+  // return INVALID_TRANSACTION if the queue is full
+  int                 submit_write( uint8_t address, const uint8_t* data, int size );
+  int                 submit_read( uint8_t address, int size );
+
+  bool                complete( int transaction ) const;
+  int                 finish( int transaction, uint8_t* data = nullptr );  // frees a complete transaction, returns the bytes transferred, -1 if it failed
+
+  void                update();     // starts the next transaction once the bus is free, and times out a stuck one
+
+  uint32_t            num_errors() const;
+
+private:
+
+  enum class OP : uint8_t
+  {
+    READ,
+    WRITE,
+  };
+
+  enum class STATUS : uint8_t
+  {
+    FREE,
+    PENDING,
+    ACTIVE,
+    COMPLETE,
+    FAILED,
+  };
+
+  struct TRANSACTION
+  {
+    uint8_t           m_address                 = 0;
+    OP                m_op                      = OP::READ;
+    uint8_t           m_size                    = 0;
+    volatile uint8_t  m_transferred             = 0;
+    uint8_t           m_data[MAX_DATA_SIZE]     = {};
+    volatile STATUS   m_status                  = STATUS::FREE;
+  };
+
+  TRANSACTION         m_transactions[MAX_TRANSACTIONS];   // ring, in submission order
+  int                 m_submit_index;
+  int                 m_start_index;
+  volatile int        m_active_index;                     // -1 when the bus is idle
+  uint32_t            m_start_time_us;
+  volatile uint32_t   m_num_errors;
+
+  static I2C_ASYNC*   s_instance;
+
+  int                 submit( OP op, uint8_t address, const uint8_t* data, int size );
+  void                start( TRANSACTION& transaction );
+  void                end( TRANSACTION& transaction, STATUS status );
+
+  static void         i2c0_interrupt();
+  void                interrupt();
+};
@@ -3,6 +3,8 @@
 #include <ADC.h>
 #include <Bounce.h>
 
+#include "DialScanner.h"
+
 //////////////////////////////////////
 
 class DIAL_BASE
@@ -27,12 +29,14 @@ public:
 class DIAL : public DIAL_BASE
 {  
   int           m_data_pin;
+  int           m_scan_channel;
   
 public:
 
   DIAL( int data_pin, bool invert = false );
 
-  bool          update( ADC& adc, bool filter );
+  void          setup( DIAL_SCANNER& scanner );
+  bool          update( const DIAL_SCANNER& scanner, bool filter );
 };
 
 //////////////////////////////////////
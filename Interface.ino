@@ -58,14 +58,21 @@ float DIAL_BASE::value() const
 
 DIAL::DIAL( int data_pin, bool invert ) :
   DIAL_BASE( invert ),
-  m_data_pin( data_pin )
+  m_data_pin( data_pin ),
+  m_scan_channel( -1 )
 {
 
 }
 
-bool DIAL::update( ADC& adc, bool filter )
+void DIAL::setup( DIAL_SCANNER& scanner )
+{
+  m_scan_channel = scanner.add_pin( m_data_pin );
+}
+
+bool DIAL::update( const DIAL_SCANNER& scanner, bool filter )
 {
-  const int new_value = adc.analogRead( m_data_pin, ADC_1 );
+  // sampled in the background, no conversion to wait for
+  const int new_value = scanner.value( m_scan_channel );
 
   return set_current_value( new_value, filter );
 }
@@ -0,0 +1,165 @@
+#include "LoopProfiler.h"
+#include "Util.h"
+
+LOOP_PROFILER::STATS            LOOP_PROFILER::s_stats[NUM_SECTIONS];
+LOOP_PROFILER::SD_SERVICE_STATS LOOP_PROFILER::s_sd_service;
+
+void LOOP_PROFILER::add_sample( SECTION section, uint32_t time_us )
+{
+  STATS& stats = s_stats[static_cast<int>(section)];
+
+  ++stats.m_count;
+  stats.m_total_us += time_us;
+  if( time_us > stats.m_max_us )
+  {
+    stats.m_max_us = time_us;
+  }
+}
+
+void LOOP_PROFILER::sd_serviced( int queued_play_blocks )
+{
+  const uint32_t time_us    = micros();
+  SD_SERVICE_STATS& service = s_sd_service;
+
+  if( service.m_last_queued_play_blocks >= 0 )
+  {
+    const uint32_t gap_us = time_us - service.m_last_time_us;
+    if( gap_us > service.m_max_gap_us )
+    {
+      service.m_max_gap_us = gap_us;
+    }
+
+    int bin             = 0;
+    uint32_t bin_limit  = BLOCK_PERIOD_US;
+    while( bin < NUM_GAP_BINS - 1 && gap_us >= bin_limit )
+    {
+      ++bin;
+      bin_limit <<= 1;
+    }
+    ++service.m_gap_histogram[bin];
+
+    // only meaningful whilst the recorder is streaming
+    if( service.m_last_queued_play_blocks > 0 )
+    {
+      const float margin_blocks = service.m_last_queued_play_blocks - static_cast<float>(gap_us) / BLOCK_PERIOD_US;
+      if( !service.m_have_margin || margin_blocks < service.m_min_margin_blocks )
+      {
+        service.m_min_margin_blocks = margin_blocks;
+        service.m_have_margin       = true;
+      }
+    }
+  }
+
+  service.m_last_time_us            = time_us;
+  service.m_last_queued_play_blocks = queued_play_blocks;
+}
+
+void LOOP_PROFILER::print_stats()
+{
+  const STATS& iteration_stats = s_stats[static_cast<int>(SECTION::LOOP_ITERATION)];
+
+  for( int s = 0; s < NUM_SECTIONS; ++s )
+  {
+    const STATS& stats = s_stats[s];
+    if( stats.m_count == 0 )
+    {
+      continue;
+    }
+
+    DEBUG_TEXT( section_name( static_cast<SECTION>(s) ) );
+    DEBUG_TEXT( " count:" );
+    DEBUG_TEXT( stats.m_count );
+    DEBUG_TEXT( " avg:" );
+    DEBUG_TEXT( stats.m_total_us / stats.m_count );
+    DEBUG_TEXT( "us max:" );
+    DEBUG_TEXT( stats.m_max_us );
+    DEBUG_TEXT( "us share:" );
+    DEBUG_TEXT( iteration_stats.m_total_us > 0 ? 100.0f * stats.m_total_us / iteration_stats.m_total_us : 0.0f );
+    DEBUG_TEXT_LINE( "%" );
+  }
+
+  const SD_SERVICE_STATS& service = s_sd_service;
+  DEBUG_TEXT( "SD service gap max:" );
+  DEBUG_TEXT( service.m_max_gap_us );
+  DEBUG_TEXT( "us (" );
+  DEBUG_TEXT( static_cast<float>(service.m_max_gap_us) / BLOCK_PERIOD_US );
+  DEBUG_TEXT( " blocks) min play queue margin:" );
+  DEBUG_TEXT( service.m_have_margin ? service.m_min_margin_blocks : 0.0f );
+  DEBUG_TEXT( " blocks, gaps in block periods (<1 <2 <4 ..):" );
+  for( int b = 0; b < NUM_GAP_BINS; ++b )
+  {
+    DEBUG_TEXT( " " );
+    DEBUG_TEXT( service.m_gap_histogram[b] );
+  }
+  DEBUG_TEXT_LINE( "" );
+}
+
+void LOOP_PROFILER::reset_stats()
+{
+  for( STATS& stats : s_stats )
+  {
+    stats = STATS();
+  }
+
+  // keep the last service, so the next gap is still measured
+  const uint32_t last_time_us             = s_sd_service.m_last_time_us;
+  const int last_queued_play_blocks       = s_sd_service.m_last_queued_play_blocks;
+  s_sd_service                            = SD_SERVICE_STATS();
+  s_sd_service.m_last_time_us             = last_time_us;
+  s_sd_service.m_last_queued_play_blocks  = last_queued_play_blocks;
+}
+
+const char* LOOP_PROFILER::section_name( SECTION section )
+{
+  switch( section )
+  {
+    case SECTION::LOOP_ITERATION:
+    {
+      return "loop()";
+    }
+    case SECTION::INTERFACE_UPDATE:
+    {
+      return "  interface update";
+    }
+    case SECTION::LOOPER_MODE:
+    {
+      return "  looper mode";
+    }
+    case SECTION::PARAMETERS:
+    {
+      return "  parameters";
+    }
+    case SECTION::BUTTON_STRIP:
+    {
+      return "  button strip";
+    }
+    case SECTION::BUTTON_STRIP_I2C:
+    {
+      return "    I2C";
+    }
+    case SECTION::SD_RECORDER:
+    {
+      return "  SD recorder";
+    }
+    case SECTION::SD_PLAY_READS:
+    {
+      return "    play reads";
+    }
+    case SECTION::SD_RECORD_WRITES:
+    {
+      return "    record writes";
+    }
+    case SECTION::SD_IO_TRANSFERS:
+    {
+      return "    SD transfers";
+    }
+    case SECTION::SD_SAMPLE_PLAYER:
+    {
+      return "  SD sample player";
+    }
+    default:
+    {
+      return "unknown";
+    }
+  }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Audio.h>
+#include "CompileSwitches.h"
+
+// Attributes main loop time to the jobs it's spent on, timed with micros(). Sections nest, so e.g. the SD sections are
+// included in the recorder and sample player sections, and everything in LOOP_ITERATION.
+// It also records the gap between successive SD services against the rate the play queue drains (a block every
+// BLOCK_PERIOD_US at 1x), and the smallest number of blocks the play queue had left when serviced - how close to underrun.
+// Enable with PROFILE_MAIN_LOOP in CompileSwitches.h, otherwise ADD_LOOP_PROFILED_SECTION() compiles to nothing.
+
+class LOOP_PROFILER
+{
+public:
+
+  enum class SECTION
+  {
+    LOOP_ITERATION,
+    INTERFACE_UPDATE,                 // LOOPER_INTERFACE::update()
+    LOOPER_MODE,                      // update_looper_mode()
+    PARAMETERS,                       // parameter pushes
+    BUTTON_STRIP,
+    BUTTON_STRIP_I2C,
+    SD_RECORDER,                      // SD_AUDIO_RECORDER::update_main_loop()
+    SD_PLAY_READS,                    // submitting and collecting play reads
+    SD_RECORD_WRITES,                 // submitting and collecting record writes
+    SD_IO_TRANSFERS,                  // SD_ASYNC_IO::update() transfers, for the recorder and the sample player
+    SD_SAMPLE_PLAYER,
+    NUM_SECTIONS,
+  };
+
+  static constexpr const int      NUM_SECTIONS      = static_cast<int>(SECTION::NUM_SECTIONS);
+  static constexpr const int      NUM_GAP_BINS      = 8;    // doubling, from under 1 block period to 64 or more
+  static constexpr const uint32_t BLOCK_PERIOD_US   = AUDIO_BLOCK_SAMPLES * 1000000.0f / AUDIO_SAMPLE_RATE_EXACT;
+
+  static void         add_sample( SECTION section, uint32_t time_us );
+  static void         sd_serviced( int queued_play_blocks );      // after each SD service, with the play blocks queued
+
+  static void         print_stats();
+  static void         reset_stats();
+
+  static const char*  section_name( SECTION section );
+
+private:
+
+  struct STATS
+  {
+    uint32_t          m_count                     = 0;
+    uint32_t          m_total_us                  = 0;
+    uint32_t          m_max_us                    = 0;
+  };
+
+  struct SD_SERVICE_STATS
+  {
+    uint32_t          m_last_time_us              = 0;
+    int               m_last_queued_play_blocks   = -1;     // -1 before the first service
+    uint32_t          m_max_gap_us                = 0;
+    float             m_min_margin_blocks         = 0.0f;   // blocks queued at the previous service less those played since
+    bool              m_have_margin               = false;
+    uint32_t          m_gap_histogram[NUM_GAP_BINS] = {};
+  };
+
+  static STATS            s_stats[NUM_SECTIONS];
+  static SD_SERVICE_STATS s_sd_service;
+};
+
+struct LOOP_PROFILED_SECTION
+{
+  LOOP_PROFILER::SECTION  m_section;
+  uint32_t                m_start_us;
+
+  LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION section ) :
+    m_section( section ),
+    m_start_us( micros() )
+  {
+  }
+
+  ~LOOP_PROFILED_SECTION()
+  {
+    LOOP_PROFILER::add_sample( m_section, micros() - m_start_us );
+  }
+};
+
+#ifdef PROFILE_MAIN_LOOP
+#define ADD_LOOP_PROFILED_SECTION(section) LOOP_PROFILED_SECTION loop_profiled_section( section )
+#define LOOP_PROFILER_SD_SERVICED(queued_play_blocks) LOOP_PROFILER::sd_serviced( queued_play_blocks )
+#else
+#define ADD_LOOP_PROFILED_SECTION(section)
+#define LOOP_PROFILER_SD_SERVICED(queued_play_blocks)
+#endif
@@ -5,20 +5,45 @@
 #include <SD.h>
 #include <SerialFlash.h>
 
+#include "AudioBlockTracker.h"
+#include "AudioDelay.h"
+#include "AudioOutputStage.h"
+#include "AudioProfiler.h"
+#include "LoopProfiler.h"
 #include "ButtonStrip.h"
+#include "ClockInput.h"
+#include "DSPBenchmark.h"
 #include "LooperInterface.h"
+#include "SampleCatalog.h"
+#include "Scheduler.h"
 #include "SDAudioRecorder.h"
+#include "SDSamplePlayer.h"
 
 constexpr int SDCARD_CS_PIN    = BUILTIN_SDCARD;
 constexpr int SDCARD_MOSI_PIN  = 11;
 constexpr int SDCARD_SCK_PIN   = 13;
 
+constexpr int CLOCK_INPUT_PIN     = 24;
+constexpr int CLOCK_RESET_PIN     = 25;
+constexpr int CLOCKS_PER_SEGMENT  = 1;     // with a clock, the loop is a whole number of clocks per segment
+
 constexpr int I2C_ADDRESS(0x01); 
 constexpr int STOP_LOOP_BUTTON_DOWN_TIME_MS(2000);
+constexpr int RESAMPLE_CLICK_TIME_MS(400);    // clicking again this soon after starting an overdub resamples instead
+constexpr int SD_MOUNT_RETRY_TIME_MS(1000);
+
+constexpr uint32_t INTERFACE_UPDATE_TIME_US     = 2000;       // dials and buttons at 500Hz
+constexpr uint32_t BUTTON_STRIP_UPDATE_TIME_US  = 5000;       // matches the strip debounce, LEDs are sent at most every 30ms
+constexpr uint32_t SCHEDULER_STATS_TIME_US      = 10000000;
+constexpr uint32_t AUDIO_PROFILE_TIME_US        = 10000000;
+constexpr uint32_t LOOP_PROFILE_TIME_US         = 10000000;
+constexpr uint32_t AUDIO_BLOCK_CHECK_TIME_US    = 1000000;    // a pool usage window is AUDIO_BLOCK_TRACKER::POOL_SAMPLES_PER_WINDOW checks
+
+// the looper's own files - the recorder's loops and sequence, and the sample index - kept out of the sample catalog
+constexpr const char* LOOPER_DIRECTORY      = "/LOOPER";
+constexpr const char* SAMPLE_INDEX_FILENAME = "/LOOPER/SAMPLES.IDX";
 
-constexpr int MAX_SAMPLES(12);
-char* sample_files[MAX_SAMPLES];
-int num_samples_loaded        = 0;
+SAMPLE_CATALOG    sample_catalog;
 
 // wrap in a struct to ensure initialisation order
 struct IO
@@ -38,32 +63,47 @@ struct IO
 IO io;
 
 SD_AUDIO_RECORDER audio_recorder;
+SD_SAMPLE_PLAYER  sample_player;
 
-AudioAmplifier    input_gain;
-AudioMixer4       looper_mixer;
-AudioEffectDelay  delay_line;
-AudioMixer4       delay_feedback_mixer;
-AudioMixer4       output_mixer;
+AUDIO_DELAY       delay_line;
 
-AudioConnection   patch_cord_1( io.audio_input, 0, input_gain, 0 );
-AudioConnection   patch_cord_2( input_gain, 0, audio_recorder, 0 );
-AudioConnection   patch_cord_3( input_gain, 0, looper_mixer, 0 );
-AudioConnection   patch_cord_4( audio_recorder, 0, looper_mixer, 1 );
-AudioConnection   patch_cord_5( looper_mixer, 0, delay_feedback_mixer, 0 );
-AudioConnection   patch_cord_6( looper_mixer, 0, output_mixer, 0 );
-AudioConnection   patch_cord_7( output_mixer, 0, io.audio_output, 0 );
+// declared after its sources so the looper, samples and delay return reach the output in the same update
+// the recorder and delay line take the stage's outputs on the following update
+AUDIO_OUTPUT_STAGE output_stage;
 
-// delay section
-AudioConnection   patch_cord_8( delay_feedback_mixer, 0, delay_line, 0 );
-AudioConnection   patch_cord_9( delay_line, 0, delay_feedback_mixer, 1 );
-AudioConnection   patch_cord_10( delay_line, 0, output_mixer, 1 );
+AudioConnection   patch_cord_1( io.audio_input, 0, output_stage, AUDIO_OUTPUT_STAGE::INPUT_AUDIO );
+AudioConnection   patch_cord_2( output_stage, AUDIO_OUTPUT_STAGE::OUTPUT_RECORD, audio_recorder, SD_AUDIO_RECORDER::INPUT_AUDIO );
+AudioConnection   patch_cord_3( audio_recorder, 0, output_stage, AUDIO_OUTPUT_STAGE::INPUT_LOOPER );
+AudioConnection   patch_cord_4( sample_player, 0, output_stage, AUDIO_OUTPUT_STAGE::INPUT_SAMPLES );
+AudioConnection   patch_cord_5( output_stage, AUDIO_OUTPUT_STAGE::OUTPUT_MAIN, io.audio_output, 0 );
 
+// delay section
+AudioConnection   patch_cord_6( output_stage, AUDIO_OUTPUT_STAGE::OUTPUT_DELAY_SEND, delay_line, 0 );
+AudioConnection   patch_cord_7( delay_line, 0, output_stage, AUDIO_OUTPUT_STAGE::INPUT_DELAY_RETURN );
 
+// resampling - the output mix bounced into the loop
+AudioConnection   patch_cord_8( output_stage, AUDIO_OUTPUT_STAGE::OUTPUT_RESAMPLE, audio_recorder, SD_AUDIO_RECORDER::INPUT_RESAMPLE );
 
 BUTTON_STRIP      button_strip( I2C_ADDRESS );
 
 LOOPER_INTERFACE  looper_interface;
 
+CLOCK_INPUT       clock_input;
+
+SCHEDULER         scheduler;
+
+// audio runs from the end of setup(), storage is brought up incrementally from loop()
+enum class BOOT_PHASE
+{
+  MOUNT_SD,
+  LOAD_CATALOG,
+  READY,
+};
+
+BOOT_PHASE        boot_phase              = BOOT_PHASE::MOUNT_SD;
+uint32_t          boot_phase_start_us     = 0;
+uint32_t          next_sd_mount_time_ms   = 0;
+
 //////////////////////////////////////
 
 void set_adc1_to_3v3()
@@ -93,44 +133,15 @@ void set_adc1_to_3v3()
   
 }
 
-// find all .raw files in dir and add to sample list
-void fill_sample_list( File dir )
-{
-  for( int i = 0; i < MAX_SAMPLES; ++i )
-  {
-    sample_files[i] = nullptr;  
-  }
-  
-  while(1)
-  {
-    File entry = dir.openNextFile();
-    if( !entry )
-    {
-      // done!
-      return;
-    }
-
-    if( !entry.isDirectory() )
-    {
-      const int entry_filename_length = strlen(entry.name());
-      constexpr const char* file_ext = ".RAW";
-      constexpr int file_ext_length = strlen( file_ext );
-      const char* entry_ext = entry.name() + entry_filename_length - file_ext_length;
-      
-      if( entry_filename_length > file_ext_length && strncmp( entry_ext, file_ext, file_ext_length ) == 0 )
-      { 
-        sample_files[num_samples_loaded] = new char[entry_filename_length+1];
-        strcpy( sample_files[num_samples_loaded], entry.name() );
-  
-        if( ++num_samples_loaded == MAX_SAMPLES )
-        {
-          // sample list full
-          return;
-        }
-      }
-    }
-  }
-}
+// scheduler tasks
+void update_interface_task( uint32_t time_ms );
+void update_button_strip_task( uint32_t time_ms );
+void update_sd_task( uint32_t time_ms );
+float sd_task_urgency();
+void print_scheduler_stats_task( uint32_t time_ms );
+void print_audio_profile_task( uint32_t time_ms );
+void print_loop_profile_task( uint32_t time_ms );
+void check_audio_blocks_task( uint32_t time_ms );
 
 void setup()
 {
@@ -139,48 +150,152 @@ void setup()
   serial_port_initialised = true;
 #endif
 
-  constexpr int mem_size = 512;
+  // the delay keeps its own ring, so only the SD queues and the graph need blocks from the pool
+  constexpr int mem_size = 352;
   AudioMemory( mem_size );
 
   analogReference(INTERNAL);
 
   set_adc1_to_3v3();
 
-  // Initialize the SD card
+  // samples are added once the catalog has loaded
+  looper_interface.setup( io.adc, 0 );
+
+  // not on a dial
+  audio_recorder.set_saturation( looper_interface.saturation() );
+
+  // master only, the button strip transactions are then driven by its own interrupt handler
+  Wire.begin();
+  button_strip.begin();
+
+  clock_input.begin( CLOCK_INPUT_PIN, CLOCK_RESET_PIN );
+
   SPI.setMOSI(SDCARD_MOSI_PIN);
   SPI.setSCK(SDCARD_SCK_PIN);
-  
-  if( !( SD.begin(SDCARD_CS_PIN) ) )
+
+  // the audio graph is now running, the dry path and delay pass audio whilst the SD card is brought up
+  DEBUG_TEXT("Setup finished (audio running) ");
+  DEBUG_TEXT( micros() / 1000.0f );
+  DEBUG_TEXT_LINE("ms");
+
+#ifdef BENCHMARK_DSP
+  DSP_BENCHMARK::run();
+#endif
+
+  scheduler.add_periodic_task( "interface", update_interface_task, INTERFACE_UPDATE_TIME_US );
+  scheduler.add_periodic_task( "button strip", update_button_strip_task, BUTTON_STRIP_UPDATE_TIME_US );
+  scheduler.add_deadline_task( "sd", update_sd_task, sd_task_urgency );
+#ifdef SHOW_SCHEDULER_STATS
+  scheduler.add_periodic_task( "stats", print_scheduler_stats_task, SCHEDULER_STATS_TIME_US );
+#endif
+#ifdef PROFILE_AUDIO_INTERRUPT
+  AUDIO_PROFILER::begin();
+  scheduler.add_periodic_task( "audio profile", print_audio_profile_task, AUDIO_PROFILE_TIME_US );
+#endif
+#ifdef PROFILE_MAIN_LOOP
+  scheduler.add_periodic_task( "loop profile", print_loop_profile_task, LOOP_PROFILE_TIME_US );
+#endif
+#ifdef TRACK_AUDIO_BLOCKS
+  scheduler.add_periodic_task( "audio blocks", check_audio_blocks_task, AUDIO_BLOCK_CHECK_TIME_US );
+#endif
+
+  boot_phase_start_us = micros();
+}
+
+void log_boot_phase_time( const char* phase_name )
+{
+  const uint32_t time_us = micros();
+
+  DEBUG_TEXT("Boot phase ");
+  DEBUG_TEXT(phase_name);
+  DEBUG_TEXT(" ");
+  DEBUG_TEXT( ( time_us - boot_phase_start_us ) / 1000.0f );
+  DEBUG_TEXT_LINE("ms");
+
+  boot_phase_start_us = time_us;
+}
+
+// perform one small step of storage startup per main loop iteration
+void update_boot( uint32_t time_ms )
+{
+  switch( boot_phase )
   {
-    // stop here if no SD card, but print a message
-    while (1)
+    case BOOT_PHASE::MOUNT_SD:
+    {
+      if( time_ms >= next_sd_mount_time_ms )
+      {
+        if( SD.begin(SDCARD_CS_PIN) )
+        {
+          log_boot_phase_time( "MOUNT_SD" );
+
+          if( !SD.exists( LOOPER_DIRECTORY ) )
+          {
+            SD.mkdir( LOOPER_DIRECTORY );
+          }
+
+          sample_catalog.begin_load( SAMPLE_INDEX_FILENAME, LOOPER_DIRECTORY );
+          boot_phase = BOOT_PHASE::LOAD_CATALOG;
+        }
+        else
+        {
+          // keep passing audio, and retry in case a card is inserted
+          DEBUG_TEXT_LINE("Unable to access the SD card");
+          next_sd_mount_time_ms = time_ms + SD_MOUNT_RETRY_TIME_MS;
+        }
+      }
+      break;
+    }
+    case BOOT_PHASE::LOAD_CATALOG:
+    {
+      if( sample_catalog.update_load() )
+      {
+        log_boot_phase_time( "LOAD_CATALOG" );
+
+        DEBUG_TEXT_LINE("Files:");
+        for( int i = 0; i < sample_catalog.size(); ++i )
+        {
+          DEBUG_TEXT_LINE( sample_catalog.path(i) );
+        }
+
+        looper_interface.set_num_samples( sample_catalog.size() );
+
+        DEBUG_TEXT("Looper ready ");
+        DEBUG_TEXT( millis() );
+        DEBUG_TEXT_LINE("ms after power on");
+
+        boot_phase = BOOT_PHASE::READY;
+      }
+      break;
+    }
+    case BOOT_PHASE::READY:
     {
-      DEBUG_TEXT_LINE("Unable to access the SD card");
-      delay(500);
+      break;
     }
   }
+}
 
-  File root = SD.open("/");
-  fill_sample_list( root );
+void start_sequence_pattern( int pattern, uint64_t time_ms )
+{
+  audio_recorder.select_sequence_pattern( pattern );
 
-  DEBUG_TEXT_LINE("Files:");
-  for( int i = 0; i < num_samples_loaded; ++i )
+  if( audio_recorder.sequence_pattern_empty( pattern ) )
   {
-    DEBUG_TEXT_LINE( sample_files[i] );
+    audio_recorder.record_sequence();
+    looper_interface.set_recording( true, time_ms );
+    button_strip.lock_buttons( false );
+  }
+  else
+  {
+    audio_recorder.play_sequence();
+    button_strip.lock_buttons( true );
   }
-
-  looper_interface.setup( num_samples_loaded );
-
-  Wire.begin( I2C_ADDRESS );
-
-  DEBUG_TEXT_LINE("Setup finished!\n");
-  delay(500);
 }
 
 void update_looper_mode(uint64_t time_ms)
 {
   static bool in_record_mode = looper_interface.mode() == LOOPER_INTERFACE::MODE::LOOP_RECORD;
   static bool mode_change_pending = false;
+  static uint64_t overdub_start_time_ms = 0;
 
   switch( looper_interface.mode() )
   {
@@ -210,37 +325,40 @@ void update_looper_mode(uint64_t time_ms)
 
       if( looper_interface.record_button().single_click() )
       {
-        // sequence recording
-        switch( button_strip.mode() )
+        // sequence recording, the cuts are recorded and played back by the recorder against the loop
+        switch( audio_recorder.sequence_mode() )
         {
-          case BUTTON_STRIP::MODE::FREE_PLAY:
+          case SD_AUDIO_RECORDER::SEQUENCE_MODE::NONE:
           {
-            // start recording
-            button_strip.start_record_sequence( time_ms );
-            looper_interface.set_recording( true, time_ms );
+            // play the selected pattern, or record it if empty
+            start_sequence_pattern( audio_recorder.sequence_pattern(), time_ms );
             break;
           }
-          case BUTTON_STRIP::MODE::RECORD_SEQ:
+          case SD_AUDIO_RECORDER::SEQUENCE_MODE::RECORD:
           {
             // stop recording
-            button_strip.start_sequence_playback( time_ms );
+            audio_recorder.play_sequence();
             looper_interface.set_recording( false, time_ms );
+            button_strip.lock_buttons( true );
             break;
           }
-          case BUTTON_STRIP::MODE::PLAY_SEQ:
+          case SD_AUDIO_RECORDER::SEQUENCE_MODE::PLAY:
           {
-            // nothing to do here?
+            // move on to the next pattern
+            start_sequence_pattern( ( audio_recorder.sequence_pattern() + 1 ) % SD_AUDIO_RECORDER::NUM_SEQUENCE_PATTERNS, time_ms );
             break;
           }
         }
       }
       else if( looper_interface.record_button().down_time_ms() > STOP_LOOP_BUTTON_DOWN_TIME_MS &&
-                button_strip.mode() != BUTTON_STRIP::MODE::FREE_PLAY )
+                audio_recorder.sequence_mode() != SD_AUDIO_RECORDER::SEQUENCE_MODE::NONE )
       {
         looper_interface.set_recording( false, time_ms );
 
+        audio_recorder.stop_sequence();
         audio_recorder.play();
 
+        button_strip.lock_buttons( false );
         button_strip.start_free_play_sequence( audio_recorder.play_back_file_time_ms(), time_ms );
       }
 
@@ -253,10 +371,7 @@ void update_looper_mode(uint64_t time_ms)
       if( !in_record_mode )
       {
         // switching from loop playback to loop record
-        if( button_strip.mode() == BUTTON_STRIP::MODE::RECORD_SEQ || button_strip.mode() == BUTTON_STRIP::MODE::PLAY_SEQ )
-        {
-          button_strip.clear_sequence();
-        }
+        audio_recorder.stop_sequence();
         
         audio_recorder.start_record();
 
@@ -275,6 +390,13 @@ void update_looper_mode(uint64_t time_ms)
         looper_interface.set_mode_pending( false, time_ms );
         button_strip.start_free_play_sequence( audio_recorder.play_back_file_time_ms(), time_ms );
       }
+
+      if( audio_recorder.recording_ended() )
+      {
+        // the card is full - the loop is what was recorded, or the overdub was abandoned
+        looper_interface.set_recording( false, time_ms );
+        mode_change_pending = true;
+      }
       
       if( looper_interface.record_button().single_click() )
       {
@@ -291,10 +413,10 @@ void update_looper_mode(uint64_t time_ms)
           }
           case SD_AUDIO_RECORDER::MODE::RECORD_INITIAL:
           {
-            // stop recording and play loop
+            // stop recording and play loop - the free play sequence starts once the new loop length is known
             audio_recorder.stop_record();
             looper_interface.set_recording( false, time_ms );
-            button_strip.start_free_play_sequence( audio_recorder.play_back_file_time_ms(), time_ms );
+            mode_change_pending = true;
             
             break;
           }
@@ -302,12 +424,22 @@ void update_looper_mode(uint64_t time_ms)
           {
             looper_interface.set_recording( true, time_ms );
             
+            audio_recorder.set_record_source( SD_AUDIO_RECORDER::RECORD_SOURCE::AUDIO_INPUT );
             audio_recorder.start_record(); // start overdubbing
+            overdub_start_time_ms = time_ms;
             
             break;
           }
           case SD_AUDIO_RECORDER::MODE::RECORD_OVERDUB:
           {
+            if( audio_recorder.record_source() == SD_AUDIO_RECORDER::RECORD_SOURCE::AUDIO_INPUT &&
+                time_ms - overdub_start_time_ms < RESAMPLE_CLICK_TIME_MS )
+            {
+              // double click - bounce the output mix (including the delay) into the loop, rather than adding the input
+              audio_recorder.set_record_source( SD_AUDIO_RECORDER::RECORD_SOURCE::RESAMPLE );
+              break;
+            }
+
             looper_interface.set_recording( false, time_ms );
             
             audio_recorder.stop_record(); // stop overdubbing
@@ -345,35 +477,90 @@ void update_looper_mode(uint64_t time_ms)
   }
 }
 
-void loop()
+// quantise a new loop to the external clock, so each segment starts on a clock edge
+void update_clock()
 {
-  const uint64_t time_ms = millis();
+  clock_input.update();
 
-  looper_interface.update( io.adc, time_ms );
+  const float loop_quantum = clock_input.locked() ? clock_input.period_samples() * CLOCKS_PER_SEGMENT * BUTTON_STRIP::NUM_SEGMENTS : 0.0f;
+  audio_recorder.set_loop_length_quantum( loop_quantum );
 
-  update_looper_mode( time_ms );
+  if( clock_input.reset_triggered() && audio_recorder.mode() == SD_AUDIO_RECORDER::MODE::PLAY )
+  {
+    // back to the start of the loop
+    audio_recorder.set_read_position( 0.0f );
+  }
+}
 
-  audio_recorder.update_main_loop(); 
+// only pushes parameters whose dial has moved, the audio objects ramp to the new value
+void update_parameters()
+{
+  LOOPER_INTERFACE::PARAMETER parameter;
+  while( looper_interface.next_parameter_change( parameter ) )
+  {
+    switch( parameter )
+    {
+      case LOOPER_INTERFACE::PARAMETER::GAIN:
+      {
+        output_stage.set_input_gain( looper_interface.gain() );
+        break;
+      }
+      case LOOPER_INTERFACE::PARAMETER::PLAY_BACK_SPEED:
+      {
+        audio_recorder.set_speed( looper_interface.play_back_speed() );
+        audio_recorder.set_reverse( looper_interface.play_back_reverse() );
+        break;
+      }
+      case LOOPER_INTERFACE::PARAMETER::DELAY_TIME:
+      {
+        delay_line.set_delay_time_ms( looper_interface.delay_time() );
+        break;
+      }
+      case LOOPER_INTERFACE::PARAMETER::DELAY_FEEDBACK:
+      {
+        output_stage.set_delay_feedback( looper_interface.delay_feedback() );
+        break;
+      }
+      case LOOPER_INTERFACE::PARAMETER::DELAY_MIX:
+      {
+        output_stage.set_delay_mix( looper_interface.delay_mix() );
+        break;
+      }
+      case LOOPER_INTERFACE::PARAMETER::LOOPER_MIX:
+      {
+        output_stage.set_looper_mix( looper_interface.looper_mix() );
+        break;
+      }
+      default:
+      {
+        break;
+      }
+    }
+  }
+}
 
-  // set interface paramaters
-  audio_recorder.set_saturation( looper_interface.saturation() );
-  audio_recorder.set_speed( looper_interface.play_back_speed() );
-  
-  input_gain.gain( looper_interface.gain() );
+void update_interface_task( uint32_t time_ms )
+{
+  {
+    ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::INTERFACE_UPDATE );
+    looper_interface.update( time_ms );
+  }
 
-  delay_line.delay( 0, looper_interface.delay_time() );
+  update_clock();
 
-  const float looper_mix = looper_interface.looper_mix();
-  looper_mixer.gain( 0, 1.0f - looper_mix );
-  looper_mixer.gain( 1, looper_mix );
+  if( boot_phase == BOOT_PHASE::READY )
+  {
+    ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::LOOPER_MODE );
+    update_looper_mode( time_ms );
+  }
 
-  const float delay_feedback = looper_interface.delay_feedback();
-  delay_feedback_mixer.gain( 0, 1.0f );
-  delay_feedback_mixer.gain( 1, delay_feedback );
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::PARAMETERS );
+  update_parameters();
+}
 
-  const float delay_mix = looper_interface.delay_mix();
-  output_mixer.gain( 0, 1.0f - delay_mix );
-  output_mixer.gain( 1, delay_mix );
+void update_button_strip_task( uint32_t time_ms )
+{
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::BUTTON_STRIP );
 
   uint32_t activated_segment;
   const float playback_pos = audio_recorder.playback_position();
@@ -385,15 +572,80 @@ void loop()
       const float t = activated_segment / static_cast<float>(button_strip.num_segments());
       audio_recorder.set_read_position( t );
     }
+    else if( audio_recorder.mode() == SD_AUDIO_RECORDER::MODE::STOP && boot_phase == BOOT_PHASE::READY && sample_catalog.size() > 0 )
+    {
+      // no loop playing - the buttons trigger samples, which can overlap
+      sample_player.play( sample_catalog.path( activated_segment % sample_catalog.size() ) );
+    }
+  }
+}
+
+void update_sd_task( uint32_t time_ms )
+{
+  if( boot_phase == BOOT_PHASE::READY )
+  {
+    audio_recorder.update_main_loop();
+    sample_player.update_main_loop();
+
+    LOOP_PROFILER_SD_SERVICED( audio_recorder.queued_play_blocks() );
+  }
+  else
+  {
+    update_boot( time_ms );
   }
+}
+
+float sd_task_urgency()
+{
+  const float recorder_urgency  = audio_recorder.sd_urgency();
+  const float player_urgency    = sample_player.sd_urgency();
+  return recorder_urgency > player_urgency ? recorder_urgency : player_urgency;
+}
+
+#ifdef SHOW_SCHEDULER_STATS
+void print_scheduler_stats_task( uint32_t /*time_ms*/ )
+{
+  scheduler.print_stats();
+  scheduler.reset_stats();
+}
+#endif
+
+#ifdef PROFILE_AUDIO_INTERRUPT
+void print_audio_profile_task( uint32_t /*time_ms*/ )
+{
+  AUDIO_PROFILER::print_stats();
+  AUDIO_PROFILER::reset_stats();
+}
+#endif
+
+#ifdef PROFILE_MAIN_LOOP
+void print_loop_profile_task( uint32_t /*time_ms*/ )
+{
+  LOOP_PROFILER::print_stats();
+  LOOP_PROFILER::reset_stats();
+}
+#endif
+
+#ifdef TRACK_AUDIO_BLOCKS
+void check_audio_blocks_task( uint32_t /*time_ms*/ )
+{
+  audio_recorder.check_block_ownership();
 
-/*
-  const int processor_usage = AudioProcessorUsage();
-  if( processor_usage > 45 )
+  if( AUDIO_BLOCK_TRACKER::sample_pool() )
   {
-    Serial.print( "Performance spike: " );
-    Serial.print( processor_usage );
-    Serial.print( "\n" );
+    DEBUG_TEXT_LINE( "Audio block pool usage rising - possible leak" );
+
+    AudioNoInterrupts();
+    const AUDIO_BLOCK_TRACKER::CENSUS census = AUDIO_BLOCK_TRACKER::census();
+    AudioInterrupts();
+    AUDIO_BLOCK_TRACKER::print_census( census );
   }
-*/
+}
+#endif
+
+void loop()
+{
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::LOOP_ITERATION );
+
+  scheduler.update();
 }
@@ -1,30 +1,43 @@
+#include "AudioDelay.h"
 #include "LooperInterface.h"
 #include "Util.h"
 
-constexpr const int GAIN_POT            = 0;
+constexpr const int GAIN_POT            = static_cast<int>(LOOPER_INTERFACE::PARAMETER::GAIN);
 //constexpr const int SATURATION_POT    = 1;
-constexpr const int SPEED_POT           = 1;
-constexpr const int DELAY_TIME_POT      = 2;
-constexpr const int DELAY_FEEDBACK_POT  = 3;
-constexpr const int DELAY_MIX_POT       = 4;
-constexpr const int LOOPER_MIX_POT      = 5;
+constexpr const int SPEED_POT           = static_cast<int>(LOOPER_INTERFACE::PARAMETER::PLAY_BACK_SPEED);
+constexpr const int DELAY_TIME_POT      = static_cast<int>(LOOPER_INTERFACE::PARAMETER::DELAY_TIME);
+constexpr const int DELAY_FEEDBACK_POT  = static_cast<int>(LOOPER_INTERFACE::PARAMETER::DELAY_FEEDBACK);
+constexpr const int DELAY_MIX_POT       = static_cast<int>(LOOPER_INTERFACE::PARAMETER::DELAY_MIX);
+constexpr const int LOOPER_MIX_POT      = static_cast<int>(LOOPER_INTERFACE::PARAMETER::LOOPER_MIX);
+
+static_assert( static_cast<int>(LOOPER_INTERFACE::PARAMETER::NUM_PARAMETERS) <= 32, "Changed parameters are a 32 bit mask" );
 
 LOOPER_INTERFACE::LOOPER_INTERFACE() :
+  m_dial_scanner(),
   m_dials( { DIAL( A20 ), DIAL( A19 ), DIAL( A18 ), DIAL( A17 ), DIAL( A16 ), DIAL( A13 ) } ),
   m_mode_button( MODE_BUTTON_PIN, false ),
   m_record_button( RECORD_BUTTON_PIN, false ),
   m_leds( { LED( LED_1_PIN, false ), LED( LED_2_PIN, false ), LED( LED_3_PIN, false ) } ),
+  m_parameter_values(),
+  m_changed_parameters( ( 1 << NUM_DIALS ) - 1 ),
   m_current_play_back_sample(-1),
   m_num_samples( 0 ),
   m_mode( MODE::LOOP_RECORD ),
-  m_mode_pending( false )
+  m_mode_pending( false ),
+  m_play_back_reverse( false )
 {
 
 }
 
-void LOOPER_INTERFACE::setup( int num_samples )
+void LOOPER_INTERFACE::setup( ADC& adc, int num_samples )
 {
   m_num_samples = num_samples;
+
+  for( int d = 0; d < NUM_DIALS; ++d )
+  {
+    m_dials[d].setup( m_dial_scanner );
+  }
+  m_dial_scanner.begin( adc );
   
   m_mode_button.setup();
   m_record_button.setup();
@@ -36,15 +49,30 @@ void LOOPER_INTERFACE::setup( int num_samples )
   }
 }
 
-bool LOOPER_INTERFACE::update( ADC& adc, uint32_t time_in_ms )
+void LOOPER_INTERFACE::set_num_samples( int num_samples )
 {
-  // read each pot
+  m_num_samples = num_samples;
+}
+
+bool LOOPER_INTERFACE::update( uint32_t time_in_ms )
+{
+  // latest value of each pot, from the background scan
   for( int d = 0; d < NUM_DIALS; ++d )
   {
     const bool filter = d == DELAY_TIME_POT;
-    m_dials[d].update( adc, filter );
+    if( m_dials[d].update( m_dial_scanner, filter ) && fabs( m_dials[d].value() - m_parameter_values[d] ) >= PARAMETER_CHANGE_THRESHOLD )
+    {
+      m_changed_parameters |= 1 << d;
+    }
   }
   
+  // the direction only changes once the speed dial is clear of its centre, so noise there doesn't flip it back and forth
+  const float speed_dial = m_dials[SPEED_POT].value();
+  if( m_play_back_reverse ? speed_dial > 0.5f + REVERSE_HYSTERESIS : speed_dial < 0.5f - REVERSE_HYSTERESIS )
+  {
+    m_play_back_reverse = !m_play_back_reverse;
+  }
+
   m_mode_button.update( time_in_ms );
   m_record_button.update( time_in_ms );
 
@@ -135,6 +163,21 @@ bool LOOPER_INTERFACE::sample_to_play( int& sample_index )
   return false;
 }
 
+bool LOOPER_INTERFACE::next_parameter_change( PARAMETER& parameter )
+{
+  if( m_changed_parameters == 0 )
+  {
+    return false;
+  }
+
+  const int d = __builtin_ctz( m_changed_parameters );
+  m_changed_parameters &= ~( 1 << d );
+  m_parameter_values[d] = m_dials[d].value();
+
+  parameter = static_cast<PARAMETER>(d);
+  return true;
+}
+
 float LOOPER_INTERFACE::gain() const
 {
   // top dial control digital gain reduction
@@ -148,10 +191,16 @@ float LOOPER_INTERFACE::saturation() const
   return 0.65f;
 }
 
- float LOOPER_INTERFACE::play_back_speed() const
- {
-  return m_dials[SPEED_POT].value();
- }
+float LOOPER_INTERFACE::play_back_speed() const
+{
+  // the speed dial is bipolar, the speed rises from the centre towards either end
+  return clamp( fabsf( m_dials[SPEED_POT].value() - 0.5f ) * 2.0f, 0.0f, 1.0f );
+}
+
+bool LOOPER_INTERFACE::play_back_reverse() const
+{
+  return m_play_back_reverse;
+}
 
 float LOOPER_INTERFACE::delay_mix() const
 {
@@ -160,8 +209,7 @@ float LOOPER_INTERFACE::delay_mix() const
 
 float LOOPER_INTERFACE::delay_time() const
 {
-  static constexpr float MAX_DELAY_TIME_MS = 500.0f;
-  return m_dials[DELAY_TIME_POT].value() * MAX_DELAY_TIME_MS;  
+  return m_dials[DELAY_TIME_POT].value() * AUDIO_DELAY::MAX_DELAY_TIME_MS;  
 }
 
 float LOOPER_INTERFACE::delay_feedback() const
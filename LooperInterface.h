@@ -14,6 +14,18 @@ public:
     NUM_MODES,
   };
 
+  // one per dial, in dial order
+  enum class PARAMETER
+  {
+    GAIN,
+    PLAY_BACK_SPEED,
+    DELAY_TIME,
+    DELAY_FEEDBACK,
+    DELAY_MIX,
+    LOOPER_MIX,
+    NUM_PARAMETERS,
+  };
+
 private:
   
     static constexpr int      MODE_BUTTON_PIN               = 2;
@@ -23,8 +35,13 @@ private:
     static constexpr int      LED_3_PIN                     = 7;
 
     static constexpr int      NUM_DIALS                     = 6;
+    static_assert( NUM_DIALS == static_cast<int>(PARAMETER::NUM_PARAMETERS), "Expected a parameter per dial" );
     static constexpr int      NUM_LEDS                      = 3;
 
+    static constexpr float    PARAMETER_CHANGE_THRESHOLD    = 1.0f / 1024.0f;  // ignore ADC noise
+    static constexpr float    REVERSE_HYSTERESIS            = 0.02f;           // either side of the speed dial's centre
+
+    DIAL_SCANNER              m_dial_scanner;
     DIAL                      m_dials[NUM_DIALS];
 
     BUTTON                    m_mode_button;
@@ -32,17 +49,22 @@ private:
 
     LED                       m_leds[NUM_LEDS];
 
+    float                     m_parameter_values[NUM_DIALS];  // as last reported by next_parameter_change()
+    uint32_t                  m_changed_parameters;           // bit per PARAMETER
+
     int                       m_current_play_back_sample;
     int                       m_num_samples;
     MODE                      m_mode;
     bool                      m_mode_pending;
+    bool                      m_play_back_reverse;
 
   public:
 
     LOOPER_INTERFACE();
-    void                      setup( int num_samples );
+    void                      setup( ADC& adc, int num_samples );
+    void                      set_num_samples( int num_samples );
 
-    bool                      update( ADC& adc, uint32_t time_in_ms );
+    bool                      update( uint32_t time_in_ms );
     void                      set_recording( bool recording, uint32_t time_in_ms );
     void                      set_mode_pending( bool pending, uint32_t time_in_ms );
 
@@ -50,9 +72,13 @@ private:
     const BUTTON&             record_button() const;
     bool                      sample_to_play( int& sample_index );
 
+    // returns each parameter whose dial has moved since it was last returned (all of them after setup)
+    bool                      next_parameter_change( PARAMETER& parameter );
+
     float                     gain() const;
     float                     saturation() const;       // not on a dial
-    float                     play_back_speed() const;
+    float                     play_back_speed() const;  // 0 at the centre of the dial, 1 at either end
+    bool                      play_back_reverse() const;  // left of centre
     float                     delay_time() const;
     float                     delay_feedback() const;
     float                     delay_mix() const;
@@ -0,0 +1,194 @@
+#include "Util.h"
+#include "LoopProfiler.h"
+#include "SDAsyncIO.h"
+
+SD_ASYNC_IO::SD_ASYNC_IO() :
+  m_requests(),
+  m_submit_index(0),
+  m_process_index(0),
+  m_num_busy_deferrals(0)
+{
+
+}
+
+int SD_ASYNC_IO::submit_read( File& file, uint32_t position, void* buffer, uint32_t size )
+{
+  return submit( OP::READ, &file, nullptr, position, static_cast<uint8_t*>(buffer), size );
+}
+
+int SD_ASYNC_IO::submit_write( File& file, uint32_t position, const void* buffer, uint32_t size )
+{
+  return submit( OP::WRITE, &file, nullptr, position, const_cast<uint8_t*>( static_cast<const uint8_t*>(buffer) ), size );
+}
+
+int SD_ASYNC_IO::submit_read( SD_RAW_STREAM& stream, uint32_t position, void* buffer, uint32_t size )
+{
+  ASSERT_MSG( position != CURRENT_POSITION, "SD_ASYNC_IO::submit_read() raw streams need a position" );
+  return submit( OP::READ, nullptr, &stream, position, static_cast<uint8_t*>(buffer), size );
+}
+
+int SD_ASYNC_IO::submit_write( SD_RAW_STREAM& stream, uint32_t position, const void* buffer, uint32_t size )
+{
+  ASSERT_MSG( position != CURRENT_POSITION, "SD_ASYNC_IO::submit_write() raw streams need a position" );
+  return submit( OP::WRITE, nullptr, &stream, position, const_cast<uint8_t*>( static_cast<const uint8_t*>(buffer) ), size );
+}
+
+int SD_ASYNC_IO::submit( OP op, File* file, SD_RAW_STREAM* stream, uint32_t position, uint8_t* buffer, uint32_t size )
+{
+  REQUEST& request = m_requests[m_submit_index];
+  if( request.m_status != STATUS::FREE )
+  {
+    // full - requests are reused in order, so this slot's result hasn't been collected yet
+    return INVALID_REQUEST;
+  }
+
+  request.m_file          = file;
+  request.m_stream        = stream;
+  request.m_buffer        = buffer;
+  request.m_position      = position;
+  request.m_size          = size;
+  request.m_transferred   = 0;
+  request.m_op            = op;
+  request.m_status        = STATUS::PENDING;
+
+  const int request_index = m_submit_index;
+  m_submit_index          = ( m_submit_index + 1 ) % MAX_REQUESTS;
+
+  return request_index;
+}
+
+bool SD_ASYNC_IO::complete( int request ) const
+{
+  ASSERT_MSG( request >= 0 && request < MAX_REQUESTS, "SD_ASYNC_IO::complete() invalid request" );
+
+  const STATUS status = m_requests[request].m_status;
+  return status == STATUS::COMPLETE || status == STATUS::FAILED;
+}
+
+int32_t SD_ASYNC_IO::finish( int request_index )
+{
+  ASSERT_MSG( complete( request_index ), "SD_ASYNC_IO::finish() request not complete" );
+
+  REQUEST& request      = m_requests[request_index];
+  const int32_t result  = request.m_status == STATUS::COMPLETE ? static_cast<int32_t>(request.m_transferred) : -1;
+  request.m_status      = STATUS::FREE;
+
+  return result;
+}
+
+int32_t SD_ASYNC_IO::wait( int request )
+{
+  while( !complete( request ) )
+  {
+    update();
+  }
+
+  return finish( request );
+}
+
+void SD_ASYNC_IO::wait_all()
+{
+  while( !idle() )
+  {
+    update();
+  }
+}
+
+bool SD_ASYNC_IO::idle() const
+{
+  return m_requests[m_process_index].m_status != STATUS::PENDING;
+}
+
+void SD_ASYNC_IO::update()
+{
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::SD_IO_TRANSFERS );
+
+  for( int t = 0; t < MAX_TRANSFERS_PER_UPDATE; ++t )
+  {
+    REQUEST& request = m_requests[m_process_index];
+    if( request.m_status != STATUS::PENDING )
+    {
+      return;
+    }
+
+    if( card_busy() )
+    {
+      // come back next time around the main loop, rather than waiting for the card
+      ++m_num_busy_deferrals;
+      return;
+    }
+
+    if( transfer( request ) )
+    {
+      m_process_index = ( m_process_index + 1 ) % MAX_REQUESTS;
+    }
+  }
+}
+
+uint32_t SD_ASYNC_IO::num_busy_deferrals() const
+{
+  return m_num_busy_deferrals;
+}
+
+bool SD_ASYNC_IO::transfer( REQUEST& request )
+{
+  if( request.m_stream != nullptr )
+  {
+    return transfer_stream( request );
+  }
+
+  const uint32_t remaining  = request.m_size - request.m_transferred;
+  const uint32_t size       = min_val<uint32_t>( remaining, TRANSFER_SIZE );
+  uint8_t* buffer           = request.m_buffer + request.m_transferred;
+
+  bool ok = true;
+  if( request.m_position != CURRENT_POSITION )
+  {
+    // re-seek every piece, other requests may have moved the file position in between
+    ok = request.m_file->seek( request.m_position + request.m_transferred );
+  }
+
+  uint32_t n = 0;
+  if( ok )
+  {
+    ADD_TIMED_SECTION( "Async transfer time", 2500 );
+    n = request.m_op == OP::READ ? request.m_file->read( buffer, size ) : request.m_file->write( buffer, size );
+  }
+
+  STATUS status = STATUS::PENDING;
+  if( !ok || ( request.m_op == OP::WRITE && n != size ) )
+  {
+    status = STATUS::FAILED;
+  }
+  else if( n < size || request.m_transferred + n == request.m_size )
+  {
+    // a short read is the end of the file
+    status = STATUS::COMPLETE;
+  }
+
+  request.m_transferred += n;
+  request.m_status      = status;
+
+  return status != STATUS::PENDING;
+}
+
+bool SD_ASYNC_IO::transfer_stream( REQUEST& request )
+{
+  // the whole request as a single multi-block command
+  bool ok = false;
+  {
+    ADD_TIMED_SECTION( "Async raw transfer time", 2500 );
+    ok = request.m_op == OP::READ ? request.m_stream->read( request.m_position, request.m_buffer, request.m_size ) :
+                                    request.m_stream->write( request.m_position, request.m_buffer, request.m_size );
+  }
+
+  request.m_transferred = ok ? request.m_size : 0;
+  request.m_status      = ok ? STATUS::COMPLETE : STATUS::FAILED;
+
+  return true;
+}
+
+bool SD_ASYNC_IO::card_busy() const
+{
+  return SD.sdfs.card()->isBusy();
+}
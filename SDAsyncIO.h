@@ -0,0 +1,79 @@
+#pragma once
+
+#include <SD.h>
+#include "SDRawStream.h"
+
+// Queue of SD card reads and writes, submitted from the main loop and performed a bounded piece at a time by update().
+// Requests complete in the order they were submitted, and completion is polled with complete()/finish().
+// Each transfer is still a blocking call (a sector through File, or a whole request as one multi-block command on a
+// raw stream), but update() never starts one whilst the card is busy programming a previous write - that wait (which
+// can be tens of ms) is what stalls the main loop with blocking writes. It isn't a DMA or background transfer, the
+// main loop has to keep calling update() for requests to progress.
+
+class SD_ASYNC_IO
+{
+public:
+
+  static constexpr const int      MAX_REQUESTS              = 8;
+  static constexpr const int      TRANSFER_SIZE             = 512;          // bytes per File access, one sector (raw streams transfer a whole request)
+  static constexpr const int      MAX_TRANSFERS_PER_UPDATE  = 2;
+  static constexpr const uint32_t CURRENT_POSITION          = 0xFFFFFFFF;   // continue from the file's current position
+  static constexpr const int      INVALID_REQUEST           = -1;
+
+  SD_ASYNC_IO();
+
+  // the buffer must remain valid until the request is finished, returns INVALID_REQUEST if the queue is full
+  int                 submit_read( File& file, uint32_t position, void* buffer, uint32_t size );
+  int                 submit_write( File& file, uint32_t position, const void* buffer, uint32_t size );
+  int                 submit_read( SD_RAW_STREAM& stream, uint32_t position, void* buffer, uint32_t size );
+  int                 submit_write( SD_RAW_STREAM& stream, uint32_t position, const void* buffer, uint32_t size );
+
+  bool                complete( int request ) const;
+  int32_t             finish( int request );      // frees a complete request, returns the bytes transferred, -1 if it failed
+  int32_t             wait( int request );        // blocking finish()
+  void                wait_all();                 // blocks until every submitted request has completed
+
+  bool                idle() const;
+
+  void                update();                   // called from the main loop, performs a bounded amount of transfer
+
+  uint32_t            num_busy_deferrals() const; // updates skipped because the card was busy
+
+private:
+
+  enum class OP : uint8_t
+  {
+    READ,
+    WRITE,
+  };
+
+  enum class STATUS : uint8_t
+  {
+    FREE,
+    PENDING,
+    COMPLETE,
+    FAILED,
+  };
+
+  struct REQUEST
+  {
+    File*             m_file          = nullptr;
+    SD_RAW_STREAM*    m_stream        = nullptr;  // used instead of m_file when set
+    uint8_t*          m_buffer        = nullptr;
+    uint32_t          m_position      = 0;
+    uint32_t          m_size          = 0;
+    uint32_t          m_transferred   = 0;
+    OP                m_op            = OP::READ;
+    STATUS            m_status        = STATUS::FREE;
+  };
+
+  REQUEST             m_requests[MAX_REQUESTS];   // ring, in submission order
+  int                 m_submit_index;
+  int                 m_process_index;
+  uint32_t            m_num_busy_deferrals;
+
+  int                 submit( OP op, File* file, SD_RAW_STREAM* stream, uint32_t position, uint8_t* buffer, uint32_t size );
+  bool                transfer( REQUEST& request );   // one piece, returns true when the request is done
+  bool                transfer_stream( REQUEST& request );
+  bool                card_busy() const;
+};
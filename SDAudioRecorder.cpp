@@ -1,63 +1,163 @@
 
+#include <algorithm>
+
 #include "Util.h"
+#include "AudioBlockTracker.h"
+#include "AudioProfiler.h"
+#include "LoopProfiler.h"
+#include "Scheduler.h"
 #include "SDAudioRecorder.h"
 
 // inspired by https://github.com/PaulStoffregen/Audio/blob/master/play_sd_raw.cpp
 
-constexpr const char* RECORDING_FILENAME1 = "RECORD1.RAW";
-constexpr const char* RECORDING_FILENAME2 = "RECORD2.RAW";
+// in the looper's directory, created at boot, so recording doesn't change the catalogued sample directories
+constexpr const char* RECORDING_FILENAME1 = "/LOOPER/RECORD1.WAV";
+constexpr const char* RECORDING_FILENAME2 = "/LOOPER/RECORD2.WAV";
+constexpr const char* SEQUENCE_FILENAME   = "/LOOPER/LOOP.SEQ";
+
+constexpr const uint32_t SEQUENCE_FILE_MAGIC    = 0x51455343; // "CSEQ"
+constexpr const uint16_t SEQUENCE_FILE_VERSION  = 1;
+
+static_assert( WAV_FORMAT::LOOPER_SAMPLE_RATE == static_cast<uint32_t>( AUDIO_SAMPLE_RATE_EXACT ), "Looper sample rate does not match the audio library" );
 
 
 SD_AUDIO_RECORDER::SD_AUDIO_RECORDER() :
-  AudioStream(1, m_input_queue_array),
+  AudioStream(NUM_INPUTS, m_input_queue_array),
   m_just_played_block(nullptr),
   m_current_play_block(nullptr),
+  m_record_source(RECORD_SOURCE::AUDIO_INPUT),
+  m_resampling(false),
   m_mode(MODE::STOP),
   m_pending_mode(MODE::NONE),
   m_play_back_filename(RECORDING_FILENAME1),
   m_record_filename(RECORDING_FILENAME1),
   m_recorded_audio_file(),
   m_play_back_audio_file(),
+  m_record_stream(),
+  m_play_back_stream(),
+  m_record_data_size(0),
+  m_record_data_limit(0),
+  m_record_read_buffer(nullptr),
+  m_record_read_offset(0),
+  m_play_back_info(),
   m_play_back_file_size(0),
+  m_play_back_readable_size(0),
   m_play_back_file_offset(0),
+  m_streaming_recording(false),
+  m_loop_length_quantum(0.0f),
+  m_initial_loop_length(0),
   m_jump_position(0),
   m_jump_pending(false),
+  m_jump_cue(-1),
+  m_cue_cache(),
+  m_cue_positions(),
+  m_cue_cache_loaded(0),
+  m_cue_cache_filename(nullptr),
+  m_transport_position(0.0f),
+  m_blocks_until_reposition(-1),
+  m_reposition_frame(0),
+  m_reposition_mode(MODE::NONE),
+  m_reposition_block_samples(AUDIO_BLOCK_SAMPLES),
+  m_pending_cue(-1),
+  m_cue(-1),
+  m_cue_read_head(0.0f),
+  m_fade_out_source(nullptr),
+  m_fade_out_size(0),
+  m_fade_out_head(0.0f),
+  m_fade_position(0),
+  m_crossfade_length(DEFAULT_CROSSFADE_SAMPLES),
+  m_sequences(),
+  m_sequence_pattern(0),
+  m_sequence_mode(SEQUENCE_MODE::NONE),
+  m_sequence_clock(0.0f),
+  m_sequence_cursor(),
+  m_num_missed_sequence_events(0),
+  m_sequence_cut_cue(-1),
+  m_sequence_record_start_clock(0),
+  m_sequence_record_start_transport(0.0f),
+  m_sequence_record_wraps(0),
+  m_sequence_file_state(SEQUENCE_FILE_STATE::IDLE),
+  m_sequence_file(),
+  m_sequence_file_request(SD_ASYNC_IO::INVALID_REQUEST),
+  m_sequence_file_size(0),
+  m_save_sequences_pending(false),
+  m_load_sequences_pending(true),
+  m_sequence_file_image(),
+  m_underrun_history(),
+  m_underrun_state(UNDERRUN_STATE::NONE),
+  m_concealed_samples(0),
+  m_underrun_event_samples(0),
+  m_underrun_skip_samples(0.0f),
+  m_late_record_blocks(0),
+  m_resampled_block_concealed(false),
+  m_underrun_recovery_position(0),
+  m_num_underruns(0),
+  m_last_underrun_samples(0),
+  m_num_underruns_logged(0),
   m_looping(false),
   m_finished_playback(false),
+  m_finishing_recording(false),
+  m_record_file_full(false),
+  m_recording_ended(false),
+  m_reverse(false),
+  m_play_reversed(false),
+  m_direction_change_pending(false),
   m_speed(1.0f),
+  m_target_speed(1.0f),
   m_read_head(0.0f),
   m_soft_clip_coefficient(0.0f),
+  m_commands(),
   m_sd_play_queue(*this, "PLAY_QUEUE"),
-  m_sd_record_queue(*this, "RECORD_QUEUE")
+  m_sd_record_queue(*this, "RECORD_QUEUE"),
+  m_sd_io(),
+  m_play_reads(),
+  m_play_read_head(0),
+  m_num_play_reads(0),
+  m_partial_play_block(nullptr),
+  m_partial_play_samples(0),
+  m_write_buffers(),
+  m_write_requests(),
+  m_write_head(0),
+  m_num_writes(0)
 {
     m_sd_play_queue.start();
 }
 
 void SD_AUDIO_RECORDER::update()
 {        
+  m_speed += ( m_target_speed - m_speed ) * SPEED_SMOOTHING;
+
   switch( m_mode )
   {
     case MODE::PLAY:
     {
+      ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::RECORDER_PLAY );
+
       update_playing_interrupt();
 
       break; 
     }
     case MODE::RECORD_INITIAL:
     {
-      m_sd_record_queue.add_block( create_record_block() );
+      ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::RECORDER_RECORD_INITIAL );
+
+      add_record_block_interrupt();
+      m_transport_position = m_transport_position + AUDIO_BLOCK_SAMPLES;
 
       break;
     }
     case MODE::RECORD_PLAY:
     case MODE::RECORD_OVERDUB:
     {
+      ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::RECORDER_RECORD_PLAY );
+
       update_playing_interrupt();
 
       ASSERT_MSG( !m_sd_play_queue.empty(), "Play queue empty, on interrupt" );
 
-      // update after updating play to capture buffer for overdub
-      m_sd_record_queue.add_block( create_record_block() );
+      // update after updating play to capture buffer for overdub (this also finishes a resample when the loop end has
+      // just switched to PLAY)
+      add_record_block_interrupt();
 
       break;
     }
@@ -66,62 +166,152 @@ void SD_AUDIO_RECORDER::update()
       break;
     }
   }
+
+  // an input only takes a new block once the last has been received, so anything unused is dropped to keep them current
+  for( int i = 0; i < NUM_INPUTS; ++i )
+  {
+    audio_block_t* unused_block = receiveReadOnly( i );
+    if( unused_block != nullptr )
+    {
+      release( unused_block );
+    }
+  }
 }
 
 void SD_AUDIO_RECORDER::update_main_loop()
 {  
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::SD_RECORDER );
+
+  m_sd_io.update();
+
+  process_commands_sd();
+
+  update_sequence_file_sd();
+
+  log_underruns();
+
   switch( m_mode )
   {
     case MODE::PLAY:
     {
+      if( m_finishing_recording )
+      {
+        // the interrupt has recorded the last block of the loop and is playing the recording
+        stop_recording_sd();
+        if( m_streaming_recording )
+        {
+          reopen_play_back_sd();
+        }
+      }
+
+      if( m_sequence_cut_cue >= 0 )
+      {
+        resync_after_sequence_cut_sd();
+      }
+
       if( m_jump_pending )
       {
-        if( m_play_back_audio_file.seek( m_jump_position ) )
+        if( jump_to_cue_sd( m_jump_cue, false ) )
+        {
+          // crossfading from the cue cache
+          m_jump_pending = false;
+        }
+        else
         {
+          // reads are submitted with their position, so the next read continues from here
           m_jump_pending = false;
           m_play_back_file_offset = m_jump_position;
+
+          // a loop end carried over the wrap is heard up to its last sample, then the jump
+          const int last_block_samples = queue_partial_play_block_sd();
+
+          AudioNoInterrupts();
+          schedule_reposition( m_jump_position / 2, queued_play_blocks(), MODE::NONE, last_block_samples );
+          AudioInterrupts();
         }
       }
 
+      // the loop which will become a recording streams forwards
+      if( m_reverse != m_play_reversed && m_pending_mode == MODE::NONE )
+      {
+        change_play_direction_sd();
+      }
+
       m_finished_playback = update_playing_sd();
 
       if( m_finished_playback )
       {       
-        if( m_looping )
-        {    
+        if( m_looping && m_pending_mode == MODE::NONE && jump_to_cue_sd( 0, true ) )
+        {
+          // wrap once the queued blocks have played, crossfading from the end of the loop into the cached start
+          enable_SPI_audio();
+          m_finished_playback = false;
+        }
+        else if( m_looping && m_pending_mode != MODE::NONE )
+        {
+          // the recording starts with a whole block, so the loop end is heard up to its last sample and the interrupt
+          // bridges the rest of that output block
+          ASSERT_MSG( m_pending_mode == MODE::RECORD_PLAY, "Invalid pending mode" );
+
+          const int last_block_samples = queue_partial_play_block_sd();
+
+          m_play_reversed = false;
+          start_recording_sd( m_play_back_file_size );
+          wrap_play_back_sd();
+
           AudioNoInterrupts();
-          
-          if( m_pending_mode != MODE::NONE )
-          {
-            ASSERT_MSG( m_pending_mode == MODE::RECORD_PLAY, "Invalid pending mode" );
+          schedule_reposition( 0, queued_play_blocks(), MODE::RECORD_PLAY, last_block_samples );
+          AudioInterrupts();
 
-            start_playing_sd();
-            start_recording_sd();
+          m_finished_playback = false;
+        }
+        else if( m_looping )
+        {
+          // keep streaming the same file, the loop end carried over is completed by the loop start so the wrap falls on
+          // its exact frame - the transport is repositioned at the first whole block after it
+          const int carried_samples = m_partial_play_samples;
+          wrap_play_back_sd();
 
-            m_mode          = MODE::RECORD_PLAY;
-            m_pending_mode  = MODE::NONE;
+          AudioNoInterrupts();
+          if( carried_samples > 0 )
+          {
+            const uint32_t frames_after_wrap = AUDIO_BLOCK_SAMPLES - carried_samples;
+            schedule_reposition( m_play_reversed ? loop_frames() - frames_after_wrap : frames_after_wrap, queued_play_blocks() + 1 );
           }
           else
           {
-            start_playing_sd();
-            m_mode = MODE::PLAY;
+            schedule_reposition( m_play_reversed ? loop_frames() : 0, queued_play_blocks() );
           }
-        
-          m_finished_playback = false;
-          
           AudioInterrupts();
+
+          m_finished_playback = false;
         }
         else
         {
           m_mode = MODE::STOP;
         }
       }
+
+      update_cue_cache_sd();
+
       break; 
     }
     case MODE::RECORD_INITIAL:
     {
       update_recording_sd();
 
+      if( m_record_file_full )
+      {
+        end_full_recording_sd();
+        break;
+      }
+
+      if( m_pending_mode == MODE::RECORD_PLAY && m_transport_position >= m_initial_loop_length )
+      {
+        // reached the quantised loop end
+        finish_record_initial_sd();
+      }
+
       break;
     }
     case MODE::RECORD_PLAY:
@@ -130,33 +320,45 @@ void SD_AUDIO_RECORDER::update_main_loop()
       m_finished_playback = update_playing_sd();
       
       update_recording_sd();
-      
+
+      if( m_record_file_full && !m_finishing_recording )
+      {
+        end_full_recording_sd();
+        break;
+      }
+
+      if( m_finishing_recording )
+      {
+        // the recording has been streamed to its end, the loop wraps again once the interrupt has switched to PLAY
+        m_finished_playback = false;
+      }
+
       // has the loop just finished
       if( m_finished_playback )
       {         
-        switch_play_record_buffers();
-
-        AudioNoInterrupts();
+        // the interrupt keeps playing (and recording) the queued blocks, and the loop end carried over, whilst the
+        // recording is streamed - the loop start is heard straight after the loop end's last sample
+        const int carried_samples = m_partial_play_samples;
+        const int queued_blocks   = queued_play_blocks() + ( carried_samples > 0 ? 1 : 0 );
+        const uint32_t frame      = carried_samples > 0 ? AUDIO_BLOCK_SAMPLES - carried_samples : 0;
 
+        MODE reposition_mode = MODE::NONE;
         if( m_pending_mode != MODE::NONE )
         {
           ASSERT_MSG( m_pending_mode == MODE::PLAY, "Invalid pending mode" );
 
-          stop_recording_sd();
-          start_playing_sd();
-
-          m_mode          = MODE::PLAY;
-          m_pending_mode  = MODE::NONE;
-        }
-        else
-        {
-          stop_recording_sd();
-          start_playing_sd();
-          start_recording_sd();
+          // the interrupt switches to PLAY once the loop end has been recorded, and nothing more is
+          m_finishing_recording = true;
+          reposition_mode       = MODE::PLAY;
         }
 
-        m_finished_playback = false;
+        stream_recording_sd();
+
+        AudioNoInterrupts();
+        schedule_reposition( frame, queued_blocks, reposition_mode );
         AudioInterrupts();
+
+        m_finished_playback = false;
       }
 
       break;
@@ -175,63 +377,122 @@ SD_AUDIO_RECORDER::MODE SD_AUDIO_RECORDER::mode() const
   
 void SD_AUDIO_RECORDER::play()
 {
-  AudioNoInterrupts();
+  post_command( COMMAND_TYPE::PLAY );
+}
+
+void SD_AUDIO_RECORDER::play_file( const char* filename, bool loop )
+{
+  post_command( COMMAND_TYPE::PLAY_FILE, filename, loop );
+}
+
+void SD_AUDIO_RECORDER::stop()
+{
+  post_command( COMMAND_TYPE::STOP );
+}
+
+void SD_AUDIO_RECORDER::start_record()
+{
+  post_command( COMMAND_TYPE::START_RECORD );
+}
 
+void SD_AUDIO_RECORDER::stop_record()
+{
+  post_command( COMMAND_TYPE::STOP_RECORD );
+}
+
+void SD_AUDIO_RECORDER::post_command( COMMAND_TYPE type, const char* filename, bool loop )
+{
+  COMMAND command;
+  command.m_type      = type;
+  command.m_filename  = filename;
+  command.m_loop      = loop;
+
+  if( !m_commands.push( command ) )
+  {
+    DEBUG_TEXT_LINE( "SD_AUDIO_RECORDER::post_command() - command queue full" );
+  }
+}
+
+void SD_AUDIO_RECORDER::process_commands_sd()
+{
+  COMMAND command;
+  while( m_commands.pop( command ) )
+  {
+    switch( command.m_type )
+    {
+      case COMMAND_TYPE::PLAY:
+      {
+        play_sd();
+        break;
+      }
+      case COMMAND_TYPE::PLAY_FILE:
+      {
+        play_file_sd( command.m_filename, command.m_loop );
+        break;
+      }
+      case COMMAND_TYPE::STOP:
+      {
+        stop_sd();
+        break;
+      }
+      case COMMAND_TYPE::START_RECORD:
+      {
+        start_record_sd();
+        break;
+      }
+      case COMMAND_TYPE::STOP_RECORD:
+      {
+        stop_record_sd();
+        break;
+      }
+    }
+  }
+}
+
+void SD_AUDIO_RECORDER::play_sd()
+{
   DEBUG_TEXT_LINE("SD_AUDIO_RECORDER::play()");
 
   if( m_mode == MODE::RECORD_PLAY || m_mode == MODE::RECORD_OVERDUB )
   {
-    m_pending_mode  = MODE::PLAY;
     m_looping       = true;
+    m_pending_mode  = MODE::PLAY;
   }
   else
   {
-    play_file( m_play_back_filename, true );
+    play_file_sd( m_play_back_filename, true );
   }
-
-  AudioInterrupts();
 }
 
-void SD_AUDIO_RECORDER::play_file( const char* filename, bool loop )
+void SD_AUDIO_RECORDER::play_file_sd( const char* filename, bool loop )
 {
-  // NOTE - should this be delaying call to start_playing() until update?
   m_play_back_filename = filename;
   m_looping = loop;
 
-  if( m_mode != MODE::PLAY )
-  {
-    DEBUG_TEXT_LINE("Stop play named file");
-    stop_current_mode( false );
-  }
+  DEBUG_TEXT_LINE("Stop play named file");
+  halt_interrupt();
+  stop_current_mode_sd( false );
   
-  if( start_playing_sd() )
+  if( start_playing_sd( m_reverse ) )
   {
+    AudioNoInterrupts();
     m_mode = MODE::PLAY;
-  }
-  else
-  {
-    m_mode = MODE::STOP;
+    schedule_reposition( m_play_reversed ? loop_length() : 0, -1 );
+    AudioInterrupts();
   }
 }
 
-void SD_AUDIO_RECORDER::stop()
+void SD_AUDIO_RECORDER::stop_sd()
 {
-  AudioNoInterrupts();
-  
   DEBUG_TEXT("SD_AUDIO_RECORDER::stop() ");
   DEBUG_TEXT_LINE( mode_to_string(m_mode) );
   
-  stop_current_mode( true );
-
-  m_mode = MODE::STOP;
-
-  AudioInterrupts();
+  halt_interrupt();
+  stop_current_mode_sd( true );
 }
 
-void SD_AUDIO_RECORDER::start_record()
+void SD_AUDIO_RECORDER::start_record_sd()
 {
-  AudioNoInterrupts();
-    
   switch( m_mode )
   {
     case MODE::PLAY:
@@ -245,9 +506,16 @@ void SD_AUDIO_RECORDER::start_record()
       m_play_back_filename  = RECORDING_FILENAME1;
       m_record_filename     = RECORDING_FILENAME2;
 
-      start_recording_sd();
+      // a new loop, the patterns of the previous one no longer apply
+      clear_sequences_sd();
+
+      // the loop length isn't known until recording stops
+      start_recording_sd( 0 );
 
+      AudioNoInterrupts();
       m_mode = MODE::RECORD_INITIAL;
+      schedule_reposition( 0, -1 );
+      AudioInterrupts();
       
       break;
     }
@@ -264,28 +532,34 @@ void SD_AUDIO_RECORDER::start_record()
       break;
     }   
   }
-
-  AudioInterrupts();
 }
 
-void SD_AUDIO_RECORDER::stop_record()
+void SD_AUDIO_RECORDER::stop_record_sd()
 {
-  AudioNoInterrupts();
-  
   switch( m_mode )
   {
     case MODE::RECORD_INITIAL:
     {
-      stop_recording_sd();
-
-      switch_play_record_buffers();
-
-      start_playing_sd();
-      start_recording_sd();
+      if( m_loop_length_quantum > 0.0f )
+      {
+        // end on the nearest multiple of the quantum - the recording is truncated to it, or continues until it's reached
+        const uint32_t recorded_length  = m_transport_position;
+        int num_quanta                  = round_to_int( recorded_length / m_loop_length_quantum );
+        if( num_quanta < 1 )
+        {
+          num_quanta = 1;
+        }
+        m_initial_loop_length           = round_to_int( num_quanta * m_loop_length_quantum );
+        m_record_data_limit             = m_initial_loop_length * 2;
 
-      m_mode = MODE::RECORD_PLAY;
+        if( m_initial_loop_length > recorded_length )
+        {
+          m_pending_mode = MODE::RECORD_PLAY;
+          break;
+        }
+      }
 
-      ASSERT_MSG( !m_sd_play_queue.empty(), "Play queue empty, on finish record initial" );
+      finish_record_initial_sd();
         
       break;
     }
@@ -296,206 +570,1568 @@ void SD_AUDIO_RECORDER::stop_record()
     }
     default:
     {
-      DEBUG_TEXT( "SD_AUDIO_RECORDER::start_record() - Invalid mode: " );
+      DEBUG_TEXT( "SD_AUDIO_RECORDER::stop_record() - Invalid mode: " );
       DEBUG_TEXT_LINE( mode_to_string( m_mode ) );
       break;
     }   
   }
-
-  AudioInterrupts();
 }
 
-bool SD_AUDIO_RECORDER::mode_pending() const
+void SD_AUDIO_RECORDER::finish_record_initial_sd()
 {
-  return m_pending_mode != MODE::NONE;
-}
+  // stop the interrupt recording before finishing the file
+  halt_interrupt();
 
-void SD_AUDIO_RECORDER::set_read_position( float t )
-{
- if( m_mode == MODE::PLAY )
- {
-  const uint32_t block_size   = 2; // AUDIO_BLOCK_SAMPLES
-  const uint32_t file_pos     = m_play_back_file_size * t;
-  const uint32_t block_rem    = file_pos % block_size;
-  
-  
-  m_jump_pending  = true;
-  m_jump_position = file_pos + block_rem;
- }
+  stop_recording_sd();
+
+  switch_play_record_buffers();
+
+  start_playing_sd( false );
+  start_recording_sd( m_play_back_file_size );
+
+  ASSERT_MSG( !m_sd_play_queue.empty(), "Play queue empty, on finish record initial" );
+
+  AudioNoInterrupts();
+  m_mode = MODE::RECORD_PLAY;
+  schedule_reposition( 0, -1 );
+  AudioInterrupts();
 }
 
-audio_block_t* SD_AUDIO_RECORDER::create_record_block()
+void SD_AUDIO_RECORDER::halt_interrupt()
 {
-  // if overdubbing, add incoming audio, otherwise re-record the original audio
-  if( m_mode == MODE::RECORD_PLAY )
-  {
-      ASSERT_MSG( m_just_played_block != nullptr, "Cannot record play, no block" ); // can it be null if overdub exceeds original play file?  
+  // once the interrupt is in STOP mode it no longer touches the queues, files or blocks
+  AudioNoInterrupts();
 
-      audio_block_t* play_block = m_just_played_block;
-      m_just_played_block = nullptr;
+  m_mode                    = MODE::STOP;
+  m_pending_mode            = MODE::NONE;
+  m_reposition_mode         = MODE::NONE;
+  m_blocks_until_reposition = -1;
 
-      return play_block;
-  }
-  if( m_mode == MODE::RECORD_OVERDUB )
-  {
-    ASSERT_MSG( m_just_played_block != nullptr, "Cannot overdub, no just_played_block" ); // can it be null if overdub exceeds original play file?
-    audio_block_t* in_block = receiveWritable();
-    ASSERT_MSG( in_block != nullptr, "Overdub - unable to receive block" );
+  AudioInterrupts();
+}
 
-    // mix incoming audio with recorded audio ( from update_playing() ) then release
-    if( in_block != nullptr && m_just_played_block != nullptr )
+void SD_AUDIO_RECORDER::collect_sd_io()
+{
+  // reads are queued in the order they were submitted, so stop at the first which hasn't completed
+  while( m_num_play_reads > 0 && m_sd_io.complete( m_play_reads[m_play_read_head].m_request ) )
+  {
+    PLAY_READ& play_read  = m_play_reads[m_play_read_head];
+    const int32_t n       = m_sd_io.finish( play_read.m_request );
+    if( n < 0 )
     {
-      for( int i = 0; i < AUDIO_BLOCK_SAMPLES; ++i )
-      {
-        const int32_t summed_sample = in_block->data[i] + m_just_played_block->data[i]; // need to add them in 32 bits to avoid wrap-around
-        const int16_t sample16      = clamp<int32_t>( summed_sample, std::numeric_limits<int16_t>::lowest(), std::numeric_limits<int16_t>::max() );
-        in_block->data[i]           = soft_clip_sample( sample16 );
-        ASSERT_MSG( in_block->data[i] < std::numeric_limits<int16_t>::max() && in_block->data[i] > std::numeric_limits<int16_t>::min(), "CLIPPING" );
-      }
+      DEBUG_TEXT_LINE( "collect_sd_io() - read failed" );
     }
-    else
+
+    int16_t* samples      = play_read.m_block->data + play_read.m_block_offset;
+    const int num_samples = max_val<int32_t>( n, 0 ) / 2;
+    if( play_read.m_reversed )
     {
-      //ASSERT_MSG( in_block != nullptr, "SD_AUDIO_RECORDER::aquire_block_func() no in_block" );
-      ASSERT_MSG( m_just_played_block != nullptr, "SD_AUDIO_RECORDER::aquire_block_func() no just_played_block" );
+      // the only short reverse read is at the start of the file, so the padding follows the first sample
+      std::reverse( samples, samples + num_samples );
+    }
 
-      audio_block_t* play_block = m_just_played_block;
-      m_just_played_block = nullptr;
+    const int block_samples = play_read.m_block_offset + num_samples;
+    m_play_read_head        = ( m_play_read_head + 1 ) % MAX_PLAY_READS_IN_FLIGHT;
+    --m_num_play_reads;
 
-      return play_block;
+    if( n == static_cast<int32_t>(play_read.m_size) && block_samples < AUDIO_BLOCK_SAMPLES )
+    {
+      // the end of the loop, held until the next read (from the loop start) fills the rest of the block
+      m_partial_play_block    = play_read.m_block;
+      m_partial_play_samples  = block_samples;
+      continue;
     }
 
-    if( m_just_played_block != nullptr )
+    for( int i = block_samples; i < AUDIO_BLOCK_SAMPLES; i++ )
     {
-      release( m_just_played_block );
-      m_just_played_block = nullptr;
+      play_read.m_block->data[i] = 0;
     }
 
-    return in_block;
+    AUDIO_BLOCK_TRANSFER( play_read.m_block, SD_READ, PLAY_QUEUE );
+    m_sd_play_queue.add_block( play_read.m_block );
   }
-  else
+
+  while( m_num_writes > 0 && m_sd_io.complete( m_write_requests[m_write_head] ) )
   {
-    ASSERT_MSG( m_mode == MODE::RECORD_INITIAL, "What mode is this?" );
-    audio_block_t* in_block = receiveReadOnly();
-    ASSERT_MSG( in_block != nullptr, "Record Initial - unable to receive block" );
+    if( m_sd_io.finish( m_write_requests[m_write_head] ) < 0 )
+    {
+      // most likely the card is full
+      DEBUG_TEXT_LINE( "collect_sd_io() - write failed" );
+      m_record_file_full = true;
+    }
 
-    return in_block;
+    m_write_head = ( m_write_head + 1 ) % NUM_WRITE_BUFFERS;
+    --m_num_writes;
   }
 }
 
-void SD_AUDIO_RECORDER::release_block_func(audio_block_t* block)
+void SD_AUDIO_RECORDER::finish_sd_io()
 {
-  release(block);
+  m_sd_io.wait_all();
+  collect_sd_io();
 }
 
-bool SD_AUDIO_RECORDER::start_playing_sd()
+int SD_AUDIO_RECORDER::queued_play_blocks() const
 {
-  DEBUG_TEXT("SD_AUDIO_RECORDER::start_playing_sd() ");
-  DEBUG_TEXT_LINE( m_play_back_filename );
-
-  m_read_head = 0.0f;
-  
-  stop_playing_sd();
+  // reads in flight will be queued ahead of anything read later
+  return m_sd_play_queue.size() + m_num_play_reads;
+}
 
-  ASSERT_MSG( m_current_play_block == nullptr, "Leaking current play block" );
+bool SD_AUDIO_RECORDER::check_block_ownership() const
+{
+  // each owner's census must match the blocks the recorder knows it holds, any excess has been leaked
+  AudioNoInterrupts();
+  const AUDIO_BLOCK_TRACKER::CENSUS census = AUDIO_BLOCK_TRACKER::census();
+
+  int expected_blocks[AUDIO_BLOCK_TRACKER::NUM_OWNERS] = {};
+  expected_blocks[static_cast<int>(AUDIO_BLOCK_TRACKER::OWNER::SD_READ)]       = m_num_play_reads + ( m_partial_play_block != nullptr ? 1 : 0 );
+  expected_blocks[static_cast<int>(AUDIO_BLOCK_TRACKER::OWNER::PLAY_QUEUE)]    = m_sd_play_queue.size();
+  expected_blocks[static_cast<int>(AUDIO_BLOCK_TRACKER::OWNER::CURRENT_PLAY)]  = m_current_play_block != nullptr ? 1 : 0;
+  expected_blocks[static_cast<int>(AUDIO_BLOCK_TRACKER::OWNER::JUST_PLAYED)]   = m_just_played_block != nullptr ? 1 : 0;
+  expected_blocks[static_cast<int>(AUDIO_BLOCK_TRACKER::OWNER::RECORD_QUEUE)]  = m_sd_record_queue.size() + ( m_record_read_buffer != nullptr ? 1 : 0 );
+  AudioInterrupts();
 
-  enable_SPI_audio();
-  __disable_irq();
-  m_play_back_audio_file = SD.open( m_play_back_filename );
-  __enable_irq();
-  
-  if( !m_play_back_audio_file )
+  bool consistent = true;
+  for( int o = 1; o < AUDIO_BLOCK_TRACKER::NUM_OWNERS; ++o )
   {
-    DEBUG_TEXT("Unable to open file: ");
-    DEBUG_TEXT_LINE( m_play_back_filename );
-#if defined(HAS_KINETIS_SDHC)
-      if (!(SIM_SCGC3 & SIM_SCGC3_SDHC)) AudioStopUsingSPI();
-#else
-      AudioStopUsingSPI();
-#endif
-
-    return false;
+    if( census.m_blocks[o] != expected_blocks[o] )
+    {
+      DEBUG_TEXT( "Audio block ownership mismatch - " );
+      DEBUG_TEXT( AUDIO_BLOCK_TRACKER::owner_name( static_cast<AUDIO_BLOCK_TRACKER::OWNER>(o) ) );
+      DEBUG_TEXT( " holds:" );
+      DEBUG_TEXT( census.m_blocks[o] );
+      DEBUG_TEXT( " expected:" );
+      DEBUG_TEXT_LINE( expected_blocks[o] );
+      consistent = false;
+    }
   }
 
-  DEBUG_TEXT("Play File loaded ");
-  DEBUG_TEXT(m_play_back_filename);
-  m_play_back_file_size = m_play_back_audio_file.size();
-  m_play_back_file_offset = 0;
-  DEBUG_TEXT(" file size: ");
-  DEBUG_TEXT_LINE(m_play_back_file_size);
-
-  // prime the first read block in the read queue
-  for( int i = 0; i < INITIAL_PLAY_BLOCKS; ++i )
+  if( !consistent )
   {
-    update_playing_sd();
+    AUDIO_BLOCK_TRACKER::print_census( census );
   }
 
-  return true;
+  return consistent;
 }
 
-bool SD_AUDIO_RECORDER::update_playing_sd()
+bool SD_AUDIO_RECORDER::mode_pending() const
 {
-  bool finished = false;
+  return m_pending_mode != MODE::NONE || !m_commands.empty();
+}
 
-  if( m_play_back_audio_file.available() )
-  {    
-    if( m_sd_play_queue.remaining() > 0 &&
-        (m_mode != MODE::PLAY || m_sd_play_queue.size() <= MAX_PREFERRED_RECORD_BLOCKS_WHEN_PLAYING) )
+bool SD_AUDIO_RECORDER::recording_ended()
+{
+  const bool ended  = m_recording_ended;
+  m_recording_ended = false;
+  return ended;
+}
+
+void SD_AUDIO_RECORDER::set_read_position( float t )
+{
+ if( m_mode == MODE::PLAY )
+ {
+  const uint32_t block_size   = 2; // AUDIO_BLOCK_SAMPLES
+  const uint32_t file_pos     = m_play_back_file_size * t;
+  const uint32_t block_rem    = file_pos % block_size;
+  
+  
+  m_jump_pending  = true;
+  m_jump_position = file_pos + block_rem;
+
+  // is this the start of a segment, which may be in the cue cache
+  const float segment = t * NUM_SEGMENTS;
+  const int segment_index = round_to_int( segment );
+  m_jump_cue      = ( fabsf( segment - segment_index ) < 0.001f && segment_index < NUM_SEGMENTS ) ? segment_index : -1;
+ }
+}
+
+void SD_AUDIO_RECORDER::record_sequence()
+{
+  AudioNoInterrupts();
+  m_sequences[m_sequence_pattern].clear();
+  m_sequence_mode                     = SEQUENCE_MODE::RECORD;
+  m_sequence_record_start_clock       = static_cast<uint32_t>(m_sequence_clock);
+  m_sequence_record_start_transport   = m_transport_position;
+  m_sequence_record_wraps             = 0;
+  AudioInterrupts();
+}
+
+void SD_AUDIO_RECORDER::play_sequence()
+{
+  AudioNoInterrupts();
+  const bool recorded = m_sequence_mode == SEQUENCE_MODE::RECORD;
+  if( recorded )
+  {
+    add_sequence_return_event();
+  }
+  m_sequence_cursor   = m_sequences[m_sequence_pattern].first_event_from( static_cast<uint32_t>(m_sequence_clock) );
+  m_sequence_mode     = SEQUENCE_MODE::PLAY;
+  AudioInterrupts();
+
+  if( recorded )
+  {
+    m_save_sequences_pending = true;
+  }
+}
+
+void SD_AUDIO_RECORDER::stop_sequence()
+{
+  m_sequence_mode = SEQUENCE_MODE::NONE;
+}
+
+void SD_AUDIO_RECORDER::select_sequence_pattern( int pattern )
+{
+  ASSERT_MSG( pattern >= 0 && pattern < NUM_SEQUENCE_PATTERNS, "SD_AUDIO_RECORDER::select_sequence_pattern() invalid pattern" );
+
+  AudioNoInterrupts();
+  m_sequence_pattern  = pattern;
+  m_sequence_cursor   = m_sequences[pattern].first_event_from( static_cast<uint32_t>(m_sequence_clock) );
+  AudioInterrupts();
+}
+
+int SD_AUDIO_RECORDER::sequence_pattern() const
+{
+  return m_sequence_pattern;
+}
+
+bool SD_AUDIO_RECORDER::sequence_pattern_empty( int pattern ) const
+{
+  return m_sequences[pattern].empty();
+}
+
+SD_AUDIO_RECORDER::SEQUENCE_MODE SD_AUDIO_RECORDER::sequence_mode() const
+{
+  return m_sequence_mode;
+}
+
+uint32_t SD_AUDIO_RECORDER::num_missed_sequence_events() const
+{
+  return m_num_missed_sequence_events;
+}
+
+uint32_t SD_AUDIO_RECORDER::num_underruns() const
+{
+  return m_num_underruns;
+}
+
+void SD_AUDIO_RECORDER::resync_after_sequence_cut_sd()
+{
+  // reads in flight are from before the cut
+  finish_sd_io();
+
+  AudioNoInterrupts();
+  const int cue = m_sequence_cut_cue;
+  m_sd_play_queue.clear();
+  release_partial_play_block_sd();
+  m_blocks_until_reposition = -1;
+  m_sequence_cut_cue        = -1;
+  AudioInterrupts();
+
+  // stream continues from the end of the cached section
+  m_play_back_file_offset   = m_cue_positions[cue] + CUE_CACHE_SAMPLES * 2;
+  m_finished_playback       = false;
+}
+
+void SD_AUDIO_RECORDER::clear_sequences_sd()
+{
+  finish_sequence_file_sd();
+
+  AudioNoInterrupts();
+  m_sequence_mode = SEQUENCE_MODE::NONE;
+  for( SEQUENCE& sequence : m_sequences )
+  {
+    sequence.clear();
+  }
+  AudioInterrupts();
+
+  m_save_sequences_pending  = false;
+  m_load_sequences_pending  = false;
+
+  if( SD.exists( SEQUENCE_FILENAME ) )
+  {
+    SD.remove( SEQUENCE_FILENAME );
+  }
+}
+
+void SD_AUDIO_RECORDER::update_sequence_file_sd()
+{
+  switch( m_sequence_file_state )
+  {
+    case SEQUENCE_FILE_STATE::IDLE:
     {
-      // allocate the audio blocks to transmit
-      audio_block_t* block = allocate();
-      if( block == nullptr )
+      if( m_save_sequences_pending )
       {
-        DEBUG_TEXT_LINE( "update_playing_sd() - Failed to allocate" );
-        return false;
+        m_save_sequences_pending = false;
+        start_save_sequences_sd();
       }
-    
-      // we can read more data from the file...
-      uint32_t n = 0;
+      else if( m_load_sequences_pending && m_mode == MODE::PLAY && loop_length() > 0 )
       {
-        ADD_TIMED_SECTION( "Read time", 2500 );
-        n = m_play_back_audio_file.read( block->data, AUDIO_BLOCK_SAMPLES*2 );
+        m_load_sequences_pending = false;
+        start_load_sequences_sd();
       }
-
-      m_play_back_file_offset += n;
-      for( int i = n/2; i < AUDIO_BLOCK_SAMPLES; i++ )
+      break;
+    }
+    case SEQUENCE_FILE_STATE::SAVING:
+    case SEQUENCE_FILE_STATE::LOADING:
+    {
+      if( m_sequence_file_request == SD_ASYNC_IO::INVALID_REQUEST )
       {
-        block->data[i] = 0;
+        // the queue was full, try again
+        m_sequence_file_request = m_sequence_file_state == SEQUENCE_FILE_STATE::SAVING ?
+                                  m_sd_io.submit_write( m_sequence_file, 0, m_sequence_file_image, m_sequence_file_size ) :
+                                  m_sd_io.submit_read( m_sequence_file, 0, m_sequence_file_image, m_sequence_file_size );
       }
-
-      if( block == nullptr )
+      else if( m_sd_io.complete( m_sequence_file_request ) )
       {
-        DEBUG_TEXT_LINE("Adding null play block");
+        const bool loading  = m_sequence_file_state == SEQUENCE_FILE_STATE::LOADING;
+        const bool ok       = m_sd_io.finish( m_sequence_file_request ) == m_sequence_file_size;
+        m_sequence_file_request = SD_ASYNC_IO::INVALID_REQUEST;
+
+        finish_sequence_file_sd();
+
+        if( !ok )
+        {
+          DEBUG_TEXT_LINE( "SD_AUDIO_RECORDER sequence file transfer failed" );
+        }
+        else if( loading && !apply_sequence_file_image( m_sequence_file_size ) )
+        {
+          DEBUG_TEXT_LINE( "SD_AUDIO_RECORDER sequence file doesn't match the loop" );
+        }
       }
-      m_sd_play_queue.add_block( block );
+      break;
+    }
+  }
+}
+
+void SD_AUDIO_RECORDER::start_save_sequences_sd()
+{
+  // snapshot the patterns, the interrupt may record into them whilst the file is written
+  SEQUENCE_FILE_HEADER header;
+  header.m_magic        = SEQUENCE_FILE_MAGIC;
+  header.m_version      = SEQUENCE_FILE_VERSION;
+  header.m_num_patterns = NUM_SEQUENCE_PATTERNS;
+  header.m_loop_length  = loop_length();
+
+  int size = sizeof(header);
+  AudioNoInterrupts();
+  for( int p = 0; p < NUM_SEQUENCE_PATTERNS; ++p )
+  {
+    const SEQUENCE& sequence  = m_sequences[p];
+    header.m_data_sizes[p]    = sequence.data_size();
+    memcpy( m_sequence_file_image + size, sequence.data(), sequence.data_size() );
+    size                      += sequence.data_size();
+  }
+  AudioInterrupts();
+  memcpy( m_sequence_file_image, &header, sizeof(header) );
+
+  // opening the file is synchronous
+  finish_sd_io();
+  if( SD.exists( SEQUENCE_FILENAME ) )
+  {
+    // delete previously existing file (SD library will append to the end)
+    SD.remove( SEQUENCE_FILENAME );
+  }
+
+  m_sequence_file = SD.open( SEQUENCE_FILENAME, FILE_WRITE );
+  if( !m_sequence_file )
+  {
+    DEBUG_TEXT( "Unable to open file: " );
+    DEBUG_TEXT_LINE( SEQUENCE_FILENAME );
+    return;
+  }
+
+  m_sequence_file_size    = size;
+  m_sequence_file_request = m_sd_io.submit_write( m_sequence_file, 0, m_sequence_file_image, size );
+  m_sequence_file_state   = SEQUENCE_FILE_STATE::SAVING;
+}
+
+void SD_AUDIO_RECORDER::start_load_sequences_sd()
+{
+  finish_sd_io();
+
+  m_sequence_file = SD.open( SEQUENCE_FILENAME );
+  if( !m_sequence_file )
+  {
+    // no patterns saved for this loop
+    return;
+  }
+
+  const uint32_t file_size = m_sequence_file.size();
+  if( file_size < sizeof(SEQUENCE_FILE_HEADER) || file_size > SEQUENCE_FILE_IMAGE_SIZE )
+  {
+    DEBUG_TEXT_LINE( "SD_AUDIO_RECORDER invalid sequence file" );
+    m_sequence_file.close();
+    return;
+  }
+
+  m_sequence_file_size    = file_size;
+  m_sequence_file_request = m_sd_io.submit_read( m_sequence_file, 0, m_sequence_file_image, file_size );
+  m_sequence_file_state   = SEQUENCE_FILE_STATE::LOADING;
+}
+
+void SD_AUDIO_RECORDER::finish_sequence_file_sd()
+{
+  if( m_sequence_file_state == SEQUENCE_FILE_STATE::IDLE )
+  {
+    return;
+  }
+
+  // closing is synchronous, and the request must be complete before the file goes
+  finish_sd_io();
+  if( m_sequence_file_request != SD_ASYNC_IO::INVALID_REQUEST )
+  {
+    m_sd_io.finish( m_sequence_file_request );
+    m_sequence_file_request = SD_ASYNC_IO::INVALID_REQUEST;
+  }
+
+  m_sequence_file.close();
+  m_sequence_file_state = SEQUENCE_FILE_STATE::IDLE;
+}
+
+bool SD_AUDIO_RECORDER::apply_sequence_file_image( int size )
+{
+  SEQUENCE_FILE_HEADER header;
+  memcpy( &header, m_sequence_file_image, sizeof(header) );
+
+  int data_size = 0;
+  for( int p = 0; p < NUM_SEQUENCE_PATTERNS; ++p )
+  {
+    data_size += header.m_data_sizes[p];
+  }
+
+  if( header.m_magic != SEQUENCE_FILE_MAGIC ||
+      header.m_version != SEQUENCE_FILE_VERSION ||
+      header.m_num_patterns != NUM_SEQUENCE_PATTERNS ||
+      header.m_loop_length != loop_length() ||
+      static_cast<int>(sizeof(header)) + data_size != size )
+  {
+    return false;
+  }
+
+  AudioNoInterrupts();
+  int offset = sizeof(header);
+  for( int p = 0; p < NUM_SEQUENCE_PATTERNS; ++p )
+  {
+    m_sequences[p].set_data( m_sequence_file_image + offset, header.m_data_sizes[p] );
+    offset += header.m_data_sizes[p];
+  }
+  m_sequence_cursor = m_sequences[m_sequence_pattern].first_event_from( static_cast<uint32_t>(m_sequence_clock) );
+  AudioInterrupts();
+
+  DEBUG_TEXT_LINE( "SD_AUDIO_RECORDER loaded sequence patterns" );
+  return true;
+}
+
+void SD_AUDIO_RECORDER::set_loop_length_quantum( float num_samples )
+{
+  m_loop_length_quantum = num_samples;
+}
+
+void SD_AUDIO_RECORDER::set_crossfade_length( int num_samples )
+{
+  m_crossfade_length = clamp( num_samples, 0, MAX_CROSSFADE_SAMPLES );
+}
+
+void SD_AUDIO_RECORDER::set_record_source( RECORD_SOURCE source )
+{
+  m_record_source = source;
+}
+
+SD_AUDIO_RECORDER::RECORD_SOURCE SD_AUDIO_RECORDER::record_source() const
+{
+  return m_record_source;
+}
+
+void SD_AUDIO_RECORDER::add_record_block_interrupt()
+{
+  // the output mix containing a loop block arrives the update after it was played, so whilst resampling the record queue
+  // runs a block behind the loop - nothing is queued as resampling starts, and two blocks as it stops
+  const bool resampling = m_mode == MODE::RECORD_OVERDUB && m_record_source == RECORD_SOURCE::RESAMPLE;
+  if( resampling || m_resampling )
+  {
+    audio_block_t* output_block = receiveReadOnly( INPUT_RESAMPLE );
+    if( m_resampling && !m_resampled_block_concealed )
+    {
+      // the output mix of the previous block
+      queue_record_block_interrupt( output_block );
+    }
+    else if( output_block != nullptr )
+    {
+      // the previous block has already been queued, or was concealed and is recorded as it arrives
+      release( output_block );
+    }
+    m_resampling = resampling;
+  }
+
+  // a concealed block isn't recorded, the stream block is recorded in its place once it arrives
+  const bool concealed        = ( m_mode == MODE::RECORD_PLAY || m_mode == MODE::RECORD_OVERDUB ) && m_just_played_block == nullptr;
+  m_resampled_block_concealed = concealed;
+
+  if( !is_recording() )
+  {
+    // the loop end has just been heard, the block played this update starts the next loop
+    if( m_just_played_block != nullptr )
+    {
+      release_block_func( m_just_played_block );
+      m_just_played_block = nullptr;
+    }
+    return;
+  }
+
+  if( concealed )
+  {
+    // an overdub's input is dropped, there's nothing to mix it into yet
+    return;
+  }
+
+  if( resampling )
+  {
+    // replaced by its output mix next update
+    if( m_just_played_block != nullptr )
+    {
+      release_block_func( m_just_played_block );
+      m_just_played_block = nullptr;
+    }
+    return;
+  }
+
+  queue_record_block_interrupt( create_record_block() );
+}
+
+void SD_AUDIO_RECORDER::queue_record_block_interrupt( audio_block_t* block )
+{
+  ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::RECORDER_QUEUES );
+  AUDIO_BLOCK_OWNER( block, RECORD_QUEUE );
+  m_sd_record_queue.add_block( block );
+}
+
+audio_block_t* SD_AUDIO_RECORDER::create_record_block()
+{
+  ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::RECORDER_CREATE_RECORD_BLOCK );
+
+  // if overdubbing, add incoming audio, otherwise re-record the original audio
+  if( m_mode == MODE::RECORD_PLAY )
+  {
+      ASSERT_MSG( m_just_played_block != nullptr, "Cannot record play, no block" ); // can it be null if overdub exceeds original play file?  
+
+      audio_block_t* play_block = m_just_played_block;
+      m_just_played_block = nullptr;
+
+      return play_block;
+  }
+  if( m_mode == MODE::RECORD_OVERDUB )
+  {
+    ASSERT_MSG( m_just_played_block != nullptr, "Cannot overdub, no just_played_block" ); // can it be null if overdub exceeds original play file?
+    audio_block_t* in_block = receiveWritable( INPUT_AUDIO );
+    ASSERT_MSG( in_block != nullptr, "Overdub - unable to receive block" );
+
+    // mix incoming audio with recorded audio ( from update_playing() ) then release
+    if( in_block != nullptr && m_just_played_block != nullptr )
+    {
+      DSP_UTILS::mix_overdub( in_block->data, m_just_played_block->data, AUDIO_BLOCK_SAMPLES, m_soft_clip_coefficient );
+    }
+    else
+    {
+      //ASSERT_MSG( in_block != nullptr, "SD_AUDIO_RECORDER::aquire_block_func() no in_block" );
+      ASSERT_MSG( m_just_played_block != nullptr, "SD_AUDIO_RECORDER::aquire_block_func() no just_played_block" );
+
+      audio_block_t* play_block = m_just_played_block;
+      m_just_played_block = nullptr;
+
+      return play_block;
     }
+
+    if( m_just_played_block != nullptr )
+    {
+      release_block_func( m_just_played_block );
+      m_just_played_block = nullptr;
+    }
+
+    return in_block;
   }
   else
   {
-    DEBUG_TEXT("File End ");
-    DEBUG_TEXT_LINE(m_play_back_audio_file.name());
+    ASSERT_MSG( m_mode == MODE::RECORD_INITIAL, "What mode is this?" );
+    audio_block_t* in_block = receiveReadOnly( INPUT_AUDIO );
+    ASSERT_MSG( in_block != nullptr, "Record Initial - unable to receive block" );
 
-    disable_SPI_audio();
-            
-    finished = true;
+    return in_block;
   }
+}
 
-  return finished;
+void SD_AUDIO_RECORDER::release_block_func(audio_block_t* block)
+{
+  AUDIO_BLOCK_OWNER( block, NONE );
+  release(block);
 }
 
-void SD_AUDIO_RECORDER::update_playing_interrupt()
-{  
-  if( m_sd_play_queue.size() > 0 )
-  {
-    // when recording - speed is always 1 and need to set just_played_block for overdub
-    if( is_recording() )
-    {
-      audio_block_t* block = m_sd_play_queue.read_block();
-      ASSERT_MSG( block != nullptr, "update_playing_interrupt() null block" );
-      transmit( block );  
-      m_sd_play_queue.release_buffer(false);
+bool SD_AUDIO_RECORDER::start_playing_sd( bool reverse )
+{
+  DEBUG_TEXT("SD_AUDIO_RECORDER::start_playing_sd() ");
+  DEBUG_TEXT_LINE( m_play_back_filename );
+
+  // the interrupt must not be playing
+  m_read_head = 0.0f;
+  
+  stop_playing_sd();
+  m_direction_change_pending = false;
+
+  ASSERT_MSG( m_current_play_block == nullptr, "Leaking current play block" );
+
+  if( !open_play_back_sd( reverse ) )
+  {
+    return false;
+  }
+
+  // prime the first read block in the read queue
+  for( int i = 0; i < INITIAL_PLAY_BLOCKS; ++i )
+  {
+    update_playing_sd();
+    finish_sd_io();
+  }
+
+  return true;
+}
+
+bool SD_AUDIO_RECORDER::open_play_back_sd( bool reverse )
+{
+  // doesn't touch the play queue or blocks, so the interrupt can keep playing what's already queued
+  finish_sd_io();
+
+  m_play_back_stream.close();
+  if( m_play_back_audio_file )
+  {
+    m_play_back_audio_file.close();
+  }
+
+  enable_SPI_audio();
+  if( !m_play_back_stream.open_read( m_play_back_filename ) )
+  {
+    // fragmented, read through the file system instead
+    m_play_back_audio_file = SD.open( m_play_back_filename );
+  }
+  
+  if( !m_play_back_stream.is_open() && !m_play_back_audio_file )
+  {
+    DEBUG_TEXT("Unable to open file: ");
+    DEBUG_TEXT_LINE( m_play_back_filename );
+    disable_SPI_audio();
+
+    return false;
+  }
+
+  if( !read_play_back_header_sd() )
+  {
+    DEBUG_TEXT("Unsupported file format: ");
+    DEBUG_TEXT_LINE( m_play_back_filename );
+
+    m_play_back_stream.close();
+    m_play_back_audio_file.close();
+    disable_SPI_audio();
+
+    return false;
+  }
+
+  DEBUG_TEXT("Play File loaded ");
+  DEBUG_TEXT(m_play_back_filename);
+  m_play_back_file_size     = m_play_back_info.m_data_size;
+  m_play_back_readable_size = m_play_back_file_size;
+  m_streaming_recording     = false;
+
+  if( m_cue_cache_filename == nullptr || strcmp( m_cue_cache_filename, m_play_back_filename ) != 0 )
+  {
+    reset_cue_cache();
+  }
+
+  m_play_reversed = reverse;
+  if( m_play_reversed )
+  {
+    m_play_back_file_offset = m_play_back_file_size & ~1u;
+  }
+  else
+  {
+    m_play_back_file_offset = 0;
+  }
+  DEBUG_TEXT(" file size: ");
+  DEBUG_TEXT_LINE(m_play_back_file_size);
+
+  return true;
+}
+
+bool SD_AUDIO_RECORDER::open_play_back_recording_sd()
+{
+  // the record file has no header until it's closed, so only the audio written so far can be streamed - the loop is
+  // the length it's being recorded to
+  finish_sd_io();
+
+  m_play_back_stream.close();
+  if( m_play_back_audio_file )
+  {
+    m_play_back_audio_file.close();
+  }
+
+  enable_SPI_audio();
+  if( m_record_stream.is_open() )
+  {
+    m_play_back_stream.open_read( m_record_stream, WAV_FORMAT::HEADER_SIZE + m_record_data_size );
+  }
+  else
+  {
+    // a second handle onto the file, which sees what's been flushed
+    m_recorded_audio_file.flush();
+    m_play_back_audio_file = SD.open( m_play_back_filename );
+  }
+
+  if( !m_play_back_stream.is_open() && !m_play_back_audio_file )
+  {
+    DEBUG_TEXT("Unable to open file: ");
+    DEBUG_TEXT_LINE( m_play_back_filename );
+    disable_SPI_audio();
+
+    return false;
+  }
+
+  m_play_back_info                = WAV_FORMAT::WAV_INFO();
+  m_play_back_info.m_sample_rate  = WAV_FORMAT::LOOPER_SAMPLE_RATE;
+  m_play_back_info.m_data_offset  = WAV_FORMAT::HEADER_SIZE;
+  m_play_back_info.m_data_size    = m_record_data_limit > 0 ? m_record_data_limit : m_record_data_size;
+  m_play_back_file_size           = m_play_back_info.m_data_size;
+  m_play_back_readable_size       = min_val( m_record_data_size, m_play_back_file_size );
+  m_play_back_file_offset         = 0;
+  m_play_reversed                 = false;
+  m_streaming_recording           = true;
+
+  reset_cue_cache();
+
+  return true;
+}
+
+void SD_AUDIO_RECORDER::extend_play_back_recording_sd()
+{
+  // the reads have caught up with what had been written of the recording, stream whatever's been written since
+  if( m_num_play_reads > 0 || m_record_data_size <= m_play_back_readable_size || !record_file_open() )
+  {
+    return;
+  }
+
+  const uint32_t offset = m_play_back_file_offset;
+  if( open_play_back_recording_sd() )
+  {
+    m_play_back_file_offset = offset;
+  }
+}
+
+void SD_AUDIO_RECORDER::reopen_play_back_sd()
+{
+  // the file is complete, carry on streaming it from where the reads had got to
+  const uint32_t offset = m_play_back_file_offset;
+
+  if( open_play_back_sd( false ) )
+  {
+    m_play_back_file_offset = min_val( offset, m_play_back_file_size & ~1u );
+    reset_cue_cache();
+  }
+}
+
+bool SD_AUDIO_RECORDER::read_play_back_header_sd()
+{
+  auto file_reader = [this]( uint32_t offset, void* dest, uint32_t size ) -> bool
+  {
+    return read_play_back_sd( offset, dest, size );
+  };
+
+  const uint32_t file_size = m_play_back_stream.is_open() ? m_play_back_stream.size() : m_play_back_audio_file.size();
+  if( !WAV_FORMAT::read_header( file_reader, file_size, m_play_back_info ) )
+  {
+    // headerless .RAW file - assume mono 16-bit at the audio library sample rate
+    m_play_back_info                    = WAV_FORMAT::WAV_INFO();
+    m_play_back_info.m_sample_rate      = WAV_FORMAT::LOOPER_SAMPLE_RATE;
+    m_play_back_info.m_data_size        = file_size;
+  }
+
+  // reads are always made with their position, so there's no need to seek to the data
+  return m_play_back_info.m_channels == 1 && m_play_back_info.m_bits_per_sample == 16;
+}
+
+bool SD_AUDIO_RECORDER::read_play_back_sd( uint32_t position, void* buffer, uint32_t size )
+{
+  // synchronous read, call finish_sd_io() first
+  if( m_play_back_stream.is_open() )
+  {
+    return m_play_back_stream.read( position, buffer, size );
+  }
+
+  return m_play_back_audio_file.seek( position ) && m_play_back_audio_file.read( buffer, size ) == size;
+}
+
+bool SD_AUDIO_RECORDER::update_playing_sd()
+{
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::SD_PLAY_READS );
+
+  collect_sd_io();
+
+  bool finished = false;
+
+  // reversed, each block is read back from the current position and its samples are reversed as it's collected, so the
+  // interrupt plays it forwards and nothing else needs to know
+  const bool more_to_read = m_play_reversed ? m_play_back_file_offset > 0 : m_play_back_file_offset < m_play_back_readable_size;
+  if( more_to_read )
+  {    
+    if( m_num_play_reads < MAX_PLAY_READS_IN_FLIGHT && m_sd_play_queue.remaining() > m_num_play_reads &&
+        (m_mode != MODE::PLAY || queued_play_blocks() <= MAX_PREFERRED_RECORD_BLOCKS_WHEN_PLAYING) )
+    {
+      // the end of the loop carried over the wrap is completed by the start, otherwise allocate the audio block to transmit
+      audio_block_t* block    = m_partial_play_block;
+      const int block_offset  = m_partial_play_samples;
+      if( block == nullptr )
+      {
+        block = allocate();
+        if( block == nullptr )
+        {
+          DEBUG_TEXT_LINE( "update_playing_sd() - Failed to allocate" );
+          return false;
+        }
+        AUDIO_BLOCK_TRANSFER( block, NONE, SD_READ );
+      }
+    
+      // we can read more data from the file, the block is queued once the read completes
+      const uint32_t bytes_to_read  = min_val<uint32_t>( ( AUDIO_BLOCK_SAMPLES - block_offset ) * 2, m_play_reversed ? m_play_back_file_offset : m_play_back_readable_size - m_play_back_file_offset );
+      const uint32_t read_start     = m_play_reversed ? m_play_back_file_offset - bytes_to_read : m_play_back_file_offset;
+      const uint32_t position       = m_play_back_info.m_data_offset + read_start;
+      const int request             = m_play_back_stream.is_open() ? m_sd_io.submit_read( m_play_back_stream, position, block->data + block_offset, bytes_to_read ) :
+                                                                     m_sd_io.submit_read( m_play_back_audio_file, position, block->data + block_offset, bytes_to_read );
+      if( request == SD_ASYNC_IO::INVALID_REQUEST )
+      {
+        if( block != m_partial_play_block )
+        {
+          release_block_func( block );
+        }
+        return false;
+      }
+
+      m_play_back_file_offset = m_play_reversed ? read_start : read_start + bytes_to_read;
+      m_partial_play_block    = nullptr;
+      m_partial_play_samples  = 0;
+
+      PLAY_READ& play_read      = m_play_reads[ ( m_play_read_head + m_num_play_reads ) % MAX_PLAY_READS_IN_FLIGHT ];
+      play_read.m_block         = block;
+      play_read.m_request       = request;
+      play_read.m_block_offset  = block_offset;
+      play_read.m_size          = bytes_to_read;
+      play_read.m_reversed      = m_play_reversed;
+      ++m_num_play_reads;
+    }
+  }
+  else if( m_streaming_recording && m_play_back_file_offset < m_play_back_file_size )
+  {
+    // the rest of the recording is still being written
+    extend_play_back_recording_sd();
+  }
+  else if( m_num_play_reads == 0 )
+  {
+    DEBUG_TEXT( m_play_reversed ? "File Start " : "File End " );
+    DEBUG_TEXT_LINE(m_play_back_filename);
+
+    disable_SPI_audio();
+            
+    finished = true;
+  }
+
+  return finished;
+}
+
+int SD_AUDIO_RECORDER::queue_partial_play_block_sd()
+{
+  // the loop end is heard on its own, the rest of its block is padded
+  if( m_partial_play_block == nullptr )
+  {
+    return AUDIO_BLOCK_SAMPLES;
+  }
+
+  const int block_samples = m_partial_play_samples;
+  for( int i = block_samples; i < AUDIO_BLOCK_SAMPLES; i++ )
+  {
+    m_partial_play_block->data[i] = 0;
+  }
+
+  AUDIO_BLOCK_TRANSFER( m_partial_play_block, SD_READ, PLAY_QUEUE );
+  m_sd_play_queue.add_block( m_partial_play_block );
+
+  m_partial_play_block    = nullptr;
+  m_partial_play_samples  = 0;
+
+  return block_samples;
+}
+
+void SD_AUDIO_RECORDER::release_partial_play_block_sd()
+{
+  if( m_partial_play_block != nullptr )
+  {
+    release_block_func( m_partial_play_block );
+    m_partial_play_block    = nullptr;
+    m_partial_play_samples  = 0;
+  }
+}
+
+void SD_AUDIO_RECORDER::change_play_direction_sd()
+{
+  // the read-ahead is ahead of what's being heard (in the current direction) by the queued blocks, so discard them and
+  // restart the stream from what's being heard, in the new direction
+  finish_sd_io();
+
+  AudioNoInterrupts();
+
+  const uint32_t queued_bytes = m_sd_play_queue.size() * AUDIO_BLOCK_SAMPLES * 2;
+  if( m_play_reversed )
+  {
+    m_play_back_file_offset = min_val<uint32_t>( m_play_back_file_offset + queued_bytes, m_play_back_file_size );
+  }
+  else
+  {
+    m_play_back_file_offset = m_play_back_file_offset > queued_bytes ? m_play_back_file_offset - queued_bytes : 0;
+  }
+  m_play_back_file_offset &= ~1u;
+
+  m_sd_play_queue.clear();
+  release_partial_play_block_sd();
+  m_play_reversed             = m_reverse;
+  m_direction_change_pending  = true;
+
+  // cues only apply when playing forwards
+  m_pending_cue               = -1;
+  m_cue                       = -1;
+  m_fade_out_source           = nullptr;
+  m_blocks_until_reposition   = -1;
+
+  // anything an underrun played over was in the old direction
+  m_underrun_skip_samples     = 0.0f;
+
+  AudioInterrupts();
+
+  // the reads complete over the next few main loop updates, until the first arrives the interrupt outputs silence
+  update_playing_sd();
+}
+
+void SD_AUDIO_RECORDER::reset_cue_cache()
+{
+  m_cue_cache_loaded    = 0;
+  m_cue_cache_filename  = m_play_back_filename;
+
+  const bool use_loop_chunk = m_play_back_info.m_has_loop_chunk && m_play_back_info.m_loop.m_num_segments == NUM_SEGMENTS;
+  for( int c = 0; c < NUM_SEGMENTS; ++c )
+  {
+    uint32_t frame = 0;
+    if( use_loop_chunk )
+    {
+      frame = m_play_back_info.m_loop.m_segment_points[c];
+    }
+    else
+    {
+      frame = static_cast<uint32_t>( ( static_cast<uint64_t>( loop_frames() ) * c ) / NUM_SEGMENTS );
+    }
+
+    m_cue_positions[c] = frame * 2;
+  }
+}
+
+void SD_AUDIO_RECORDER::update_cue_cache_sd()
+{
+  // load one cue per update, only once the play queue is healthy
+  constexpr const uint32_t all_loaded = ( 1 << NUM_SEGMENTS ) - 1;
+  if( m_cue_cache_loaded == all_loaded || m_play_reversed || m_jump_pending ||
+      m_sd_play_queue.size() < MAX_PREFERRED_RECORD_BLOCKS_WHEN_PLAYING )
+  {
+    return;
+  }
+
+  int cue = 0;
+  while( m_cue_cache_loaded & ( 1 << cue ) )
+  {
+    ++cue;
+  }
+
+  const uint32_t cue_bytes  = CUE_CACHE_SAMPLES * 2;
+  int16_t* cache            = m_cue_cache[cue];
+  uint32_t n                = 0;
+
+  if( m_cue_positions[cue] + cue_bytes <= m_play_back_file_size )
+  {
+    finish_sd_io();
+
+    // the stream's reads carry their own position, so there's no need to seek back afterwards
+    ADD_TIMED_SECTION( "Cue read time", 2500 );
+    if( read_play_back_sd( m_play_back_info.m_data_offset + m_cue_positions[cue], cache, cue_bytes ) )
+    {
+      n = cue_bytes;
+    }
+  }
+
+  if( n == cue_bytes )
+  {
+    m_cue_cache_loaded |= 1 << cue;
+  }
+  else
+  {
+    // segment too short to cache, don't try again
+    m_cue_positions[cue] = m_play_back_file_size;
+    m_cue_cache_loaded |= 1 << cue;
+  }
+}
+
+bool SD_AUDIO_RECORDER::jump_to_cue_sd( int cue, bool at_loop_wrap )
+{
+  if( cue < 0 || m_play_reversed || ( m_cue_cache_loaded & ( 1 << cue ) ) == 0 )
+  {
+    return false;
+  }
+
+  // stream continues from the end of the cached section
+  const uint32_t stream_position = m_cue_positions[cue] + CUE_CACHE_SAMPLES * 2;
+  if( stream_position > m_play_back_file_size )
+  {
+    return false;
+  }
+
+  if( !at_loop_wrap )
+  {
+    // reads in flight are from before the cut
+    finish_sd_io();
+  }
+
+  // at the loop wrap, the crossfade starts on the loop's last sample
+  const int last_block_samples = at_loop_wrap ? queue_partial_play_block_sd() : AUDIO_BLOCK_SAMPLES;
+
+  AudioNoInterrupts();
+
+  if( at_loop_wrap )
+  {
+    schedule_reposition( m_cue_positions[cue] / 2, queued_play_blocks(), MODE::NONE, last_block_samples );
+  }
+  else
+  {
+    // cut immediately, the cache covers the time to refill the queue
+    m_sd_play_queue.clear();
+    release_partial_play_block_sd();
+    m_blocks_until_reposition = -1;
+  }
+
+  m_pending_cue             = cue;
+
+  AudioInterrupts();
+
+  m_play_back_file_offset   = stream_position;
+
+  return true;
+}
+
+void SD_AUDIO_RECORDER::start_cue_interrupt( int cue )
+{
+  // crossfade from whatever is currently playing - continue reading it, mirrored if we run off the end
+  if( m_crossfade_length > 0 && m_cue >= 0 )
+  {
+    m_fade_out_source = m_cue_cache[m_cue];
+    m_fade_out_size   = CUE_CACHE_SAMPLES;
+    m_fade_out_head   = m_cue_read_head;
+  }
+  else if( m_crossfade_length > 0 && m_current_play_block != nullptr )
+  {
+    m_fade_out_source = m_current_play_block->data;
+    m_fade_out_size   = current_play_block_end_interrupt();
+    m_fade_out_head   = m_read_head;
+  }
+  else
+  {
+    m_fade_out_source = nullptr;
+  }
+
+  m_fade_position       = 0;
+  m_cue                 = cue;
+  m_cue_read_head       = 0.0f;
+  m_pending_cue         = -1;
+  m_transport_position  = m_cue_positions[cue] / 2;
+
+  // the cut replaces any underrun concealment
+  finish_underrun_interrupt();
+  m_underrun_state        = UNDERRUN_STATE::NONE;
+  m_underrun_skip_samples = 0.0f;
+}
+
+void SD_AUDIO_RECORDER::conceal_underrun_interrupt( int16_t* samples, int from, int to )
+{
+  if( m_underrun_state != UNDERRUN_STATE::CONCEALING )
+  {
+    // an underrun whilst recovering from the last continues its concealment, so the output stays continuous
+    if( m_underrun_state == UNDERRUN_STATE::NONE )
+    {
+      m_concealed_samples = 0;
+    }
+    m_underrun_state          = UNDERRUN_STATE::CONCEALING;
+    m_underrun_event_samples  = 0;
+  }
+
+  for( int i = from; i < to; ++i )
+  {
+    samples[i] = next_concealed_sample_interrupt();
+  }
+
+  // the caller decides what happens to the stream samples this plays over
+  m_underrun_event_samples  += to - from;
+}
+
+void SD_AUDIO_RECORDER::record_late_blocks_interrupt()
+{
+  // blocks which arrive after their slot was concealed are recorded (but not played), so nothing concealed is recorded
+  while( m_late_record_blocks > 0 )
+  {
+    audio_block_t* late_block = next_play_block_interrupt();
+    if( late_block == nullptr )
+    {
+      return;
+    }
+
+    if( !is_recording() )
+    {
+      // reached the loop end, this block starts the loop now playing - the rest of the concealed slots are skipped as
+      // they would be in PLAY, and the transport counts the slots already heard
+      release_block_func( late_block );
+      m_underrun_skip_samples = ( m_late_record_blocks - 1 ) * AUDIO_BLOCK_SAMPLES;
+      m_transport_position    = m_transport_position + ( m_late_record_blocks * AUDIO_BLOCK_SAMPLES );
+      m_late_record_blocks    = 0;
+      wrap_transport_interrupt();
+      return;
+    }
+
+    queue_record_block_interrupt( late_block );
+    --m_late_record_blocks;
+  }
+}
+
+int16_t SD_AUDIO_RECORDER::next_concealed_sample_interrupt()
+{
+  if( m_concealed_samples >= UNDERRUN_FADE_SAMPLES )
+  {
+    return 0;
+  }
+
+  // repeat the recent output, each repeat starting with a crossfade from the end of the history (mirrored, so the splice
+  // is continuous), fading out so a longer underrun doesn't buzz
+  const int position  = m_concealed_samples % UNDERRUN_HISTORY_SAMPLES;
+  int16_t sample      = m_underrun_history[position];
+  if( position < UNDERRUN_SPLICE_SAMPLES )
+  {
+    const float t = static_cast<float>( position + 1 ) / ( UNDERRUN_SPLICE_SAMPLES + 1 );
+    sample        = DSP_UTILS::crossfade_equal_power( m_underrun_history[UNDERRUN_HISTORY_SAMPLES - 1 - position], sample, t );
+  }
+
+  const float gain = 1.0f - ( static_cast<float>(m_concealed_samples) / UNDERRUN_FADE_SAMPLES );
+  ++m_concealed_samples;
+
+  return round_to_int( sample * gain );
+}
+
+void SD_AUDIO_RECORDER::recover_from_underrun_interrupt( int16_t* samples, int from, int to )
+{
+  if( m_underrun_state == UNDERRUN_STATE::NONE )
+  {
+    return;
+  }
+
+  if( m_underrun_state == UNDERRUN_STATE::CONCEALING )
+  {
+    // the stream has caught up
+    finish_underrun_interrupt();
+    m_underrun_state              = UNDERRUN_STATE::RECOVERING;
+    m_underrun_recovery_position  = 0;
+  }
+
+  for( int i = from; i < to && m_underrun_recovery_position < UNDERRUN_RECOVERY_SAMPLES; ++i )
+  {
+    const float t = static_cast<float>(++m_underrun_recovery_position) / ( UNDERRUN_RECOVERY_SAMPLES + 1 );
+    samples[i]    = DSP_UTILS::crossfade_equal_power( next_concealed_sample_interrupt(), samples[i], t );
+  }
+
+  if( m_underrun_recovery_position >= UNDERRUN_RECOVERY_SAMPLES )
+  {
+    m_underrun_state = UNDERRUN_STATE::NONE;
+  }
+}
+
+void SD_AUDIO_RECORDER::finish_underrun_interrupt()
+{
+  if( m_underrun_state == UNDERRUN_STATE::CONCEALING )
+  {
+    m_last_underrun_samples = m_underrun_event_samples;
+    m_num_underruns         = m_num_underruns + 1;
+  }
+}
+
+void SD_AUDIO_RECORDER::update_underrun_history_interrupt( const int16_t* samples )
+{
+  constexpr int kept_samples = UNDERRUN_HISTORY_SAMPLES - AUDIO_BLOCK_SAMPLES;
+  memmove( m_underrun_history, m_underrun_history + AUDIO_BLOCK_SAMPLES, kept_samples * sizeof(int16_t) );
+  memcpy( m_underrun_history + kept_samples, samples, AUDIO_BLOCK_SAMPLES * sizeof(int16_t) );
+}
+
+void SD_AUDIO_RECORDER::reset_underrun_concealment()
+{
+  m_underrun_state              = UNDERRUN_STATE::NONE;
+  m_underrun_skip_samples       = 0.0f;
+  m_late_record_blocks          = 0;
+  m_resampled_block_concealed   = false;
+  m_concealed_samples           = 0;
+  memset( m_underrun_history, 0, sizeof(m_underrun_history) );
+}
+
+void SD_AUDIO_RECORDER::log_underruns()
+{
+  const uint32_t num_underruns = m_num_underruns;
+  if( num_underruns == m_num_underruns_logged )
+  {
+    return;
+  }
+
+  DEBUG_TEXT( "Play queue underrun concealed, " );
+  DEBUG_TEXT( m_last_underrun_samples );
+  DEBUG_TEXT( " samples (" );
+  DEBUG_TEXT( m_last_underrun_samples * 1000.0f / AUDIO_SAMPLE_RATE_EXACT );
+  DEBUG_TEXT( "ms), total underruns:" );
+  DEBUG_TEXT_LINE( num_underruns );
+
+  m_num_underruns_logged = num_underruns;
+}
+
+int16_t SD_AUDIO_RECORDER::read_cue_sample_interrupt()
+{
+  const int16_t sample_in = DSP_UTILS::read_sample_cubic( m_cue_read_head, m_cue_cache[m_cue], CUE_CACHE_SAMPLES );
+  m_cue_read_head += m_speed;
+
+  if( m_fade_out_source == nullptr )
+  {
+    return sample_in;
+  }
+
+  int fade_out_index = trunc_to_int( m_fade_out_head );
+  if( fade_out_index >= m_fade_out_size )
+  {
+    // mirror the outgoing audio rather than stopping abruptly
+    fade_out_index = max_val( ( 2 * m_fade_out_size ) - 1 - fade_out_index, 0 );
+  }
+  const int16_t sample_out = m_fade_out_source[fade_out_index];
+  m_fade_out_head += m_speed;
+
+  const float t = static_cast<float>(++m_fade_position) / ( m_crossfade_length + 1 );
+  if( m_fade_position >= m_crossfade_length )
+  {
+    m_fade_out_source = nullptr;
+  }
+
+  return DSP_UTILS::crossfade_equal_power( sample_out, sample_in, t );
+}
+
+void SD_AUDIO_RECORDER::schedule_reposition( uint32_t frame, int blocks_before_reposition, MODE mode, int last_block_samples )
+{
+  // called with audio interrupts disabled
+  m_reposition_frame          = frame;
+  m_reposition_mode           = mode;
+  m_reposition_block_samples  = last_block_samples;
+  m_blocks_until_reposition   = blocks_before_reposition;
+
+  if( blocks_before_reposition < 0 )
+  {
+    m_transport_position    = frame;
+  }
+}
+
+void SD_AUDIO_RECORDER::wrap_play_back_sd()
+{
+  // continue streaming the current file from the start (or end, when reversed), after the blocks already queued
+  enable_SPI_audio();
+
+  m_play_back_file_offset = m_play_reversed ? m_play_back_file_size & ~1u : 0;
+}
+
+uint32_t SD_AUDIO_RECORDER::loop_frames() const
+{
+  return m_play_back_file_size / 2;
+}
+
+void SD_AUDIO_RECORDER::wrap_transport_interrupt()
+{
+  // the transport counts round the loop, so it stays on the loop's exact frame however the wrap falls in the blocks
+  const float loop_length = loop_frames();
+  if( m_mode == MODE::RECORD_INITIAL || loop_length <= 0.0f )
+  {
+    return;
+  }
+
+  float position = m_transport_position;
+  while( position >= loop_length )
+  {
+    position -= loop_length;
+  }
+  while( position < 0.0f )
+  {
+    position += loop_length;
+  }
+  m_transport_position = position;
+}
+
+audio_block_t* SD_AUDIO_RECORDER::next_play_block_interrupt()
+{
+  ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::RECORDER_QUEUES );
+
+  while( true )
+  {
+    if( m_blocks_until_reposition == 0 && m_pending_cue >= 0 )
+    {
+      // loop wrap into the cue cache, reached after an underrun - the queue continues from the end of the cache
+      reposition_interrupt();
+      return nullptr;
+    }
+
+    if( m_sd_play_queue.empty() )
+    {
+      // underrun, concealed by the caller
+      return nullptr;
+    }
+
+    if( m_blocks_until_reposition == 0 )
+    {
+      // this block is the first after the reposition
+      reposition_interrupt();
+    }
+    else if( m_blocks_until_reposition > 0 )
+    {
+      m_blocks_until_reposition = m_blocks_until_reposition - 1;
+    }
+
+    audio_block_t* play_block = m_sd_play_queue.read_block();
+    ASSERT_MSG( play_block != nullptr, "update_playing_interrupt() get_next_play_block() null block" );
+    m_sd_play_queue.release_buffer(false);
+    AUDIO_BLOCK_TRANSFER( play_block, PLAY_QUEUE, CURRENT_PLAY );
+    m_direction_change_pending = false;
+
+    if( m_underrun_skip_samples < AUDIO_BLOCK_SAMPLES )
+    {
+      // back in step with the transport
+      m_read_head             = m_read_head + m_underrun_skip_samples;
+      m_underrun_skip_samples = 0.0f;
+      return play_block;
+    }
+
+    // already played over by the underrun concealment
+    m_underrun_skip_samples = m_underrun_skip_samples - AUDIO_BLOCK_SAMPLES;
+    release_block_func( play_block );
+  }
+}
+
+int SD_AUDIO_RECORDER::current_play_block_end_interrupt() const
+{
+  // the block before a reposition may end part way through, on the last sample of the loop
+  return m_blocks_until_reposition == 0 ? m_reposition_block_samples : AUDIO_BLOCK_SAMPLES;
+}
+
+void SD_AUDIO_RECORDER::reposition_interrupt()
+{
+  // the transport and the stream are in step again after the jump, so anything an underrun played over is forgotten
+  m_transport_position      = m_reposition_frame;
+  m_underrun_skip_samples   = 0.0f;
+
+  if( m_reposition_mode != MODE::NONE )
+  {
+    m_mode            = m_reposition_mode;
+    m_pending_mode    = MODE::NONE;
+    m_reposition_mode = MODE::NONE;
+  }
+
+  if( m_pending_cue >= 0 )
+  {
+    start_cue_interrupt( m_pending_cue );
+  }
+
+  // cleared last, the cue fades out of the block before the reposition
+  m_blocks_until_reposition = -1;
+}
+
+int SD_AUDIO_RECORDER::next_sequence_event_write_head( float clock, int clock_head ) const
+{
+  const uint32_t loop_length = loop_frames();
+  if( m_sequence_mode == SEQUENCE_MODE::NONE || loop_length == 0 )
+  {
+    return AUDIO_BLOCK_SAMPLES;
+  }
+
+  // the next event, or the clock wrapping at the end of the loop
+  float target = loop_length;
+  const SEQUENCE& sequence = m_sequences[m_sequence_pattern];
+  if( m_sequence_mode == SEQUENCE_MODE::PLAY && !sequence.at_end( m_sequence_cursor ) )
+  {
+    target = sequence.peek_event( m_sequence_cursor ).m_position;
+  }
+
+  const int write_head = clock_head + static_cast<int>( ceilf( ( target - clock ) / m_speed ) );
+  return clamp( write_head, clock_head, static_cast<int>(AUDIO_BLOCK_SAMPLES) );
+}
+
+void SD_AUDIO_RECORDER::dispatch_sequence_event_interrupt( float& clock, int& clock_head, int write_head )
+{
+  clock       = clock + ( ( write_head - clock_head ) * m_speed );
+  clock_head  = write_head;
+
+  const SEQUENCE& sequence = m_sequences[m_sequence_pattern];
+  if( m_sequence_mode != SEQUENCE_MODE::PLAY || sequence.at_end( m_sequence_cursor ) )
+  {
+    // end of the loop
+    clock             = clock - loop_frames();
+    m_sequence_cursor = SEQUENCE::CURSOR();
+    if( m_sequence_mode == SEQUENCE_MODE::RECORD )
+    {
+      m_sequence_record_wraps = m_sequence_record_wraps + 1;
+    }
+    return;
+  }
+
+  const int cue = sequence.next_event( m_sequence_cursor ).m_cue;
+
+  // only cached segments can be cut to without the SD card, and a pending mode change owns the next reposition
+  if( cue < 0 || cue >= NUM_SEGMENTS || m_play_reversed || ( m_cue_cache_loaded & ( 1 << cue ) ) == 0 || m_reposition_mode != MODE::NONE )
+  {
+    m_num_missed_sequence_events = m_num_missed_sequence_events + 1;
+    return;
+  }
+
+  // the queued blocks (and any loop wrap scheduled against them) are from before the cut, update_main_loop() moves the stream
+  start_cue_interrupt( cue );
+  m_blocks_until_reposition = -1;
+  m_sequence_cut_cue        = cue;
+}
+
+void SD_AUDIO_RECORDER::add_sequence_return_event()
+{
+  // the pattern ends by cutting back to the segment heard as recording started, so from the end of the recording round
+  // to its start plays what was heard - called with audio interrupts disabled
+  SEQUENCE& sequence          = m_sequences[m_sequence_pattern];
+  const uint32_t loop_length  = loop_frames();
+  if( sequence.empty() || loop_length == 0 )
+  {
+    return;
+  }
+
+  const uint32_t start_clock  = m_sequence_record_start_clock;
+  const uint32_t stop_clock   = min_val<uint32_t>( static_cast<uint32_t>(m_sequence_clock), loop_length - 1 );
+  if( m_sequence_record_wraps > 1 || ( m_sequence_record_wraps == 1 && stop_clock >= start_clock ) )
+  {
+    // every position in the loop was recorded
+    return;
+  }
+
+  int cue = 0;
+  for( int c = 1; c < NUM_SEGMENTS; ++c )
+  {
+    if( m_cue_positions[c] / 2 <= m_sequence_record_start_transport )
+    {
+      cue = c;
+    }
+  }
+
+  // cut early enough to be at the same point in the segment as recording started, if that's within the unrecorded
+  // part of the loop, otherwise where recording stopped
+  const uint32_t cue_offset   = static_cast<uint32_t>( max_val( m_sequence_record_start_transport - ( m_cue_positions[cue] / 2 ), 0.0f ) );
+  const uint32_t gap          = ( start_clock + loop_length - stop_clock ) % loop_length;
+  const uint32_t position     = cue_offset < gap ? ( start_clock + loop_length - cue_offset ) % loop_length : stop_clock;
+
+  if( !sequence.add_event( position, cue ) )
+  {
+    m_num_missed_sequence_events = m_num_missed_sequence_events + 1;
+  }
+}
+
+void SD_AUDIO_RECORDER::update_playing_interrupt()
+{  
+  ADD_PROFILED_SECTION( AUDIO_PROFILER::playing_section( m_speed ) );
+
+  // after a cut the queue may be empty whilst the cue cache plays, otherwise an empty queue is an underrun unless the
+  // file has finished
+  const bool cue_playing = !is_recording() && ( m_cue >= 0 || ( m_pending_cue >= 0 && m_blocks_until_reposition < 0 ) );
+  if( m_sd_play_queue.size() > 0 || cue_playing || !m_finished_playback )
+  {
+    // when recording - speed is always 1 and need to set just_played_block for overdub
+    if( is_recording() )
+    {
+      audio_block_t* block = nullptr;
+      if( m_current_play_block != nullptr )
+      {
+        // first block of the loop, fetched as PLAY switched to recording - played whole, crossfading from the bridge
+        block                 = m_current_play_block;
+        m_current_play_block  = nullptr;
+        m_transport_position  = 0.0f;
+      }
+      else
+      {
+        record_late_blocks_interrupt();
+
+        if( m_late_record_blocks == 0 )
+        {
+          block = next_play_block_interrupt();
+        }
+      }
+
+      if( block == nullptr )
+      {
+        // conceal the underrun so the loop keeps time, the block is recorded when it arrives (or skipped if the loop end
+        // has just switched to PLAY)
+        audio_block_t* concealed_block = allocate();
+        if( concealed_block == nullptr )
+        {
+          DEBUG_TEXT_LINE( "Unable to allocate underrun block" );
+          return;
+        }
+        AUDIO_BLOCK_TRANSFER( concealed_block, NONE, TRANSMIT );
+        conceal_underrun_interrupt( concealed_block->data, 0, AUDIO_BLOCK_SAMPLES );
+        if( is_recording() )
+        {
+          ++m_late_record_blocks;
+        }
+        else
+        {
+          m_underrun_skip_samples = m_underrun_skip_samples + AUDIO_BLOCK_SAMPLES;
+        }
+
+        update_underrun_history_interrupt( concealed_block->data );
+        transmit( concealed_block );
+        release_block_func( concealed_block );
+      }
+      else
+      {
+        // the stream block is recorded as it is, only what's heard crossfades out of the concealment
+        audio_block_t* heard_block = block;
+        if( m_underrun_state != UNDERRUN_STATE::NONE )
+        {
+          audio_block_t* recovery_block = allocate();
+          if( recovery_block != nullptr )
+          {
+            AUDIO_BLOCK_TRANSFER( recovery_block, NONE, TRANSMIT );
+            memcpy( recovery_block->data, block->data, sizeof(recovery_block->data) );
+            heard_block = recovery_block;
+          }
+          recover_from_underrun_interrupt( heard_block->data, 0, AUDIO_BLOCK_SAMPLES );
+        }
+        update_underrun_history_interrupt( heard_block->data );
+
+        transmit( heard_block );
+
+        if( heard_block != block )
+        {
+          release_block_func( heard_block );
+        }
 
-      ASSERT_MSG( m_just_played_block == nullptr, "Leaking just_played_block" );
-      m_just_played_block = block;
+        ASSERT_MSG( m_just_played_block == nullptr, "Leaking just_played_block" );
+        AUDIO_BLOCK_TRANSFER( block, CURRENT_PLAY, JUST_PLAYED );
+        m_just_played_block = block;
+      }
+
+      m_transport_position = m_transport_position + AUDIO_BLOCK_SAMPLES;
+      wrap_transport_interrupt();
     }
     // when playing - apply speed to audio playback
     else
@@ -507,196 +2143,596 @@ void SD_AUDIO_RECORDER::update_playing_interrupt()
         DEBUG_TEXT_LINE( "Unable to allocate block_to_transmit" );
         return;
       }
+      AUDIO_BLOCK_TRANSFER( block_to_transmit, NONE, TRANSMIT );
 
-      auto get_next_play_block = [this]()
-      {       
-        audio_block_t* play_block = m_sd_play_queue.read_block();
-        ASSERT_MSG( play_block != nullptr, "update_playing_interrupt() get_next_play_block() null block" );
-        m_sd_play_queue.release_buffer(false);
+      auto read_from_block_with_speed = []( const audio_block_t* source, int source_size, audio_block_t* target, float speed, float& read_head, int& write_head, int write_limit )
+      {
+        DSP_UTILS::read_with_speed( source->data, source_size, target->data, speed, read_head, write_head, write_limit );
+      };
 
-        return play_block;
+      // the transport advances by the source samples consumed, and is synced before anything which may reposition it
+      const float transport_step  = m_play_reversed ? -m_speed : m_speed;
+      int write_head              = 0;
+      int transport_write_head    = 0;
+      auto sync_transport = [this, transport_step, &write_head, &transport_write_head]()
+      {
+        m_transport_position  = m_transport_position + ( write_head - transport_write_head ) * transport_step;
+        transport_write_head  = write_head;
+        wrap_transport_interrupt();
       };
 
-      auto read_from_block_with_speed = []( const audio_block_t* source, audio_block_t* target, float speed, float& read_head, int& write_head )
+      if( m_pending_cue >= 0 && m_blocks_until_reposition < 0 )
       {
-        while( static_cast<int>(read_head) < AUDIO_BLOCK_SAMPLES && write_head < AUDIO_BLOCK_SAMPLES )
+        // cut
+        if( m_sequence_mode == SEQUENCE_MODE::RECORD )
         {
-          //target->data[write_head] = source->data[static_cast<int>(read_head)]; // no interpolation
-          target->data[write_head] = DSP_UTILS::read_sample_cubic( read_head, source->data, AUDIO_BLOCK_SAMPLES );
-          ++write_head;
-          read_head += speed;
+          if( !m_sequences[m_sequence_pattern].add_event( static_cast<uint32_t>(m_sequence_clock), m_pending_cue ) )
+          {
+            m_num_missed_sequence_events = m_num_missed_sequence_events + 1;
+          }
         }
-      };
+        start_cue_interrupt( m_pending_cue );
+      }
+
+      // sequence events (and the sequence clock wrapping) are dispatched at the exact sample they fall on
+      float sequence_clock        = m_sequence_clock;
+      int sequence_clock_head     = 0;
+      int sequence_write_head     = next_sequence_event_write_head( sequence_clock, sequence_clock_head );
       
-      if( m_current_play_block == nullptr || static_cast<int>(m_read_head) >= AUDIO_BLOCK_SAMPLES )
+      if( m_cue < 0 && ( m_current_play_block == nullptr || static_cast<int>(m_read_head) >= current_play_block_end_interrupt() ) )
       {
         m_read_head           = 0.0f;
-        m_current_play_block  = get_next_play_block();
+        m_current_play_block  = next_play_block_interrupt();
       }
 
-      int write_head = 0;
       while( write_head < AUDIO_BLOCK_SAMPLES )
       {
+        if( is_recording() )
+        {
+          // the block just fetched starts the loop being recorded, so none of it is heard until the next update plays
+          // it whole - the rest of this block bridges to it, without counting as an underrun
+          conceal_underrun_interrupt( block_to_transmit->data, write_head, AUDIO_BLOCK_SAMPLES );
+          m_underrun_state              = UNDERRUN_STATE::RECOVERING;
+          m_underrun_recovery_position  = 0;
+          write_head                    = AUDIO_BLOCK_SAMPLES;
+          transport_write_head          = write_head;
+          break;
+        }
+
+        if( write_head >= sequence_write_head )
+        {
+          sync_transport();
+          dispatch_sequence_event_interrupt( sequence_clock, sequence_clock_head, write_head );
+          sequence_write_head = next_sequence_event_write_head( sequence_clock, sequence_clock_head );
+          continue;
+        }
+
+        if( m_cue >= 0 )
+        {
+          if( static_cast<int>(m_cue_read_head) < CUE_CACHE_SAMPLES )
+          {
+            // playing from the cue cache
+            block_to_transmit->data[write_head++] = read_cue_sample_interrupt();
+          }
+          else if( m_sequence_cut_cue >= 0 )
+          {
+            // the stream hasn't been moved to the sequence cut yet, the queue still holds what was playing before it -
+            // conceal, and the moved stream skips what would have played meanwhile
+            conceal_underrun_interrupt( block_to_transmit->data, write_head, sequence_write_head );
+            m_underrun_skip_samples = m_underrun_skip_samples + ( ( sequence_write_head - write_head ) * m_speed );
+            write_head              = sequence_write_head;
+          }
+
+          if( static_cast<int>(m_cue_read_head) >= CUE_CACHE_SAMPLES && m_sequence_cut_cue < 0 )
+          {
+            // end of the cached section - the queue continues from here
+            if( m_current_play_block != nullptr )
+            {
+              release_block_func( m_current_play_block );
+            }
+            sync_transport();
+            m_read_head           = m_cue_read_head - CUE_CACHE_SAMPLES;
+            m_current_play_block  = next_play_block_interrupt();
+            m_cue                 = -1;
+            m_fade_out_source     = nullptr;
+          }
+          continue;
+        }
+
+        if( m_current_play_block == nullptr )
+        {
+          if( m_finished_playback )
+          {
+            // end of a file which isn't looping
+            while( write_head < sequence_write_head )
+            {
+              block_to_transmit->data[write_head++] = 0;
+            }
+          }
+          else if( m_direction_change_pending )
+          {
+            // the stream restarts from what was heard, so it hasn't fallen behind - silence until the first block in the
+            // new direction arrives, and the transport waits for it
+            while( write_head < sequence_write_head )
+            {
+              block_to_transmit->data[write_head++] = 0;
+            }
+            transport_write_head = write_head;
+          }
+          else
+          {
+            // the queue hasn't kept up (or caught up with the cue cache), the stream falls behind the transport by what
+            // would have been played
+            conceal_underrun_interrupt( block_to_transmit->data, write_head, sequence_write_head );
+            m_underrun_skip_samples = m_underrun_skip_samples + ( ( sequence_write_head - write_head ) * m_speed );
+            write_head              = sequence_write_head;
+          }
+          continue;
+        }
+
         // read from current play block
-        read_from_block_with_speed( m_current_play_block, block_to_transmit, m_speed, m_read_head, write_head );
-        if( static_cast<int>(m_read_head) >= AUDIO_BLOCK_SAMPLES )
+        const int read_start_head = write_head;
+        const int block_end       = current_play_block_end_interrupt();
+        read_from_block_with_speed( m_current_play_block, block_end, block_to_transmit, m_speed, m_read_head, write_head, sequence_write_head );
+        recover_from_underrun_interrupt( block_to_transmit->data, read_start_head, write_head );
+        if( static_cast<int>(m_read_head) >= block_end )
         {
+          sync_transport();
+
+          if( m_blocks_until_reposition == 0 && m_pending_cue >= 0 )
+          {
+            // loop wrap - the current block is kept as the source of the outgoing crossfade
+            reposition_interrupt();
+            continue;
+          }
+
           // end of block reached - fetch another block from the queue
-          release( m_current_play_block );
+          release_block_func( m_current_play_block );
           m_read_head           = 0.0f;
-          m_current_play_block  = get_next_play_block();
+          m_current_play_block  = next_play_block_interrupt();
         }
       }
 
+      sync_transport();
+
+      if( m_sequence_mode == SEQUENCE_MODE::NONE )
+      {
+        // free running, so a recording starts in phase with the loop
+        m_sequence_clock = m_transport_position;
+      }
+      else
+      {
+        m_sequence_clock = sequence_clock + ( ( AUDIO_BLOCK_SAMPLES - sequence_clock_head ) * m_speed );
+      }
+
+      update_underrun_history_interrupt( block_to_transmit->data );
+
       transmit( block_to_transmit );
 
-      release( block_to_transmit );
+      release_block_func( block_to_transmit );
     }
   }
-  else
-  {
-    ASSERT_MSG( m_finished_playback, "PLAY QUEUE EMPTY!!" );
-  }
 }
 
 void SD_AUDIO_RECORDER::stop_playing_sd()
 {
   DEBUG_TEXT_LINE("SD_AUDIO_RECORDER::stop_playing_sd");
 
-  __disable_irq();
-  if( m_mode == MODE::PLAY || m_mode == MODE::RECORD_PLAY || m_mode == MODE::RECORD_OVERDUB )
+  finish_sd_io();
+
+  if( m_play_back_stream.is_open() || m_play_back_audio_file )
   {    
+    m_play_back_stream.close();
     m_play_back_audio_file.close();
     
     disable_SPI_audio();
   }
-  __enable_irq();
 
   if( m_current_play_block != nullptr )
   {
-    release( m_current_play_block );
+    release_block_func( m_current_play_block );
     m_current_play_block = nullptr;
   }
 
+  release_partial_play_block_sd();
+  m_streaming_recording = false;
+
+  reset_underrun_concealment();
+
+  m_pending_cue     = -1;
+  m_cue             = -1;
+  m_fade_out_source = nullptr;
+  m_reposition_mode = MODE::NONE;
+
   // TODO - do we need to write the rest of the queue?
   //m_sd_play_queue.stop();
 }
 
-void SD_AUDIO_RECORDER::start_recording_sd()
+void SD_AUDIO_RECORDER::start_recording_sd( uint32_t loop_data_size )
 {  
-  DEBUG_TEXT("SD_AUDIO_RECORDER::start_recording_sd() ");
+  // the interrupt isn't recording, so nothing is left from an earlier resample
+  m_resampling = false;
+
+  if( open_record_file_sd( loop_data_size ) )
+  {
+    m_sd_record_queue.start();
+    m_record_read_buffer = nullptr;
+    m_record_read_offset = 0;
+  }
+}
+
+bool SD_AUDIO_RECORDER::open_record_file_sd( uint32_t loop_data_size )
+{
+  DEBUG_TEXT("SD_AUDIO_RECORDER::open_record_file_sd() ");
   DEBUG_TEXT_LINE(m_record_filename);
   if( SD.exists( m_record_filename ) )
   {
     // delete previously existing file (SD library will append to the end)
     SD.remove( m_record_filename ); 
   } 
+
+  if( m_cue_cache_filename != nullptr && strcmp( m_cue_cache_filename, m_record_filename ) == 0 )
+  {
+    // cached audio is about to be overwritten
+    m_cue_cache_filename = nullptr;
+  }
   
-  m_recorded_audio_file = SD.open( m_record_filename, FILE_WRITE );
+  m_record_data_size  = 0;
+  m_record_data_limit = loop_data_size;
 
-  if( m_recorded_audio_file )
+  // contiguous, so the audio can be written by sector without touching the FAT until the file is closed
+  const uint32_t max_data_size = loop_data_size > 0 ? loop_data_size + RECORD_DATA_MARGIN : MAX_RECORD_DATA_SIZE;
+  if( !m_record_stream.create_write( m_record_filename, WAV_FORMAT::HEADER_SIZE + max_data_size ) )
   {
-    m_sd_record_queue.start();
-    DEBUG_TEXT_LINE( m_record_filename );
+    m_recorded_audio_file = SD.open( m_record_filename, FILE_WRITE );
   }
-  else
+
+  if( !record_file_open() )
   {
     DEBUG_TEXT("Unable to open file: ");
     DEBUG_TEXT_LINE( m_record_filename );
+    return false;
   }
+
+  // placeholder header, finalised in close_record_file_sd() once the loop length is known
+  write_record_header_sd( 0 );
+
+  return true;
 }
 
 void SD_AUDIO_RECORDER::update_recording_sd()
 {
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::SD_RECORD_WRITES );
+
+  collect_sd_io();
+
+  if( m_record_data_limit > 0 && m_record_data_size >= m_record_data_limit )
+  {
+    if( ( m_mode == MODE::RECORD_PLAY || m_mode == MODE::RECORD_OVERDUB ) && !m_finishing_recording )
+    {
+      // the loop's last sample has been written, what follows it is the start of the next loop
+      next_record_file_sd();
+    }
+    else
+    {
+      // recorded past the end of the loop whilst the interrupt finishes with it
+      read_record_bytes( nullptr, queued_record_bytes() );
+      return;
+    }
+  }
+
+  // whole buffers, apart from the end of the loop
+  const uint32_t write_size = m_record_data_limit > 0 ? min_val<uint32_t>( WRITE_BUFFER_SIZE, m_record_data_limit - m_record_data_size ) : WRITE_BUFFER_SIZE;
+
   // Simple balancing system to keep play queue from emptying whilst preventing record queue from getting full
   const int record_queue_size = m_sd_record_queue.size(); 
-  if( record_queue_size >= 2 && 
-      ( m_mode == MODE::RECORD_INITIAL || m_sd_play_queue.size() >= MIN_PREFERRED_PLAY_BLOCKS || record_queue_size >= MAX_PREFERRED_RECORD_BLOCKS ) )
+  if( queued_record_bytes() >= write_size && m_num_writes < NUM_WRITE_BUFFERS && !m_record_file_full &&
+      ( m_mode == MODE::RECORD_INITIAL || queued_play_blocks() >= MIN_PREFERRED_PLAY_BLOCKS || record_queue_size >= MAX_PREFERRED_RECORD_BLOCKS ) )
   {
-    byte buffer[512]; // arduino library most efficient with full 512 sector size writes
+    // a raw stream is written by sector, so the end of the loop is padded (the header holds the true length)
+    const uint32_t sector_size = ( ( write_size + SD_RAW_STREAM::SECTOR_SIZE - 1 ) / SD_RAW_STREAM::SECTOR_SIZE ) * SD_RAW_STREAM::SECTOR_SIZE;
+    if( !reserve_record_space_sd( sector_size ) )
+    {
+      m_record_file_full = true;
+      return;
+    }
+    const uint32_t transfer_size = m_record_stream.is_open() ? sector_size : write_size;
 
-    // write 2 x 256 byte blocks to buffer
-    memcpy( buffer, m_sd_record_queue.read_buffer(), 256);
-    m_sd_record_queue.release_buffer();
-    memcpy( buffer + 256, m_sd_record_queue.read_buffer(), 256);
-    m_sd_record_queue.release_buffer();
+    // the buffer is owned by the write until it's collected
+    const int buffer_index  = ( m_write_head + m_num_writes ) % NUM_WRITE_BUFFERS;
+    byte* buffer            = m_write_buffers[buffer_index];
+
+    read_record_bytes( buffer, write_size );
+    memset( buffer + write_size, 0, transfer_size - write_size );
 
     // soft clip the buffer
-    for( int s = 0; s < 512; ++s )
+    for( uint32_t s = 0; s < write_size; ++s )
     {
       buffer[s] = soft_clip_sample( buffer[s] );
     }
 
-    ADD_TIMED_SECTION( "Write time", 8000 );
-    m_recorded_audio_file.write( buffer, 512 );
+    const uint32_t position = WAV_FORMAT::HEADER_SIZE + m_record_data_size;
+    const int request       = m_record_stream.is_open() ? m_sd_io.submit_write( m_record_stream, position, buffer, transfer_size ) :
+                                                          m_sd_io.submit_write( m_recorded_audio_file, SD_ASYNC_IO::CURRENT_POSITION, buffer, transfer_size );
+    if( request == SD_ASYNC_IO::INVALID_REQUEST )
+    {
+      // can't happen whilst the reads and writes in flight are limited to the size of the I/O queue
+      DEBUG_TEXT_LINE( "update_recording_sd() - I/O queue full" );
+      return;
+    }
+
+    m_write_requests[buffer_index] = request;
+    ++m_num_writes;
+    m_record_data_size += write_size;
   }
 }
 
-void SD_AUDIO_RECORDER::stop_recording_sd( bool write_remaining_blocks )
+uint32_t SD_AUDIO_RECORDER::queued_record_bytes() const
 {
-  DEBUG_TEXT_LINE("SD_AUDIO_RECORDER::stop_recording_sd()");
-  m_sd_record_queue.stop();
+  const uint32_t held_bytes = m_record_read_buffer != nullptr ? AUDIO_BLOCK_SAMPLES * 2 - m_record_read_offset : 0;
+  return m_sd_record_queue.size() * AUDIO_BLOCK_SAMPLES * 2 + held_bytes;
+}
 
-  if( is_recording() )
+void SD_AUDIO_RECORDER::read_record_bytes( byte* buffer, uint32_t size )
+{
+  // the end of the loop can fall part way through a block, which is held until the rest of it starts the next file
+  while( size > 0 )
   {
-    if( m_just_played_block != nullptr )
+    if( m_record_read_buffer == nullptr )
     {
-      release( m_just_played_block );
-      m_just_played_block = nullptr;
+      m_record_read_buffer = reinterpret_cast<const byte*>( m_sd_record_queue.read_buffer() );
+      m_record_read_offset = 0;
     }
-    
-    // empty the record queue
-    if( write_remaining_blocks )
+
+    const uint32_t bytes = min_val<uint32_t>( size, AUDIO_BLOCK_SAMPLES * 2 - m_record_read_offset );
+    if( buffer != nullptr )
     {
-      DEBUG_TEXT("Writing final blocks:");
-      DEBUG_TEXT_LINE( m_sd_record_queue.size() );
-      while( m_sd_record_queue.size() > 0 )
-      {
-        m_recorded_audio_file.write( reinterpret_cast<byte*>(m_sd_record_queue.read_buffer()), 256 );
-        m_sd_record_queue.release_buffer();
-      }
+      memcpy( buffer, m_record_read_buffer + m_record_read_offset, bytes );
+      buffer += bytes;
+    }
+    m_record_read_offset  += bytes;
+    size                  -= bytes;
+
+    if( m_record_read_offset == AUDIO_BLOCK_SAMPLES * 2 )
+    {
+      m_sd_record_queue.release_buffer();
+      m_record_read_buffer = nullptr;
+    }
+  }
+}
+
+void SD_AUDIO_RECORDER::write_remaining_record_sd()
+{
+  // synchronous, once the I/O queue has been drained - nothing past the end of the loop is written
+  uint32_t remaining = queued_record_bytes();
+  if( m_record_data_limit > 0 )
+  {
+    remaining = min_val<uint32_t>( remaining, m_record_data_limit > m_record_data_size ? m_record_data_limit - m_record_data_size : 0 );
+  }
+
+  while( remaining > 0 )
+  {
+    alignas(4) byte buffer[SD_RAW_STREAM::SECTOR_SIZE] = {};
+
+    if( m_record_file_full || !reserve_record_space_sd( SD_RAW_STREAM::SECTOR_SIZE ) )
+    {
+      // nowhere to put them
+      m_record_file_full = true;
+      break;
+    }
+
+    const uint32_t bytes = min_val<uint32_t>( remaining, SD_RAW_STREAM::SECTOR_SIZE );
+    read_record_bytes( buffer, bytes );
+
+    if( m_record_stream.is_open() )
+    {
+      // a final partial sector is padded, the header holds the true length
+      m_record_stream.write( WAV_FORMAT::HEADER_SIZE + m_record_data_size, buffer, SD_RAW_STREAM::SECTOR_SIZE );
     }
     else
     {
-      m_sd_record_queue.clear();
+      m_recorded_audio_file.write( buffer, bytes );
     }
 
-    m_recorded_audio_file.close();
+    m_record_data_size  += bytes;
+    remaining           -= bytes;
   }
+
+  read_record_bytes( nullptr, queued_record_bytes() );
 }
 
-void SD_AUDIO_RECORDER::stop_current_mode( bool reset_play_file )
-{ 
-  switch( m_mode )
+bool SD_AUDIO_RECORDER::reserve_record_space_sd( uint32_t size )
+{
+  // a file written through the file system grows as it's written, until the card is full
+  if( !m_record_stream.is_open() )
   {
-    case MODE::PLAY:
+    return m_recorded_audio_file;
+  }
+
+  if( WAV_FORMAT::HEADER_SIZE + m_record_data_size + size <= m_record_stream.size() )
+  {
+    return true;
+  }
+
+  // the preallocation is used up - release the rest of it, and carry on appending through the file system
+  const char* filename = m_streaming_recording ? m_play_back_filename : m_record_filename;
+  DEBUG_TEXT( "Record file preallocation full, appending: " );
+  DEBUG_TEXT_LINE( filename );
+
+  finish_sd_io();
+  m_record_stream.close( WAV_FORMAT::HEADER_SIZE + m_record_data_size );
+  m_recorded_audio_file = SD.open( filename, FILE_WRITE );
+
+  return m_recorded_audio_file;
+}
+
+void SD_AUDIO_RECORDER::end_full_recording_sd()
+{
+  // the recording stops where the card filled up, and the caller is told through recording_ended()
+  DEBUG_TEXT( "Record file full - " );
+  DEBUG_TEXT_LINE( mode_to_string( m_mode ) );
+  m_recording_ended = true;
+
+  if( m_mode == MODE::RECORD_INITIAL )
+  {
+    // loop what's been recorded
+    finish_record_initial_sd();
+    return;
+  }
+
+  // the loop being recorded is incomplete, so carry on looping the one it would have replaced - the play queue already
+  // holds it, and any scheduled wrap applies to it
+  AudioNoInterrupts();
+  m_mode                  = MODE::PLAY;
+  m_pending_mode          = MODE::NONE;
+  m_underrun_skip_samples = m_underrun_skip_samples + ( m_late_record_blocks * AUDIO_BLOCK_SAMPLES );
+  m_late_record_blocks    = 0;
+  AudioInterrupts();
+
+  m_looping = true;
+
+  if( m_streaming_recording )
+  {
+    // the incomplete loop was about to play, the one it would have replaced carries on from the same place instead
+    const uint32_t offset = m_play_back_file_offset;
+    switch_play_record_buffers();
+    if( open_play_back_sd( false ) )
     {
-      stop_playing_sd();
-      break; 
+      m_play_back_file_offset = min_val( offset, m_play_back_file_size & ~1u );
     }
-    case MODE::RECORD_INITIAL:
+  }
+
+  stop_recording_sd( false );
+}
+
+bool SD_AUDIO_RECORDER::record_file_open() const
+{
+  return m_record_stream.is_open() || m_recorded_audio_file;
+}
+
+void SD_AUDIO_RECORDER::next_record_file_sd()
+{
+  // every loop after the first is the same length, the rest of the record stream starts the next file
+  finish_sd_io();
+
+  const uint32_t loop_data_size = m_record_data_limit;
+  close_record_file_sd();
+
+  if( m_streaming_recording )
+  {
+    // the loop playing is complete now
+    reopen_play_back_sd();
+  }
+
+  open_record_file_sd( loop_data_size );
+}
+
+void SD_AUDIO_RECORDER::stream_recording_sd()
+{
+  // the recording plays straight after the queued blocks, whilst they're still being added to its end
+  if( record_file_open() )
+  {
+    switch_play_record_buffers();
+    if( open_play_back_recording_sd() )
     {
-      stop_recording_sd();
-      break;
+      return;
     }
-    case MODE::RECORD_PLAY:
-    case MODE::RECORD_OVERDUB:
+    switch_play_record_buffers();
+  }
+
+  // nothing to stream the recording from, keep looping what was playing
+  DEBUG_TEXT_LINE( "stream_recording_sd() - unable to play the recording" );
+  open_play_back_sd( false );
+}
+
+void SD_AUDIO_RECORDER::stop_recording_sd( bool write_remaining_blocks )
+{
+  // the interrupt must not be recording
+  DEBUG_TEXT_LINE("SD_AUDIO_RECORDER::stop_recording_sd()");
+  m_sd_record_queue.stop();
+
+  m_finishing_recording = false;
+
+  finish_sd_io();
+
+  if( m_just_played_block != nullptr )
+  {
+    release_block_func( m_just_played_block );
+    m_just_played_block = nullptr;
+  }
+
+  if( record_file_open() )
+  {
+    // empty the record queue
+    if( write_remaining_blocks )
     {
-      stop_playing_sd();
-      stop_recording_sd();
+      DEBUG_TEXT("Writing final blocks:");
+      DEBUG_TEXT_LINE( m_sd_record_queue.size() );
+      write_remaining_record_sd();
+    }
+
+    close_record_file_sd();
+  }
 
-      m_sd_play_queue.clear();
-      m_sd_record_queue.clear();
+  m_sd_record_queue.clear();
+  m_record_read_buffer  = nullptr;
+  m_record_read_offset  = 0;
+  m_record_file_full    = false;
+}
 
-      ASSERT_MSG( m_just_played_block == nullptr, "This should have been reset in stop_recording_sd()" );
-      
-      break;
+void SD_AUDIO_RECORDER::close_record_file_sd()
+{
+  if( record_file_open() )
+  {
+    if( m_record_data_limit > 0 && m_record_data_size > m_record_data_limit )
+    {
+      m_record_data_size = m_record_data_limit;
     }
-    default:
+    if( m_recorded_audio_file && m_recorded_audio_file.size() < WAV_FORMAT::HEADER_SIZE + m_record_data_size )
     {
-      break;
+      // writes failed once the card was full
+      m_record_data_size = m_recorded_audio_file.size() - WAV_FORMAT::HEADER_SIZE;
     }
+    m_record_data_limit = 0;
+
+    write_record_header_sd( m_record_data_size );
+
+    // the only file system update for a raw stream
+    m_record_stream.close( WAV_FORMAT::HEADER_SIZE + m_record_data_size );
+    m_recorded_audio_file.close();
+  }
+}
+
+void SD_AUDIO_RECORDER::write_record_header_sd( uint32_t data_size )
+{
+  WAV_FORMAT::WAV_INFO info;
+  info.m_sample_rate  = WAV_FORMAT::LOOPER_SAMPLE_RATE;
+  info.m_data_size    = data_size;
+  WAV_FORMAT::set_equal_segments( info, data_size / info.bytes_per_frame(), NUM_SEGMENTS );
+
+  alignas(4) byte header[WAV_FORMAT::HEADER_SIZE];
+  WAV_FORMAT::write_header( header, info );
+
+  if( m_record_stream.is_open() )
+  {
+    m_record_stream.write( 0, header, WAV_FORMAT::HEADER_SIZE );
+  }
+  else
+  {
+    m_recorded_audio_file.seek( 0 );
+    m_recorded_audio_file.write( header, WAV_FORMAT::HEADER_SIZE );
   }
+}
+
+void SD_AUDIO_RECORDER::stop_current_mode_sd( bool reset_play_file )
+{ 
+  // called once halt_interrupt() has stopped the interrupt using the queues and files
+  stop_playing_sd();
+  stop_recording_sd();
+
+  m_sd_play_queue.clear();
+
+  ASSERT_MSG( m_just_played_block == nullptr, "This should have been reset in stop_recording_sd()" );
 
   if( reset_play_file )
   {
@@ -728,12 +2764,17 @@ void SD_AUDIO_RECORDER::set_saturation( float saturation )
   m_soft_clip_coefficient = lerp( MIN_SATURATION, MAX_SATURATION, saturation );
 }
 
+void SD_AUDIO_RECORDER::set_reverse( bool reverse )
+{
+  m_reverse = reverse;
+}
+
 void SD_AUDIO_RECORDER::set_speed( float speed )
 {
   constexpr const float MIN_SPEED = 0.25f;
   constexpr const float MAX_SPEED = 2.0f;
 
-  m_speed = lerp( MIN_SPEED, MAX_SPEED, speed ); 
+  m_target_speed = lerp( MIN_SPEED, MAX_SPEED, speed );
 }
 
 const char* SD_AUDIO_RECORDER::mode_to_string( MODE mode )
@@ -769,8 +2810,13 @@ const char* SD_AUDIO_RECORDER::mode_to_string( MODE mode )
 
 uint32_t SD_AUDIO_RECORDER::play_back_file_time_ms() const
 {
-  const uint64_t num_samples = m_play_back_file_size / 2;
-  const uint64_t time_in_ms = ( num_samples * 1000 ) / AUDIO_SAMPLE_RATE;
+  if( m_play_back_info.m_sample_rate == 0 )
+  {
+    return 0;
+  }
+
+  const uint64_t num_samples = m_play_back_file_size / m_play_back_info.bytes_per_frame();
+  const uint64_t time_in_ms = ( num_samples * 1000 ) / m_play_back_info.m_sample_rate;
 
   //DEBUG_TEXT("Play back time in seconds:");
   //DEBUG_TEXT_LINE(time_in_ms / 1000.0f);
@@ -780,9 +2826,10 @@ uint32_t SD_AUDIO_RECORDER::play_back_file_time_ms() const
 
 float SD_AUDIO_RECORDER::playback_position() const
 {
-  if( m_play_back_file_size > 0 )
+  const uint32_t length = loop_length();
+  if( length > 0 && m_mode != MODE::RECORD_INITIAL )
   {
-    return m_play_back_file_offset / static_cast<float>(m_play_back_file_size);
+    return clamp( m_transport_position / length, 0.0f, 1.0f );
   }
   else
   {
@@ -790,3 +2837,45 @@ float SD_AUDIO_RECORDER::playback_position() const
     return 0;
   }
 }
+
+uint32_t SD_AUDIO_RECORDER::loop_length() const
+{
+  if( m_mode == MODE::RECORD_INITIAL )
+  {
+    // still recording, the loop is as long as the recording so far
+    return transport_position();
+  }
+
+  return loop_frames();
+}
+
+uint32_t SD_AUDIO_RECORDER::transport_position() const
+{
+  const float position = m_transport_position;
+  return position > 0.0f ? static_cast<uint32_t>(position) : 0;
+}
+
+float SD_AUDIO_RECORDER::sd_urgency() const
+{
+  float urgency = 0.0f;
+
+  const MODE mode = m_mode;
+  if( mode == MODE::PLAY || mode == MODE::RECORD_PLAY || mode == MODE::RECORD_OVERDUB )
+  {
+    // relative to how far ahead the reads are kept - only a few blocks when playing, to keep the latency down
+    const int refill_target = mode == MODE::PLAY ? MAX_PREFERRED_RECORD_BLOCKS_WHEN_PLAYING + 1 : MIN_PREFERRED_PLAY_BLOCKS;
+    urgency = SCHEDULER::refill_urgency( queued_play_blocks(), refill_target );
+  }
+
+  if( mode == MODE::RECORD_INITIAL || mode == MODE::RECORD_PLAY || mode == MODE::RECORD_OVERDUB )
+  {
+    // writes are forced beyond MAX_PREFERRED_RECORD_BLOCKS, whatever the play queue
+    const float record_urgency = m_sd_record_queue.size() / static_cast<float>(MAX_PREFERRED_RECORD_BLOCKS);
+    if( record_urgency > urgency )
+    {
+      urgency = record_urgency;
+    }
+  }
+
+  return clamp( urgency, 0.0f, 1.0f );
+}
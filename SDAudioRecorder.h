@@ -2,6 +2,11 @@
 
 #include <Audio.h>
 #include "AudioRecordQueue.h"
+#include "CommandQueue.h"
+#include "SDAsyncIO.h"
+#include "SDRawStream.h"
+#include "Sequence.h"
+#include "WavFormat.h"
 
 class SD_AUDIO_RECORDER : public AudioStream
 {
@@ -18,6 +23,23 @@ public:
     NONE,                 // no mode (used by pending mode)
   };
 
+  enum class SEQUENCE_MODE
+  {
+    NONE,
+    RECORD,               // cuts are recorded at the loop position they are heard
+    PLAY,                 // recorded cuts are replayed from the audio interrupt
+  };
+
+  enum class RECORD_SOURCE
+  {
+    AUDIO_INPUT,          // overdubs add the input to the loop
+    RESAMPLE,             // overdubs replace the loop with the output mix, from INPUT_RESAMPLE
+  };
+
+  static constexpr const int INPUT_AUDIO          = 0;    // recorded, and mixed into overdubs
+  static constexpr const int INPUT_RESAMPLE       = 1;    // the output mix, recorded when overdubbing with RECORD_SOURCE::RESAMPLE
+  static constexpr const int NUM_INPUTS           = 2;
+
   SD_AUDIO_RECORDER();
 
   virtual void        update() override;
@@ -27,77 +49,337 @@ public:
 
   MODE                mode() const;
   
+  // mode changes are queued, and applied in update_main_loop()
   void                play();
   void                play_file( const char* filename, bool loop );
   void                stop();
   void                start_record();
   void                stop_record();
 
-  bool                mode_pending() const;
+  bool                mode_pending() const;   // a queued command, or a mode waiting for the loop point
+  bool                recording_ended();      // true once after the card filled up and the recording was ended early
 
   void                set_read_position( float t );
+  void                set_loop_length_quantum( float num_samples );  // the initial recording ends on the nearest multiple, 0 to end when asked
+  void                set_record_source( RECORD_SOURCE source );
+  RECORD_SOURCE       record_source() const;
+
+  // cut sequences, in PLAY mode - each loop has NUM_SEQUENCE_PATTERNS patterns, saved alongside the loop as they're recorded
+  void                record_sequence();                    // into the selected pattern, replacing it
+  void                play_sequence();                      // ends a recording with a cut back to the segment it started in
+  void                stop_sequence();
+  void                select_sequence_pattern( int pattern );
+  int                 sequence_pattern() const;
+  bool                sequence_pattern_empty( int pattern ) const;
+  SEQUENCE_MODE       sequence_mode() const;
+  uint32_t            num_missed_sequence_events() const;   // cut to a segment which wasn't cached, or recorded into a full pattern
+  uint32_t            num_underruns() const;            // play queue underruns concealed
+  void                set_crossfade_length( int num_samples );  // crossfade applied at cuts and loop wraps in PLAY mode
   
   uint32_t            play_back_file_time_ms() const;
-  float               playback_position() const;        // 0..1 (0 beginning, 1 end)
+  float               playback_position() const;        // 0..1 (0 beginning, 1 end) of what is currently being heard
+  uint32_t            loop_length() const;              // in samples
+  uint32_t            transport_position() const;       // in samples, advanced by the audio interrupt
+  float               sd_urgency() const;               // 0..1, how close the play queue is to running dry or the record queue to overflowing
+  int                 queued_play_blocks() const;       // including reads in flight
+  bool                check_block_ownership() const;    // with TRACK_AUDIO_BLOCKS, false (and logged) if blocks have leaked
 
   static const char*  mode_to_string( MODE mode );
 
+  static constexpr const int NUM_SEGMENTS                             = 8; // matches BUTTON_STRIP::NUM_SEGMENTS
+  static constexpr const int CUE_CACHE_SAMPLES                        = 512; // cached at the start of each segment, covers the SD seek after a cut
+  static constexpr const int MAX_CROSSFADE_SAMPLES                    = CUE_CACHE_SAMPLES / 2; // fade must finish within the cache at the maximum speed (2x)
+  static constexpr const int DEFAULT_CROSSFADE_SAMPLES                = 128;
+  static constexpr const float SPEED_SMOOTHING                        = 0.25f; // per block, approx 10ms time constant
+  static constexpr const int NUM_SEQUENCE_PATTERNS                    = 4;
+
   void                set_saturation( float saturation );
   void                set_speed( float speed );
+  void                set_reverse( bool reverse );      // play backwards at the set_speed() rate, only applies in PLAY mode
 
   //// For AUDIO_RECORD_QUEUE
   void                release_block_func(audio_block_t* block);
 
 private:
 
-  audio_block_t*      m_input_queue_array[1];
+  enum class COMMAND_TYPE
+  {
+    PLAY,
+    PLAY_FILE,
+    STOP,
+    START_RECORD,
+    STOP_RECORD,
+  };
+
+  struct COMMAND
+  {
+    COMMAND_TYPE      m_type;
+    const char*       m_filename;
+    bool              m_loop;
+  };
+
+  static constexpr const int COMMAND_QUEUE_SIZE                       = 8;
+
+  audio_block_t*      m_input_queue_array[NUM_INPUTS];
   audio_block_t*      m_just_played_block;   // block which was just played from the SD file
   audio_block_t*      m_current_play_block;  // block which is currently being played (when speed != 1 we don't always play 1 block) - could just use m_just_played_block?
 
-  MODE                m_mode;
-  MODE                m_pending_mode;         // used to switch modes at the loop point
+  volatile RECORD_SOURCE m_record_source;
+  bool                m_resampling;           // the record queue is running a block behind the loop, see add_record_block_interrupt()
+
+  volatile MODE       m_mode;
+  volatile MODE       m_pending_mode;         // used to switch modes at the loop point
   const char*         m_play_back_filename;
   const char*         m_record_filename;
 
   File                m_recorded_audio_file;
   File                m_play_back_audio_file;
-  uint32_t            m_play_back_file_size;
-  uint32_t            m_play_back_file_offset;
+  SD_RAW_STREAM       m_record_stream;          // used instead of the Files when the file is contiguous
+  SD_RAW_STREAM       m_play_back_stream;
+  uint32_t            m_record_data_size;       // audio bytes written to the record file
+  uint32_t            m_record_data_limit;      // exact length of the loop, the record stream moves on to the next file once it's written, 0 if not known
+  const byte*         m_record_read_buffer;     // record queue block held part way through, when the loop end splits it between files
+  uint32_t            m_record_read_offset;     // bytes of it already written
+  WAV_FORMAT::WAV_INFO m_play_back_info;
+  uint32_t            m_play_back_file_size;    // size of the audio data (excluding any header)
+  uint32_t            m_play_back_readable_size;  // less than the size whilst streaming a recording that's still being written
+  uint32_t            m_play_back_file_offset;  // offset into the audio data
+  bool                m_streaming_recording;    // the play back file is the record file, its end still being written
+
+  float               m_loop_length_quantum;    // in samples, 0 if not quantised
+  uint32_t            m_initial_loop_length;    // quantised end of the initial recording, in samples
 
   uint32_t            m_jump_position;
   bool                m_jump_pending;
+  int                 m_jump_cue;             // segment being jumped to, -1 if not a segment start
+
+  // head of each segment cached in RAM, so a cut or loop wrap can start playing immediately and crossfade from what is
+  // currently playing without needing a second SD stream
+  int16_t             m_cue_cache[NUM_SEGMENTS][CUE_CACHE_SAMPLES];
+  uint32_t            m_cue_positions[NUM_SEGMENTS];  // byte offset into the audio data
+  uint32_t            m_cue_cache_loaded;             // bit per segment
+  const char*         m_cue_cache_filename;
+
+  // transport - the position in the loop of what is being heard, rather than what has been read from the SD card
+  volatile float      m_transport_position;   // in samples
+  volatile int        m_blocks_until_reposition;  // queued blocks to play before the transport jumps (e.g. the loop wrap), -1 if none
+  volatile uint32_t   m_reposition_frame;
+  volatile MODE       m_reposition_mode;      // mode to switch to when the transport jumps
+  volatile int        m_reposition_block_samples; // samples heard of the last block before the jump, it may end part way through
+
+  // interrupt side of the cue cache
+  volatile int        m_pending_cue;          // cue to switch to (immediately, or at the reposition), -1 if none
+  int                 m_cue;                  // cue currently playing from the cache, -1 if playing from the queue
+  float               m_cue_read_head;
+  const int16_t*      m_fade_out_source;      // what was playing at the cut, nullptr if not fading
+  int                 m_fade_out_size;
+  float               m_fade_out_head;
+  int                 m_fade_position;
+  int                 m_crossfade_length;
+
+  // sequencer - the clock counts loop samples heard since the loop start, but unlike the transport isn't moved by cuts
+  SEQUENCE            m_sequences[NUM_SEQUENCE_PATTERNS];
+  volatile int        m_sequence_pattern;
+  volatile SEQUENCE_MODE m_sequence_mode;
+  float               m_sequence_clock;       // in samples, wraps at the loop length
+  SEQUENCE::CURSOR    m_sequence_cursor;      // next event to dispatch
+  volatile uint32_t   m_num_missed_sequence_events;
+  volatile int        m_sequence_cut_cue;     // cut made by the interrupt, waiting for update_main_loop() to move the stream, -1 if none
+  uint32_t            m_sequence_record_start_clock;
+  float               m_sequence_record_start_transport;
+  volatile int        m_sequence_record_wraps;  // loop ends passed whilst recording the pattern
+
+  // the patterns are saved to (and loaded from) the card through m_sd_io, via an image of the file
+  struct SEQUENCE_FILE_HEADER
+  {
+    uint32_t          m_magic;
+    uint16_t          m_version;
+    uint16_t          m_num_patterns;
+    uint32_t          m_loop_length;          // in samples, the patterns only apply to a loop of the same length
+    uint16_t          m_data_sizes[NUM_SEQUENCE_PATTERNS];
+  };
+
+  enum class SEQUENCE_FILE_STATE
+  {
+    IDLE,
+    SAVING,
+    LOADING,
+  };
+
+  static constexpr const int SEQUENCE_FILE_IMAGE_SIZE                 = sizeof(SEQUENCE_FILE_HEADER) + NUM_SEQUENCE_PATTERNS * SEQUENCE::MAX_DATA_SIZE;
+
+  SEQUENCE_FILE_STATE m_sequence_file_state;
+  File                m_sequence_file;
+  int                 m_sequence_file_request;
+  int                 m_sequence_file_size;
+  bool                m_save_sequences_pending;
+  bool                m_load_sequences_pending;   // once the loop is playing, so its length is known
+  alignas(4) byte     m_sequence_file_image[SEQUENCE_FILE_IMAGE_SIZE];
+
+  // underrun concealment - when the play queue runs dry the recent output is repeated (fading out) so the transport, and
+  // any recording, keep time, then the stale blocks it played over are dropped as the queue catches up
+  enum class UNDERRUN_STATE
+  {
+    NONE,
+    CONCEALING,
+    RECOVERING,                               // crossfading from the concealment back to the stream
+  };
+
+  static constexpr const int UNDERRUN_HISTORY_SAMPLES                 = 2 * AUDIO_BLOCK_SAMPLES;
+  static constexpr const int UNDERRUN_SPLICE_SAMPLES                  = 32;  // crossfade each time the history repeats
+  static constexpr const int UNDERRUN_FADE_SAMPLES                    = 8 * AUDIO_BLOCK_SAMPLES; // approx 23ms to silence
+  static constexpr const int UNDERRUN_RECOVERY_SAMPLES                = 64;
+
+  int16_t             m_underrun_history[UNDERRUN_HISTORY_SAMPLES];  // most recent output, oldest first
+  UNDERRUN_STATE      m_underrun_state;
+  uint32_t            m_concealed_samples;      // position in the concealment, continues through recovery
+  uint32_t            m_underrun_event_samples; // output samples concealed in the current underrun
+  float               m_underrun_skip_samples;  // stream samples the concealment played over, dropped when they arrive
+  int                 m_late_record_blocks;     // slots concealed whilst recording, their blocks are recorded when they arrive
+  bool                m_resampled_block_concealed; // the output mix arriving next update holds a concealed block
+  int                 m_underrun_recovery_position;
+  volatile uint32_t   m_num_underruns;
+  volatile uint32_t   m_last_underrun_samples;
+  uint32_t            m_num_underruns_logged;
 
   bool                m_looping;
   bool                m_finished_playback;
+  bool                m_finishing_recording;  // the switch to PLAY is scheduled, recording stops once the loop end is heard
+  bool                m_record_file_full;     // a record write failed or the file couldn't grow, see end_full_recording_sd()
+  bool                m_recording_ended;
+
+  bool                m_reverse;              // requested direction
+  bool                m_play_reversed;        // direction of the current SD stream
+  volatile bool       m_direction_change_pending; // the queue is refilling in the new direction, an empty queue isn't an underrun
 
-  float               m_speed;
+  float               m_speed;                // constant within a block, so the transport stays in step
+  volatile float      m_target_speed;         // m_speed glides towards this once per block
   float               m_read_head;
 
   float               m_soft_clip_coefficient;
 
+  COMMAND_QUEUE<COMMAND, COMMAND_QUEUE_SIZE>                m_commands;
+
   static constexpr const int PLAY_QUEUE_SIZE                          = 64;
   static constexpr const int RECORD_QUEUE_SIZE                        = 53; // matches the teensy audio library
   static constexpr const int INITIAL_PLAY_BLOCKS                      = 16;
   static constexpr const int MIN_PREFERRED_PLAY_BLOCKS                = 32;
   static constexpr const int MAX_PREFERRED_RECORD_BLOCKS_WHEN_PLAYING = 6; // approx 14ms latency when playing
   static constexpr const int MAX_PREFERRED_RECORD_BLOCKS              = 40;
+  static constexpr const int MAX_PLAY_READS_IN_FLIGHT                 = 4;
+  static constexpr const int NUM_WRITE_BUFFERS                        = SD_ASYNC_IO::MAX_REQUESTS - MAX_PLAY_READS_IN_FLIGHT;
+  static constexpr const int BLOCKS_PER_WRITE                         = 4;
+  static constexpr const int WRITE_BUFFER_SIZE                        = BLOCKS_PER_WRITE * AUDIO_BLOCK_SAMPLES * 2; // whole sectors, written as one multi-block command
+  static constexpr const uint32_t MAX_RECORD_DATA_SIZE                = 64 * 1024 * 1024; // preallocated for the initial recording (about 12 minutes), longer recordings grow through the file system
+  static constexpr const uint32_t RECORD_DATA_MARGIN                  = SD_RAW_STREAM::SECTOR_SIZE; // the loop's final sector is padded
   AUDIO_RECORD_QUEUE<PLAY_QUEUE_SIZE, SD_AUDIO_RECORDER>    m_sd_play_queue;
   AUDIO_RECORD_QUEUE<RECORD_QUEUE_SIZE, SD_AUDIO_RECORDER>  m_sd_record_queue;
 
+  // play reads (in either direction) and record writes are submitted to m_sd_io, and collected in submission order once complete
+  struct PLAY_READ
+  {
+    audio_block_t*    m_block;
+    int               m_request;
+    int               m_block_offset; // first sample of the block the read fills
+    uint32_t          m_size;         // bytes requested
+    bool              m_reversed;     // read backwards, the samples are reversed once it completes
+  };
+
+  SD_ASYNC_IO         m_sd_io;
+  PLAY_READ           m_play_reads[MAX_PLAY_READS_IN_FLIGHT];
+  int                 m_play_read_head;
+  int                 m_num_play_reads;
+  audio_block_t*      m_partial_play_block;   // holds the end of the loop, and is filled from its start as the loop wraps
+  int                 m_partial_play_samples;
+  alignas(4) byte     m_write_buffers[NUM_WRITE_BUFFERS][WRITE_BUFFER_SIZE];
+  int                 m_write_requests[NUM_WRITE_BUFFERS];
+  int                 m_write_head;
+  int                 m_num_writes;
+
+  void                add_record_block_interrupt();
+  void                queue_record_block_interrupt( audio_block_t* block );
   audio_block_t*      create_record_block();
 
-  // X_sd functions access the SD card - therefore should not be called within the update() interrupt
-  void                start_recording_sd();
+  void                post_command( COMMAND_TYPE type, const char* filename = nullptr, bool loop = false );
+
+  // X_sd functions access the SD card - therefore should not be called within the update() interrupt, or with interrupts disabled
+  void                process_commands_sd();
+  void                collect_sd_io();
+  void                finish_sd_io();     // blocks until all submitted I/O is complete - before any synchronous file access
+
+  void                play_sd();
+  void                play_file_sd( const char* filename, bool loop );
+  void                stop_sd();
+  void                start_record_sd();
+  void                stop_record_sd();
+  void                finish_record_initial_sd();
+
+  void                start_recording_sd( uint32_t loop_data_size );     // 0 if the loop length isn't known yet
+  bool                open_record_file_sd( uint32_t loop_data_size );
+  bool                record_file_open() const;
   void                update_recording_sd();
+  uint32_t            queued_record_bytes() const;
+  void                read_record_bytes( byte* buffer, uint32_t size );  // a null buffer drops them
+  void                write_remaining_record_sd();
+  bool                reserve_record_space_sd( uint32_t size );
+  void                end_full_recording_sd();
+  void                next_record_file_sd();
+  void                stream_recording_sd();
   void                stop_recording_sd( bool write_remaining_blocks = true );
+  void                close_record_file_sd();
+  void                write_record_header_sd( uint32_t data_size );
 
-  bool                start_playing_sd();
+  bool                start_playing_sd( bool reverse );
+  bool                open_play_back_sd( bool reverse );
+  bool                open_play_back_recording_sd();
+  void                extend_play_back_recording_sd();
+  void                reopen_play_back_sd();
+  bool                read_play_back_header_sd();
+  bool                read_play_back_sd( uint32_t position, void* buffer, uint32_t size );
   bool                update_playing_sd();
+  int                 queue_partial_play_block_sd();    // returns the samples of it which are heard
+  void                release_partial_play_block_sd();
+  void                change_play_direction_sd();
   void                stop_playing_sd();
 
   void                update_playing_interrupt();
+  void                start_cue_interrupt( int cue );
+  int16_t             read_cue_sample_interrupt();
+
+  void                conceal_underrun_interrupt( int16_t* samples, int from, int to );
+  void                record_late_blocks_interrupt();
+  int16_t             next_concealed_sample_interrupt();
+  void                recover_from_underrun_interrupt( int16_t* samples, int from, int to );   // crossfades into stream samples
+  void                finish_underrun_interrupt();
+  void                update_underrun_history_interrupt( const int16_t* samples );
+  void                reset_underrun_concealment();
+  void                log_underruns();
+
+  void                reset_cue_cache();
+  void                update_cue_cache_sd();
+  bool                jump_to_cue_sd( int cue, bool at_loop_wrap );
+  void                schedule_reposition( uint32_t frame, int blocks_before_reposition, MODE mode = MODE::NONE, int last_block_samples = AUDIO_BLOCK_SAMPLES );
+  void                wrap_play_back_sd();
+  uint32_t            loop_frames() const;        // exact length of the loop being played, the transport and sequence clock wrap at it
+  void                wrap_transport_interrupt();
+
+  audio_block_t*      next_play_block_interrupt();
+  int                 current_play_block_end_interrupt() const;
+  void                reposition_interrupt();
+  int                 next_sequence_event_write_head( float clock, int clock_head ) const;   // AUDIO_BLOCK_SAMPLES if not in this block
+  void                resync_after_sequence_cut_sd();
+  void                dispatch_sequence_event_interrupt( float& clock, int& clock_head, int write_head );
+  void                add_sequence_return_event();
+
+  void                clear_sequences_sd();
+  void                update_sequence_file_sd();
+  void                start_save_sequences_sd();
+  void                start_load_sequences_sd();
+  void                finish_sequence_file_sd();
+  bool                apply_sequence_file_image( int size );
 
-  void                stop_current_mode( bool reset_play_file );
+  void                halt_interrupt();
+  void                stop_current_mode_sd( bool reset_play_file );
 
   void                switch_play_record_buffers();
 
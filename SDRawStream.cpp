@@ -0,0 +1,180 @@
+#include "Util.h"
+#include "SDRawStream.h"
+
+SD_RAW_STREAM::SD_RAW_STREAM() :
+  m_file(),
+  m_first_sector(0),
+  m_num_sectors(0),
+  m_size(0),
+  m_writing(false),
+  m_sector_buffer()
+{
+
+}
+
+bool SD_RAW_STREAM::open_read( const char* filename )
+{
+  close();
+
+  m_file = SD.sdfs.open( filename, O_RDONLY );
+  if( !m_file )
+  {
+    return false;
+  }
+
+  m_size = m_file.fileSize();
+  if( !resolve_range() )
+  {
+    m_file.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool SD_RAW_STREAM::open_read( const SD_RAW_STREAM& writer, uint32_t size )
+{
+  close();
+
+  if( !writer.is_open() )
+  {
+    return false;
+  }
+
+  // shares the writer's sectors without a file of its own, they stay allocated once the writer closes
+  m_first_sector  = writer.m_first_sector;
+  m_num_sectors   = writer.m_num_sectors;
+  m_size          = min_val( size, writer.m_size );
+
+  return true;
+}
+
+bool SD_RAW_STREAM::create_write( const char* filename, uint32_t max_size )
+{
+  close();
+
+  m_file = SD.sdfs.open( filename, O_RDWR | O_CREAT | O_TRUNC );
+  if( !m_file )
+  {
+    return false;
+  }
+
+  // allocate all the clusters now, so nothing in the FAT changes until close()
+  if( !m_file.preAllocate( max_size ) || !resolve_range() )
+  {
+    DEBUG_TEXT( "SD_RAW_STREAM::create_write() unable to preallocate: " );
+    DEBUG_TEXT_LINE( filename );
+
+    m_file.close();
+    return false;
+  }
+
+  m_size    = max_size;
+  m_writing = true;
+
+  return true;
+}
+
+void SD_RAW_STREAM::close( uint32_t final_size )
+{
+  if( m_file )
+  {
+    if( m_writing )
+    {
+      // release the unused part of the preallocation, this is the only FAT update
+      m_file.truncate( final_size );
+    }
+
+    m_file.close();
+  }
+
+  m_first_sector  = 0;
+  m_num_sectors   = 0;
+  m_size          = 0;
+  m_writing       = false;
+}
+
+bool SD_RAW_STREAM::is_open() const
+{
+  return m_num_sectors > 0;
+}
+
+uint32_t SD_RAW_STREAM::size() const
+{
+  return m_size;
+}
+
+bool SD_RAW_STREAM::read( uint32_t position, void* buffer, uint32_t size )
+{
+  if( !is_open() || position + size > m_size )
+  {
+    return false;
+  }
+
+  SdCardInterface* card = SD.sdfs.card();
+  uint8_t* dest         = static_cast<uint8_t*>(buffer);
+
+  while( size > 0 )
+  {
+    const uint32_t sector = m_first_sector + position / SECTOR_SIZE;
+    const uint32_t offset = position % SECTOR_SIZE;
+
+    if( offset == 0 && size >= SECTOR_SIZE && ( reinterpret_cast<uintptr_t>(dest) & 3 ) == 0 )
+    {
+      // whole sectors straight into the destination, as one multi-block read
+      const uint32_t num_sectors = size / SECTOR_SIZE;
+      if( !card->readSectors( sector, dest, num_sectors ) )
+      {
+        return false;
+      }
+
+      const uint32_t bytes = num_sectors * SECTOR_SIZE;
+      dest      += bytes;
+      position  += bytes;
+      size      -= bytes;
+    }
+    else
+    {
+      if( !card->readSectors( sector, m_sector_buffer, 1 ) )
+      {
+        return false;
+      }
+
+      const uint32_t bytes = min_val<uint32_t>( SECTOR_SIZE - offset, size );
+      memcpy( dest, m_sector_buffer + offset, bytes );
+
+      dest      += bytes;
+      position  += bytes;
+      size      -= bytes;
+    }
+  }
+
+  return true;
+}
+
+bool SD_RAW_STREAM::write( uint32_t position, const void* buffer, uint32_t size )
+{
+  ASSERT_MSG( position % SECTOR_SIZE == 0 && size % SECTOR_SIZE == 0, "SD_RAW_STREAM::write() must be whole sectors" );
+
+  if( !is_open() || !m_writing || position + size > m_size )
+  {
+    return false;
+  }
+
+  return SD.sdfs.card()->writeSectors( m_first_sector + position / SECTOR_SIZE, static_cast<const uint8_t*>(buffer), size / SECTOR_SIZE );
+}
+
+bool SD_RAW_STREAM::resolve_range()
+{
+  uint32_t first_sector = 0;
+  uint32_t last_sector  = 0;
+  if( !m_file.contiguousRange( &first_sector, &last_sector ) )
+  {
+    return false;
+  }
+
+  m_first_sector  = first_sector;
+  m_num_sectors   = last_sector - first_sector + 1;
+
+  return true;
+}
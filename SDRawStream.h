@@ -0,0 +1,41 @@
+#pragma once
+
+#include <SD.h>
+
+// Streams a contiguous file by sector, with raw (multi-block) card reads and writes which bypass the FAT layer.
+// The file's sector range is resolved once when it's opened. Files being written are preallocated contiguously, and the
+// FAT metadata is only updated in close(), when the file is truncated to the length actually written.
+// Opening fails if the file isn't contiguous (e.g. copied onto a fragmented card), so callers fall back to File.
+// A stream can also read the sectors another stream is writing, so a file can be played before it's closed.
+
+class SD_RAW_STREAM
+{
+public:
+
+  static constexpr const uint32_t SECTOR_SIZE   = 512;
+
+  SD_RAW_STREAM();
+
+  bool                open_read( const char* filename );
+  bool                open_read( const SD_RAW_STREAM& writer, uint32_t size );  // the first size bytes, which must already be written
+  bool                create_write( const char* filename, uint32_t max_size );
+  void                close( uint32_t final_size = 0 );      // final_size is the file length when writing
+
+  bool                is_open() const;
+  uint32_t            size() const;
+
+  bool                read( uint32_t position, void* buffer, uint32_t size );           // any position and size
+  bool                write( uint32_t position, const void* buffer, uint32_t size );    // whole sectors only
+
+private:
+
+  FsFile              m_file;
+  uint32_t            m_first_sector;
+  uint32_t            m_num_sectors;
+  uint32_t            m_size;
+  bool                m_writing;
+
+  alignas(4) uint8_t  m_sector_buffer[SECTOR_SIZE];   // for reads which don't start or end on a sector boundary
+
+  bool                resolve_range();
+};
@@ -0,0 +1,321 @@
+#include "Util.h"
+#include "AudioProfiler.h"
+#include "LoopProfiler.h"
+#include "SDSamplePlayer.h"
+
+static_assert( SD_SAMPLE_PLAYER::RING_SIZE % SD_SAMPLE_PLAYER::READ_SIZE == 0, "Reads must not straddle the end of the ring" );
+static_assert( ( SD_SAMPLE_PLAYER::RING_SIZE & ( SD_SAMPLE_PLAYER::RING_SIZE - 1 ) ) == 0, "Ring size must be a power of 2" );
+
+SD_SAMPLE_PLAYER::SD_SAMPLE_PLAYER() :
+  AudioStream(0, nullptr),
+  m_voices(),
+  m_num_underruns(0),
+  m_sd_io()
+{
+
+}
+
+void SD_SAMPLE_PLAYER::update()
+{
+  ADD_PROFILED_SECTION( AUDIO_PROFILER::SECTION::SAMPLE_PLAYER );
+
+  bool any_active = false;
+  int32_t mix[AUDIO_BLOCK_SAMPLES] = {0};
+
+  for( int v = 0; v < NUM_VOICES; ++v )
+  {
+    VOICE& voice = m_voices[v];
+    if( !voice.m_active )
+    {
+      continue;
+    }
+
+    const uint32_t buffered   = voice.buffered();
+    const uint32_t to_mix     = min_val<uint32_t>( buffered, AUDIO_BLOCK_SAMPLES );
+    uint32_t read_pos         = voice.m_read_pos;
+
+    for( uint32_t s = 0; s < to_mix; ++s )
+    {
+      mix[s] += voice.m_ring[ read_pos++ & ( RING_SIZE - 1 ) ];
+    }
+
+    voice.m_read_pos = read_pos;
+    any_active = true;
+
+    if( to_mix < AUDIO_BLOCK_SAMPLES )
+    {
+      if( voice.m_file_finished )
+      {
+        // played to the end, the main loop will close the file
+        voice.m_active = false;
+      }
+      else if( voice.m_write_pos > 0 )
+      {
+        // before the first read lands the voice just hasn't started
+        ++m_num_underruns;
+      }
+    }
+  }
+
+  if( !any_active )
+  {
+    return;
+  }
+
+  audio_block_t* block = allocate();
+  if( block == nullptr )
+  {
+    return;
+  }
+
+  for( int s = 0; s < AUDIO_BLOCK_SAMPLES; ++s )
+  {
+    block->data[s] = clamp<int32_t>( mix[s], std::numeric_limits<int16_t>::lowest(), std::numeric_limits<int16_t>::max() );
+  }
+
+  transmit( block );
+  release( block );
+}
+
+void SD_SAMPLE_PLAYER::update_main_loop()
+{
+  ADD_LOOP_PROFILED_SECTION( LOOP_PROFILER::SECTION::SD_SAMPLE_PLAYER );
+
+  m_sd_io.update();
+
+  for( int v = 0; v < NUM_VOICES; ++v )
+  {
+    VOICE& voice = m_voices[v];
+    if( voice.m_read_request != SD_ASYNC_IO::INVALID_REQUEST && m_sd_io.complete( voice.m_read_request ) )
+    {
+      collect_read_sd( voice, m_sd_io.finish( voice.m_read_request ) );
+    }
+
+    // close the files of voices which have finished playing
+    if( !voice.m_active && voice.m_file && voice.m_read_request == SD_ASYNC_IO::INVALID_REQUEST )
+    {
+      voice.m_file.close();
+    }
+  }
+
+  // service the voices closest to running out first
+  for( int r = 0; r < MAX_READS_PER_UPDATE; ++r )
+  {
+    VOICE* voice = most_urgent_voice();
+    if( voice == nullptr || !submit_read_sd( *voice ) )
+    {
+      break;
+    }
+  }
+}
+
+bool SD_SAMPLE_PLAYER::play( const char* filename )
+{
+  VOICE* voice = allocate_voice();
+
+  voice->m_file = SD.open( filename );
+  if( !voice->m_file )
+  {
+    DEBUG_TEXT("Unable to open file: ");
+    DEBUG_TEXT_LINE( filename );
+    return false;
+  }
+
+  auto file_reader = [voice]( uint32_t offset, void* dest, uint32_t size ) -> bool
+  {
+    return voice->m_file.seek( offset ) && voice->m_file.read( dest, size ) == size;
+  };
+
+  WAV_FORMAT::WAV_INFO info;
+  const uint32_t file_size = voice->m_file.size();
+  if( !WAV_FORMAT::read_header( file_reader, file_size, info ) )
+  {
+    // headerless .RAW file - assume mono 16-bit at the looper's rate
+    info                = WAV_FORMAT::WAV_INFO();
+    info.m_data_size    = file_size;
+    info.m_sample_rate  = WAV_FORMAT::LOOPER_SAMPLE_RATE;
+  }
+
+  const uint32_t rate_error = info.m_sample_rate > WAV_FORMAT::LOOPER_SAMPLE_RATE ? info.m_sample_rate - WAV_FORMAT::LOOPER_SAMPLE_RATE :
+                                                                                    WAV_FORMAT::LOOPER_SAMPLE_RATE - info.m_sample_rate;
+  if( rate_error > MAX_SAMPLE_RATE_ERROR )
+  {
+    DEBUG_TEXT("Unsupported sample rate: ");
+    DEBUG_TEXT( info.m_sample_rate );
+    DEBUG_TEXT(" ");
+    DEBUG_TEXT_LINE( filename );
+    voice->m_file.close();
+    return false;
+  }
+
+  if( info.m_channels != 1 || info.m_bits_per_sample != 16 || !voice->m_file.seek( info.m_data_offset ) )
+  {
+    DEBUG_TEXT("Unsupported file format: ");
+    DEBUG_TEXT_LINE( filename );
+    voice->m_file.close();
+    return false;
+  }
+
+  voice->m_data_remaining = info.m_data_size;
+  voice->m_start_time_ms  = millis();
+  voice->m_write_pos      = 0;
+  voice->m_read_pos       = 0;
+  voice->m_file_finished  = false;
+
+  // the interrupt plays silence, without counting an underrun, until the first read lands
+  submit_read_sd( *voice );
+
+  voice->m_active = true;
+
+  return true;
+}
+
+void SD_SAMPLE_PLAYER::stop_all()
+{
+  for( int v = 0; v < NUM_VOICES; ++v )
+  {
+    stop_voice( m_voices[v] );
+  }
+}
+
+int SD_SAMPLE_PLAYER::num_active_voices() const
+{
+  int num_active = 0;
+  for( int v = 0; v < NUM_VOICES; ++v )
+  {
+    if( m_voices[v].m_active )
+    {
+      ++num_active;
+    }
+  }
+
+  return num_active;
+}
+
+uint32_t SD_SAMPLE_PLAYER::num_underruns() const
+{
+  return m_num_underruns;
+}
+
+float SD_SAMPLE_PLAYER::sd_urgency() const
+{
+  float urgency = 0.0f;
+  for( int v = 0; v < NUM_VOICES; ++v )
+  {
+    const VOICE& voice = m_voices[v];
+    if( voice.m_active && !voice.m_file_finished )
+    {
+      const float voice_urgency = 1.0f - ( voice.buffered() / static_cast<float>(RING_SIZE) );
+      if( voice_urgency > urgency )
+      {
+        urgency = voice_urgency;
+      }
+    }
+  }
+
+  return urgency;
+}
+
+SD_SAMPLE_PLAYER::VOICE* SD_SAMPLE_PLAYER::allocate_voice()
+{
+  // use a free voice, otherwise steal the oldest
+  VOICE* oldest = &m_voices[0];
+  for( int v = 0; v < NUM_VOICES; ++v )
+  {
+    VOICE& voice = m_voices[v];
+    if( !voice.m_active )
+    {
+      stop_voice( voice );
+      return &voice;
+    }
+
+    if( voice.m_start_time_ms < oldest->m_start_time_ms )
+    {
+      oldest = &voice;
+    }
+  }
+
+  stop_voice( *oldest );
+  return oldest;
+}
+
+void SD_SAMPLE_PLAYER::stop_voice( VOICE& voice )
+{
+  AudioNoInterrupts();
+  voice.m_active = false;
+  AudioInterrupts();
+
+  // the read in flight is writing into the ring through the file, so has to finish first
+  if( voice.m_read_request != SD_ASYNC_IO::INVALID_REQUEST )
+  {
+    m_sd_io.wait( voice.m_read_request );
+    voice.m_read_request = SD_ASYNC_IO::INVALID_REQUEST;
+  }
+
+  if( voice.m_file )
+  {
+    voice.m_file.close();
+  }
+}
+
+bool SD_SAMPLE_PLAYER::submit_read_sd( VOICE& voice )
+{
+  if( voice.m_read_request != SD_ASYNC_IO::INVALID_REQUEST || voice.m_file_finished || voice.space() < READ_SIZE )
+  {
+    return false;
+  }
+
+  // write position is always a multiple of READ_SIZE, so the read is contiguous in the ring
+  int16_t* dest         = voice.m_ring + ( voice.m_write_pos & ( RING_SIZE - 1 ) );
+  voice.m_read_size     = min_val<uint32_t>( READ_SIZE * sizeof(int16_t), voice.m_data_remaining );
+  voice.m_read_request  = m_sd_io.submit_read( voice.m_file, SD_ASYNC_IO::CURRENT_POSITION, dest, voice.m_read_size );
+
+  return voice.m_read_request != SD_ASYNC_IO::INVALID_REQUEST;
+}
+
+void SD_SAMPLE_PLAYER::collect_read_sd( VOICE& voice, int32_t bytes_read )
+{
+  voice.m_read_request  = SD_ASYNC_IO::INVALID_REQUEST;
+
+  // a failed read ends the sample
+  const uint32_t n      = bytes_read > 0 ? bytes_read : 0;
+  int16_t* dest         = voice.m_ring + ( voice.m_write_pos & ( RING_SIZE - 1 ) );
+
+  voice.m_data_remaining -= n;
+
+  // pad the final read with silence to keep the write position aligned
+  for( int s = n / sizeof(int16_t); s < READ_SIZE; ++s )
+  {
+    dest[s] = 0;
+  }
+
+  if( n < voice.m_read_size || voice.m_data_remaining == 0 )
+  {
+    // only make the final partial read available to the interrupt
+    voice.m_write_pos     += n / sizeof(int16_t);
+    voice.m_file_finished = true;
+  }
+  else
+  {
+    voice.m_write_pos     += READ_SIZE;
+  }
+}
+
+SD_SAMPLE_PLAYER::VOICE* SD_SAMPLE_PLAYER::most_urgent_voice()
+{
+  // earliest deadline first - all voices play at the same rate, so the voice with the least buffered audio is due soonest
+  VOICE* most_urgent = nullptr;
+  for( int v = 0; v < NUM_VOICES; ++v )
+  {
+    VOICE& voice = m_voices[v];
+    if( voice.m_active && !voice.m_file_finished && voice.m_read_request == SD_ASYNC_IO::INVALID_REQUEST && voice.space() >= READ_SIZE )
+    {
+      if( most_urgent == nullptr || voice.buffered() < most_urgent->buffered() )
+      {
+        most_urgent = &voice;
+      }
+    }
+  }
+
+  return most_urgent;
+}
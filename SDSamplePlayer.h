@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Audio.h>
+#include "SDAsyncIO.h"
+#include "WavFormat.h"
+
+// Plays up to NUM_VOICES samples from the SD card simultaneously.
+// Each voice streams into its own read-ahead ring, which the audio interrupt mixes from.
+// The rings are refilled in update_main_loop() by a deadline scheduler - the voice with the least audio buffered
+// is serviced first, with large sequential reads, rather than interleaving small reads from every voice.
+// The reads go through SD_ASYNC_IO, so an update only transfers a bounded number of sectors.
+// Samples play at the looper's sample rate without resampling, so files at other rates are rejected.
+
+class SD_SAMPLE_PLAYER : public AudioStream
+{
+public:
+
+  static constexpr const int NUM_VOICES             = 4;
+  static constexpr const int RING_SIZE              = 2048;   // samples per voice, must be a multiple of READ_SIZE
+  static constexpr const int READ_SIZE              = 512;    // samples per SD read (2 sectors)
+  static constexpr const int MAX_READS_PER_UPDATE   = 2;      // submitted per update, SD_ASYNC_IO transfers them a few sectors at a time
+  static constexpr const uint32_t MAX_SAMPLE_RATE_ERROR = 50; // Hz, accepts 44.1kHz files, which play under a cent sharp
+
+  SD_SAMPLE_PLAYER();
+
+  virtual void        update() override;
+
+  void                update_main_loop();    // this is called outside the audio library update() which is interrupt driven
+                                             // the relatively slow SD operations should be performed here
+
+  bool                play( const char* filename );
+  void                stop_all();
+
+  int                 num_active_voices() const;
+  uint32_t            num_underruns() const;
+  float               sd_urgency() const;    // 0..1, how close the emptiest ring is to running dry
+
+private:
+
+  struct VOICE
+  {
+    File              m_file;
+    uint32_t          m_data_remaining      = 0;          // bytes left to read from the file
+    int               m_read_request        = SD_ASYNC_IO::INVALID_REQUEST;   // the read in flight into the ring
+    uint32_t          m_read_size           = 0;          // bytes
+    uint32_t          m_start_time_ms       = 0;
+    volatile uint32_t m_write_pos           = 0;          // total samples written into the ring (main loop)
+    volatile uint32_t m_read_pos            = 0;          // total samples read from the ring (interrupt)
+    volatile bool     m_active              = false;      // the interrupt is playing this voice
+    volatile bool     m_file_finished       = false;      // all the data has been read into the ring
+    int16_t           m_ring[RING_SIZE];
+
+    uint32_t          buffered() const      { return m_write_pos - m_read_pos; }
+    uint32_t          space() const         { return RING_SIZE - buffered(); }
+  };
+
+  VOICE               m_voices[NUM_VOICES];
+  volatile uint32_t   m_num_underruns;
+
+  SD_ASYNC_IO         m_sd_io;
+
+  VOICE*              allocate_voice();
+  void                stop_voice( VOICE& voice );
+  bool                submit_read_sd( VOICE& voice );
+  void                collect_read_sd( VOICE& voice, int32_t bytes_read );
+  VOICE*              most_urgent_voice();
+};
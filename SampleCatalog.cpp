@@ -0,0 +1,462 @@
+#include <algorithm>
+
+#include "SampleCatalog.h"
+#include "Util.h"
+
+constexpr const uint32_t INDEX_MAGIC    = 0x58444953; // "SIDX"
+constexpr const uint16_t INDEX_VERSION  = 3;
+
+SAMPLE_CATALOG::SAMPLE_CATALOG() :
+  m_entries(),
+  m_directories(),
+  m_arena(),
+  m_num_entries(0),
+  m_num_directories(0),
+  m_arena_used(0),
+  m_load_state(LOAD_STATE::IDLE),
+  m_index_filename(nullptr),
+  m_excluded_directory(nullptr),
+  m_directories_checked(0),
+  m_check_dir(),
+  m_check_signature(),
+  m_scan_stack(),
+  m_scan_path_lengths(),
+  m_scan_depth(0),
+  m_scan_path()
+{
+
+}
+
+bool SAMPLE_CATALOG::load( const char* index_filename, const char* excluded_directory )
+{
+  begin_load( index_filename, excluded_directory );
+
+  while( !update_load() )
+  {
+  }
+
+  return m_num_entries > 0;
+}
+
+void SAMPLE_CATALOG::begin_load( const char* index_filename, const char* excluded_directory )
+{
+  m_index_filename      = index_filename;
+  m_excluded_directory  = excluded_directory;
+  m_load_state          = LOAD_STATE::READ_INDEX;
+}
+
+bool SAMPLE_CATALOG::update_load()
+{
+  switch( m_load_state )
+  {
+    case LOAD_STATE::READ_INDEX:
+    {
+      if( read_index( m_index_filename ) )
+      {
+        m_directories_checked = 0;
+        m_load_state          = LOAD_STATE::CHECK_DIRECTORIES;
+      }
+      else
+      {
+        begin_rebuild();
+      }
+      break;
+    }
+    case LOAD_STATE::CHECK_DIRECTORIES:
+    {
+      if( m_directories_checked == m_num_directories )
+      {
+        DEBUG_TEXT( "SAMPLE_CATALOG loaded index, samples:" );
+        DEBUG_TEXT_LINE( m_num_entries );
+        m_load_state = LOAD_STATE::LOADED;
+      }
+      else if( update_directory_signature() )
+      {
+        const DIRECTORY& directory  = m_directories[m_directories_checked];
+        const bool unchanged        = m_check_signature.m_size > 0 &&
+                                      m_check_signature.m_size == directory.m_size &&
+                                      m_check_signature.m_signature == directory.m_signature;
+        if( unchanged )
+        {
+          ++m_directories_checked;
+        }
+        else
+        {
+          DEBUG_TEXT( "SAMPLE_CATALOG directory changed:" );
+          DEBUG_TEXT_LINE( m_arena + directory.m_path );
+          begin_rebuild();
+        }
+      }
+      break;
+    }
+    case LOAD_STATE::SCAN:
+    {
+      if( update_scan() )
+      {
+        sort();
+
+        DEBUG_TEXT( "SAMPLE_CATALOG rebuilt, samples:" );
+        DEBUG_TEXT_LINE( m_num_entries );
+
+        m_directories_checked = 0;
+        m_load_state          = LOAD_STATE::SIGN_DIRECTORIES;
+      }
+      break;
+    }
+    case LOAD_STATE::SIGN_DIRECTORIES:
+    {
+      // signed once the scan has finished, the same way they're checked
+      if( m_directories_checked == m_num_directories )
+      {
+        m_load_state = LOAD_STATE::WRITE_INDEX;
+      }
+      else if( update_directory_signature() )
+      {
+        DIRECTORY& directory    = m_directories[m_directories_checked++];
+        directory.m_size        = m_check_signature.m_size;
+        directory.m_signature   = m_check_signature.m_signature;
+      }
+      break;
+    }
+    case LOAD_STATE::WRITE_INDEX:
+    {
+      write_index( m_index_filename );
+      m_load_state = LOAD_STATE::LOADED;
+      break;
+    }
+    case LOAD_STATE::IDLE:
+    case LOAD_STATE::LOADED:
+    {
+      break;
+    }
+  }
+
+  return m_load_state == LOAD_STATE::LOADED || m_load_state == LOAD_STATE::IDLE;
+}
+
+void SAMPLE_CATALOG::begin_rebuild()
+{
+  DEBUG_TEXT_LINE( "SAMPLE_CATALOG::begin_rebuild()" );
+
+  clear();
+
+  if( m_check_dir.isOpen() )
+  {
+    m_check_dir.close();
+  }
+
+  File root = SD.open( "/" );
+  if( !root )
+  {
+    m_load_state = LOAD_STATE::IDLE;
+    return;
+  }
+
+  strcpy( m_scan_path, "/" );
+  push_scan_directory( root, 1 );
+
+  m_load_state = LOAD_STATE::SCAN;
+}
+
+bool SAMPLE_CATALOG::loaded() const
+{
+  return m_load_state == LOAD_STATE::LOADED;
+}
+
+int SAMPLE_CATALOG::size() const
+{
+  return m_num_entries;
+}
+
+const char* SAMPLE_CATALOG::path( int index ) const
+{
+  ASSERT_MSG( index >= 0 && index < m_num_entries, "SAMPLE_CATALOG::path() index out of range" );
+  return m_arena + m_entries[index];
+}
+
+int SAMPLE_CATALOG::find( const char* path ) const
+{
+  int low   = 0;
+  int high  = m_num_entries - 1;
+
+  while( low <= high )
+  {
+    const int mid = ( low + high ) / 2;
+    const int cmp = strcasecmp( m_arena + m_entries[mid], path );
+
+    if( cmp == 0 )
+    {
+      return mid;
+    }
+    else if( cmp < 0 )
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid - 1;
+    }
+  }
+
+  return -1;
+}
+
+bool SAMPLE_CATALOG::is_sample_file( const char* filename )
+{
+  auto has_file_extension = [filename]( const char* file_ext )
+  {
+    const int filename_length = strlen( filename );
+    const int file_ext_length = strlen( file_ext );
+
+    return filename_length > file_ext_length && strcasecmp( filename + filename_length - file_ext_length, file_ext ) == 0;
+  };
+
+  return has_file_extension( ".WAV" ) || has_file_extension( ".RAW" );
+}
+
+void SAMPLE_CATALOG::clear()
+{
+  m_num_entries     = 0;
+  m_num_directories = 0;
+  m_arena_used      = 0;
+}
+
+int SAMPLE_CATALOG::add_string( const char* str )
+{
+  const int length = strlen( str ) + 1;
+  if( m_arena_used + length > ARENA_SIZE )
+  {
+    DEBUG_TEXT_LINE( "SAMPLE_CATALOG::add_string() arena full" );
+    return -1;
+  }
+
+  const int offset = m_arena_used;
+  memcpy( m_arena + offset, str, length );
+  m_arena_used += length;
+
+  return offset;
+}
+
+void SAMPLE_CATALOG::push_scan_directory( File& dir, int path_length )
+{
+  if( m_num_directories < MAX_DIRECTORIES )
+  {
+    const int path_offset = add_string( m_scan_path );
+    if( path_offset >= 0 )
+    {
+      DIRECTORY& directory  = m_directories[m_num_directories++];
+      directory.m_path      = path_offset;
+      directory.m_size      = 0;
+      directory.m_signature = 0;
+    }
+  }
+
+  m_scan_stack[m_scan_depth]        = dir;
+  m_scan_path_lengths[m_scan_depth] = path_length;
+  ++m_scan_depth;
+}
+
+bool SAMPLE_CATALOG::update_scan()
+{
+  for( int e = 0; e < ENTRIES_PER_UPDATE && m_scan_depth > 0; ++e )
+  {
+    File& dir             = m_scan_stack[m_scan_depth - 1];
+    const int path_length = m_scan_path_lengths[m_scan_depth - 1];
+
+    File entry = dir.openNextFile();
+    if( !entry )
+    {
+      // finished this directory, return to the parent
+      dir.close();
+      --m_scan_depth;
+      if( m_scan_depth > 0 )
+      {
+        m_scan_path[ m_scan_path_lengths[m_scan_depth - 1] ] = '\0';
+      }
+      continue;
+    }
+
+    const char* name        = entry.name();
+    const int name_length   = strlen( name );
+    if( name[0] == '.' || path_length + name_length + 2 > MAX_PATH_LENGTH )
+    {
+      // skip hidden files (e.g. macOS metadata) and paths which won't fit
+      entry.close();
+      continue;
+    }
+
+    memcpy( m_scan_path + path_length, name, name_length + 1 );
+
+    if( entry.isDirectory() )
+    {
+      // the looper's own files aren't samples
+      const bool excluded = m_excluded_directory != nullptr && strcasecmp( m_scan_path, m_excluded_directory ) == 0;
+      if( !excluded && m_scan_depth < MAX_DEPTH )
+      {
+        m_scan_path[path_length + name_length]     = '/';
+        m_scan_path[path_length + name_length + 1] = '\0';
+        push_scan_directory( entry, path_length + name_length + 1 );
+        continue;
+      }
+    }
+    else if( is_sample_file( name ) && m_num_entries < MAX_ENTRIES )
+    {
+      const int path_offset = add_string( m_scan_path );
+      if( path_offset >= 0 )
+      {
+        m_entries[m_num_entries++] = path_offset;
+      }
+    }
+
+    m_scan_path[path_length] = '\0';
+    entry.close();
+  }
+
+  return m_scan_depth == 0;
+}
+
+void SAMPLE_CATALOG::sort()
+{
+  std::sort( m_entries, m_entries + m_num_entries, [this]( uint16_t e1, uint16_t e2 )
+  {
+    return strcasecmp( m_arena + e1, m_arena + e2 ) < 0;
+  } );
+}
+
+bool SAMPLE_CATALOG::read_index( const char* index_filename )
+{
+  File index_file = SD.open( index_filename );
+  if( !index_file )
+  {
+    return false;
+  }
+
+  INDEX_HEADER header;
+  bool valid = index_file.read( &header, sizeof(header) ) == sizeof(header) &&
+               header.m_magic == INDEX_MAGIC &&
+               header.m_version == INDEX_VERSION &&
+               header.m_num_entries <= MAX_ENTRIES &&
+               header.m_num_directories <= MAX_DIRECTORIES &&
+               header.m_arena_used <= ARENA_SIZE;
+
+  if( valid )
+  {
+    // read each table in one go - this is what makes the index faster than walking the directories
+    const uint32_t entries_size     = header.m_num_entries * sizeof(m_entries[0]);
+    const uint32_t directories_size = header.m_num_directories * sizeof(m_directories[0]);
+
+    valid = index_file.read( m_entries, entries_size ) == entries_size &&
+            index_file.read( m_directories, directories_size ) == directories_size &&
+            index_file.read( m_arena, header.m_arena_used ) == header.m_arena_used;
+  }
+
+  // every path must start and end inside the arena, so a corrupt index can't read past it
+  for( int e = 0; valid && e < header.m_num_entries; ++e )
+  {
+    valid = valid_string( m_entries[e], header.m_arena_used );
+  }
+  for( int d = 0; valid && d < header.m_num_directories; ++d )
+  {
+    valid = valid_string( m_directories[d].m_path, header.m_arena_used );
+  }
+
+  index_file.close();
+
+  if( valid )
+  {
+    m_num_entries     = header.m_num_entries;
+    m_num_directories = header.m_num_directories;
+    m_arena_used      = header.m_arena_used;
+  }
+  else
+  {
+    DEBUG_TEXT_LINE( "SAMPLE_CATALOG::read_index() invalid index" );
+    clear();
+  }
+
+  return valid;
+}
+
+bool SAMPLE_CATALOG::write_index( const char* index_filename ) const
+{
+  if( SD.exists( index_filename ) )
+  {
+    // delete previously existing file (SD library will append to the end)
+    SD.remove( index_filename );
+  }
+
+  File index_file = SD.open( index_filename, FILE_WRITE );
+  if( !index_file )
+  {
+    DEBUG_TEXT( "Unable to open file: " );
+    DEBUG_TEXT_LINE( index_filename );
+    return false;
+  }
+
+  INDEX_HEADER header;
+  header.m_magic            = INDEX_MAGIC;
+  header.m_version          = INDEX_VERSION;
+  header.m_num_entries      = m_num_entries;
+  header.m_num_directories  = m_num_directories;
+  header.m_arena_used       = m_arena_used;
+
+  index_file.write( &header, sizeof(header) );
+  index_file.write( m_entries, m_num_entries * sizeof(m_entries[0]) );
+  index_file.write( m_directories, m_num_directories * sizeof(m_directories[0]) );
+  index_file.write( m_arena, m_arena_used );
+  index_file.close();
+
+  return true;
+}
+
+bool SAMPLE_CATALOG::valid_string( uint16_t offset, uint16_t arena_used ) const
+{
+  return offset < arena_used && memchr( m_arena + offset, '\0', arena_used - offset ) != nullptr;
+}
+
+bool SAMPLE_CATALOG::update_directory_signature()
+{
+  // FNV-1a over the raw entry data, which holds every entry's name, size, times and first cluster - reading it by the
+  // sector costs far less than opening each entry, but still grows with the directory, so a few sectors per update
+  constexpr const uint32_t FNV_OFFSET = 2166136261u;
+  constexpr const uint32_t FNV_PRIME  = 16777619;
+
+  if( !m_check_dir.isOpen() )
+  {
+    m_check_signature.m_size      = 0;
+    m_check_signature.m_signature = FNV_OFFSET;
+
+    m_check_dir = SD.sdfs.open( m_arena + m_directories[m_directories_checked].m_path, O_RDONLY );
+    if( !m_check_dir.isOpen() )
+    {
+      return true;
+    }
+    if( !m_check_dir.isDir() )
+    {
+      m_check_dir.close();
+      return true;
+    }
+  }
+
+  uint8_t sector[SECTOR_SIZE];
+  for( int s = 0; s < SECTORS_PER_UPDATE; ++s )
+  {
+    const int bytes_read = m_check_dir.read( sector, SECTOR_SIZE );
+    if( bytes_read <= 0 )
+    {
+      m_check_dir.close();
+      return true;
+    }
+
+    uint32_t hash = m_check_signature.m_signature;
+    for( int b = 0; b < bytes_read; ++b )
+    {
+      hash = ( hash ^ sector[b] ) * FNV_PRIME;
+    }
+
+    m_check_signature.m_signature = hash;
+    m_check_signature.m_size      += bytes_read;
+  }
+
+  return false;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <SD.h>
+
+// Sorted list of every sample (.WAV/.RAW) on the SD card, stored in a fixed arena to avoid heap fragmentation.
+// The catalog is persisted to an index file, and only rebuilt when one of the catalogued directories has changed.
+// FAT doesn't update a directory's modify time when files are added or replaced, so each directory keeps the size and
+// a hash of its raw entry data instead - read a sector at a time, without opening any of the entries.
+// The looper's own directory (loops, sequence and the index itself) is excluded, so recording doesn't stale the index.
+// Loading can be done incrementally (begin_load()/update_load()) so it can be spread across the main loop.
+
+class SAMPLE_CATALOG
+{
+public:
+
+  static constexpr const int      MAX_ENTRIES         = 512;
+  static constexpr const int      MAX_DIRECTORIES     = 32;
+  static constexpr const int      ARENA_SIZE          = 12 * 1024;
+  static constexpr const int      MAX_PATH_LENGTH     = 128;
+  static constexpr const int      MAX_DEPTH           = 4;
+  static constexpr const int      ENTRIES_PER_UPDATE  = 8;
+  static constexpr const int      SECTOR_SIZE         = 512;
+  static constexpr const int      SECTORS_PER_UPDATE  = 4;
+
+  SAMPLE_CATALOG();
+
+  // the excluded directory isn't catalogued, and should hold the index file
+  bool                load( const char* index_filename, const char* excluded_directory );   // load the index, or rebuild it if stale (blocking)
+
+  void                begin_load( const char* index_filename, const char* excluded_directory );
+  bool                update_load();                         // perform a small amount of work, returns true when loaded
+  void                begin_rebuild();
+  bool                loaded() const;
+
+  int                 size() const;
+  const char*         path( int index ) const;
+  int                 find( const char* path ) const;       // binary search, -1 if not found
+
+  static bool         is_sample_file( const char* filename );
+
+private:
+
+  enum class LOAD_STATE
+  {
+    IDLE,
+    READ_INDEX,
+    CHECK_DIRECTORIES,
+    SCAN,
+    SIGN_DIRECTORIES,
+    WRITE_INDEX,
+    LOADED,
+  };
+
+  struct DIRECTORY
+  {
+    uint16_t          m_path;                 // offset into the arena
+    uint32_t          m_size;                 // bytes of raw entry data, 0 if the directory couldn't be read
+    uint32_t          m_signature;            // hash of the raw entry data
+  };
+
+  struct INDEX_HEADER
+  {
+    uint32_t          m_magic;
+    uint16_t          m_version;
+    uint16_t          m_num_entries;
+    uint16_t          m_num_directories;
+    uint16_t          m_arena_used;
+  };
+
+  uint16_t            m_entries[MAX_ENTRIES];         // offsets into the arena, sorted by path
+  DIRECTORY           m_directories[MAX_DIRECTORIES];
+  char                m_arena[ARENA_SIZE];
+
+  uint16_t            m_num_entries;
+  uint16_t            m_num_directories;
+  uint16_t            m_arena_used;
+
+  LOAD_STATE          m_load_state;
+  const char*         m_index_filename;
+  const char*         m_excluded_directory;
+  int                 m_directories_checked;
+  FsFile              m_check_dir;                    // the directory being signed, read over several updates
+  DIRECTORY           m_check_signature;
+
+  // directory walk state - a stack of open directories rather than recursion, so the scan can be suspended
+  File                m_scan_stack[MAX_DEPTH];
+  uint8_t             m_scan_path_lengths[MAX_DEPTH];
+  int                 m_scan_depth;
+  char                m_scan_path[MAX_PATH_LENGTH];
+
+  void                clear();
+  int                 add_string( const char* str );
+  void                push_scan_directory( File& dir, int path_length );
+  bool                update_scan();
+  void                sort();
+
+  bool                read_index( const char* index_filename );
+  bool                write_index( const char* index_filename ) const;
+  bool                valid_string( uint16_t offset, uint16_t arena_used ) const;
+  bool                update_directory_signature();   // signs m_directories[m_directories_checked], returns true once read
+};
@@ -0,0 +1,156 @@
+#include "Scheduler.h"
+#include "Util.h"
+
+SCHEDULER::SCHEDULER() :
+  m_tasks(),
+  m_num_tasks(0)
+{
+
+}
+
+SCHEDULER::TASK* SCHEDULER::add_task( const char* name, TASK_FUNCTION function )
+{
+  ASSERT_MSG( m_num_tasks < MAX_TASKS, "SCHEDULER::add_task() too many tasks" );
+  if( m_num_tasks >= MAX_TASKS )
+  {
+    return nullptr;
+  }
+
+  TASK& task      = m_tasks[m_num_tasks++];
+  task            = TASK();
+  task.m_name     = name;
+  task.m_function = function;
+  return &task;
+}
+
+bool SCHEDULER::add_periodic_task( const char* name, TASK_FUNCTION function, uint32_t period_us )
+{
+  ASSERT_MSG( period_us > 0, "SCHEDULER::add_periodic_task() zero period" );
+
+  TASK* task = add_task( name, function );
+  if( task == nullptr )
+  {
+    return false;
+  }
+
+  task->m_period_us   = period_us;
+  task->m_next_run_us = micros();
+  return true;
+}
+
+bool SCHEDULER::add_deadline_task( const char* name, TASK_FUNCTION function, URGENCY_FUNCTION urgency )
+{
+  TASK* task = add_task( name, function );
+  if( task == nullptr )
+  {
+    return false;
+  }
+
+  task->m_urgency = urgency;
+  return true;
+}
+
+float SCHEDULER::priority( const TASK& task, uint32_t time_us ) const
+{
+  if( task.m_urgency != nullptr )
+  {
+    return clamp( task.m_urgency(), 0.0f, 1.0f ) * URGENCY_PRIORITY_SCALE;
+  }
+
+  const int32_t late_us = static_cast<int32_t>( time_us - task.m_next_run_us );
+  if( late_us < 0 )
+  {
+    return -1.0f;
+  }
+
+  // a due periodic task outranks an idle deadline task
+  return 1.0f + ( late_us / static_cast<float>(task.m_period_us) );
+}
+
+void SCHEDULER::update()
+{
+  const uint32_t time_us  = micros();
+
+  TASK* most_urgent       = nullptr;
+  float highest_priority  = 0.0f;
+  for( int t = 0; t < m_num_tasks; ++t )
+  {
+    const float p = priority( m_tasks[t], time_us );
+    if( p >= 0.0f && ( most_urgent == nullptr || p > highest_priority ) )
+    {
+      most_urgent       = &m_tasks[t];
+      highest_priority  = p;
+    }
+  }
+
+  if( most_urgent != nullptr )
+  {
+    run_task( *most_urgent, time_us );
+  }
+}
+
+void SCHEDULER::run_task( TASK& task, uint32_t time_us )
+{
+  if( task.m_urgency == nullptr )
+  {
+    const uint32_t late_us  = time_us - task.m_next_run_us;
+    if( late_us > task.m_max_late_us )
+    {
+      task.m_max_late_us = late_us;
+    }
+
+    // keep to the period, but don't try to catch up with runs missed by more than a period
+    task.m_next_run_us += task.m_period_us;
+    if( late_us >= task.m_period_us )
+    {
+      task.m_next_run_us = time_us + task.m_period_us;
+    }
+  }
+
+  task.m_function( millis() );
+
+  const uint32_t run_us = micros() - time_us;
+  ++task.m_num_runs;
+  task.m_total_run_us += run_us;
+  if( run_us > task.m_max_run_us )
+  {
+    task.m_max_run_us = run_us;
+  }
+}
+
+void SCHEDULER::print_stats() const
+{
+  for( int t = 0; t < m_num_tasks; ++t )
+  {
+    const TASK& task = m_tasks[t];
+
+    DEBUG_TEXT( task.m_name );
+    DEBUG_TEXT( " runs:" );
+    DEBUG_TEXT( task.m_num_runs );
+    DEBUG_TEXT( " avg:" );
+    DEBUG_TEXT( task.m_num_runs > 0 ? task.m_total_run_us / task.m_num_runs : 0 );
+    DEBUG_TEXT( "us max:" );
+    DEBUG_TEXT( task.m_max_run_us );
+    DEBUG_TEXT( "us max late:" );
+    DEBUG_TEXT( task.m_max_late_us );
+    DEBUG_TEXT_LINE( "us" );
+  }
+}
+
+void SCHEDULER::reset_stats()
+{
+  for( int t = 0; t < m_num_tasks; ++t )
+  {
+    TASK& task            = m_tasks[t];
+    task.m_num_runs       = 0;
+    task.m_total_run_us   = 0;
+    task.m_max_run_us     = 0;
+    task.m_max_late_us    = 0;
+  }
+}
+
+float SCHEDULER::refill_urgency( int queued, int refill_target )
+{
+  ASSERT_MSG( refill_target > 0, "SCHEDULER::refill_urgency() zero refill target" );
+  return clamp( 1.0f - ( queued / static_cast<float>(refill_target) ), 0.0f, 1.0f );
+}
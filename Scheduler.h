@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+// Cooperative scheduler for the main loop. Each update() runs the single most urgent task which is due, so a slow
+// task only delays the others by its own run time, rather than every job running in a fixed sequence each loop.
+// Periodic tasks become more urgent the later they run. Deadline tasks are always due, with an urgency (0..1) reported
+// by the task - e.g. how close an SD queue is to running dry - so they pre-empt periodic tasks as their deadline nears.
+
+class SCHEDULER
+{
+public:
+
+  static constexpr const int    MAX_TASKS               = 8;
+  static constexpr const float  URGENCY_PRIORITY_SCALE  = 4.0f;   // a fully urgent deadline task beats a periodic task up to 3 periods late
+
+  using TASK_FUNCTION     = void (*)( uint32_t time_ms );
+  using URGENCY_FUNCTION  = float (*)();
+
+  SCHEDULER();
+
+  bool                add_periodic_task( const char* name, TASK_FUNCTION function, uint32_t period_us );
+  bool                add_deadline_task( const char* name, TASK_FUNCTION function, URGENCY_FUNCTION urgency );
+
+  void                update();
+
+  void                print_stats() const;
+  void                reset_stats();
+
+  // urgency of a queue the audio interrupt drains and a deadline task refills - 0 at the task's refill target, 1 when empty
+  static float        refill_urgency( int queued, int refill_target );
+
+private:
+
+  struct TASK
+  {
+    const char*       m_name          = nullptr;
+    TASK_FUNCTION     m_function      = nullptr;
+    URGENCY_FUNCTION  m_urgency       = nullptr;  // deadline tasks only
+    uint32_t          m_period_us     = 0;        // periodic tasks only
+    uint32_t          m_next_run_us   = 0;
+
+    // stats
+    uint32_t          m_num_runs      = 0;
+    uint32_t          m_total_run_us  = 0;
+    uint32_t          m_max_run_us    = 0;
+    uint32_t          m_max_late_us   = 0;        // periodic tasks, how long after the due time they ran
+  };
+
+  TASK                m_tasks[MAX_TASKS];
+  int                 m_num_tasks;
+
+  TASK*               add_task( const char* name, TASK_FUNCTION function );
+  float               priority( const TASK& task, uint32_t time_us ) const;   // negative when not due
+  void                run_task( TASK& task, uint32_t time_us );
+};
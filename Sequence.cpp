@@ -0,0 +1,193 @@
+#include "Sequence.h"
+#include "Util.h"
+
+SEQUENCE::SEQUENCE() :
+  m_data(),
+  m_data_size(0),
+  m_num_events(0)
+{
+
+}
+
+bool SEQUENCE::add_event( uint32_t position, int cue )
+{
+  ASSERT_MSG( cue >= 0 && cue < MAX_CUES, "SEQUENCE::add_event() invalid cue" );
+
+  const CURSOR cursor = first_event_from( position );
+
+  uint8_t encoded[MAX_EVENT_SIZE * 2];
+  int encoded_size    = encode( position - cursor.m_position, cue, encoded );
+  int replaced_size   = 0;
+
+  if( !at_end( cursor ) )
+  {
+    EVENT next;
+    replaced_size = decode( cursor, next );
+
+    if( next.m_position == position )
+    {
+      // the cue is in the low bits of the first byte, so the size doesn't change
+      m_data[cursor.m_offset] = ( m_data[cursor.m_offset] & ~( MAX_CUES - 1 ) ) | cue;
+      return true;
+    }
+
+    // the following event is now coded relative to the new one
+    encoded_size += encode( next.m_position - position, next.m_cue, encoded + encoded_size );
+  }
+
+  const int new_data_size = m_data_size + encoded_size - replaced_size;
+  if( new_data_size > MAX_DATA_SIZE )
+  {
+    return false;
+  }
+
+  const int tail_offset = cursor.m_offset + replaced_size;
+  memmove( m_data + cursor.m_offset + encoded_size, m_data + tail_offset, m_data_size - tail_offset );
+  memcpy( m_data + cursor.m_offset, encoded, encoded_size );
+
+  m_data_size = new_data_size;
+  ++m_num_events;
+
+  return true;
+}
+
+void SEQUENCE::clear()
+{
+  m_data_size   = 0;
+  m_num_events  = 0;
+}
+
+int SEQUENCE::num_events() const
+{
+  return m_num_events;
+}
+
+bool SEQUENCE::empty() const
+{
+  return m_num_events == 0;
+}
+
+bool SEQUENCE::at_end( const CURSOR& cursor ) const
+{
+  return cursor.m_offset >= m_data_size;
+}
+
+SEQUENCE::EVENT SEQUENCE::peek_event( const CURSOR& cursor ) const
+{
+  EVENT event;
+  decode( cursor, event );
+  return event;
+}
+
+SEQUENCE::EVENT SEQUENCE::next_event( CURSOR& cursor ) const
+{
+  EVENT event;
+  cursor.m_offset   += decode( cursor, event );
+  cursor.m_position = event.m_position;
+  return event;
+}
+
+SEQUENCE::CURSOR SEQUENCE::first_event_from( uint32_t position ) const
+{
+  CURSOR cursor;
+  while( !at_end( cursor ) )
+  {
+    EVENT event;
+    const int size = decode( cursor, event );
+    if( event.m_position >= position )
+    {
+      break;
+    }
+
+    cursor.m_offset   += size;
+    cursor.m_position = event.m_position;
+  }
+
+  return cursor;
+}
+
+const uint8_t* SEQUENCE::data() const
+{
+  return m_data;
+}
+
+int SEQUENCE::data_size() const
+{
+  return m_data_size;
+}
+
+bool SEQUENCE::set_data( const uint8_t* data, int size )
+{
+  clear();
+
+  if( size < 0 || size > MAX_DATA_SIZE )
+  {
+    return false;
+  }
+
+  memcpy( m_data, data, size );
+  m_data_size = size;
+
+  // count the events, checking every one decodes
+  int num_events = 0;
+  CURSOR cursor;
+  while( !at_end( cursor ) )
+  {
+    EVENT event;
+    const int event_size = decode( cursor, event );
+    if( event_size == 0 )
+    {
+      DEBUG_TEXT_LINE( "SEQUENCE::set_data() invalid data" );
+      clear();
+      return false;
+    }
+
+    cursor.m_offset   += event_size;
+    cursor.m_position = event.m_position;
+    ++num_events;
+  }
+
+  m_num_events = num_events;
+  return true;
+}
+
+int SEQUENCE::decode( const CURSOR& cursor, EVENT& event ) const
+{
+  uint32_t value  = 0;
+  int size        = 0;
+  uint8_t byte    = 0x80;
+
+  while( ( byte & 0x80 ) && size < MAX_EVENT_SIZE && cursor.m_offset + size < m_data_size )
+  {
+    byte    = m_data[cursor.m_offset + size];
+    value   |= static_cast<uint32_t>( byte & 0x7F ) << ( size * 7 );
+    ++size;
+  }
+
+  if( byte & 0x80 )
+  {
+    // truncated
+    return 0;
+  }
+
+  event.m_position  = cursor.m_position + ( value >> CUE_BITS );
+  event.m_cue       = value & ( MAX_CUES - 1 );
+  return size;
+}
+
+int SEQUENCE::encode( uint32_t delta, int cue, uint8_t* data )
+{
+  ASSERT_MSG( delta < ( 1u << ( 32 - CUE_BITS ) ), "SEQUENCE::encode() delta too large" );
+
+  uint32_t value  = ( delta << CUE_BITS ) | cue;
+  int size        = 0;
+  do
+  {
+    const uint8_t byte = value & 0x7F;
+    value >>= 7;
+    data[size++] = value != 0 ? ( byte | 0x80 ) : byte;
+  }
+  while( value != 0 );
+
+  return size;
+}
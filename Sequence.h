@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+// A pattern of cuts, each at a sample position relative to the start of the loop, kept in position order.
+// Events are delta coded from the previous event and packed as varints (7 bits per byte) with the cue in the low bits,
+// so an event a few seconds from the previous one takes 3 bytes rather than 8. Events are read sequentially with a CURSOR.
+// Events are added and dispatched from the audio interrupt, so the main loop must disable audio interrupts to modify it.
+
+class SEQUENCE
+{
+public:
+
+  static constexpr const int MAX_DATA_SIZE    = 256;
+  static constexpr const int CUE_BITS         = 3;
+  static constexpr const int MAX_CUES         = 1 << CUE_BITS;
+  static constexpr const int MAX_EVENT_SIZE   = 5;      // varint of a 32 bit value
+
+  struct EVENT
+  {
+    uint32_t          m_position    = 0;    // in samples from the start of the loop
+    int8_t            m_cue         = 0;    // segment to cut to
+  };
+
+  struct CURSOR
+  {
+    uint16_t          m_offset      = 0;    // into the data, of the next event
+    uint32_t          m_position    = 0;    // of the previous event, which the next is coded relative to
+  };
+
+  SEQUENCE();
+
+  bool                add_event( uint32_t position, int cue );   // replaces an event at the same position, false if full
+  void                clear();
+
+  int                 num_events() const;
+  bool                empty() const;
+
+  // events from the cursor onwards
+  bool                at_end( const CURSOR& cursor ) const;
+  EVENT               peek_event( const CURSOR& cursor ) const;
+  EVENT               next_event( CURSOR& cursor ) const;
+  CURSOR              first_event_from( uint32_t position ) const;  // cursor at the first event at or after position
+
+  // encoded form, for saving and loading
+  const uint8_t*      data() const;
+  int                 data_size() const;
+  bool                set_data( const uint8_t* data, int size );  // false (leaving it empty) if the data isn't a valid pattern
+
+private:
+
+  uint8_t             m_data[MAX_DATA_SIZE];
+  uint16_t            m_data_size;
+  uint16_t            m_num_events;
+
+  int                 decode( const CURSOR& cursor, EVENT& event ) const;  // returns the encoded size, 0 if malformed
+
+  static int          encode( uint32_t delta, int cue, uint8_t* data );  // returns the encoded size
+};
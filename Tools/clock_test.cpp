@@ -0,0 +1,270 @@
+// Host test of the CLOCK_INPUT phase locked loop, against simulated clock sources
+//
+// Build:   g++ -O2 -std=c++14 -Wall -Wextra -I host -o clock_test clock_test.cpp ../ClockInput.cpp ../Util.cpp
+// Usage:   clock_test
+//
+// Each edge sets the cycle counter to the time of the edge (plus the interrupt latency) and calls the pin interrupt,
+// then the main loop update() runs. Checks how many edges the loop takes to lock, and the error of the locked period
+// against the true period of the source. Returns non-zero if any check fails.
+
+#include <random>
+
+#include <Arduino.h>
+#include <Audio.h>
+#include "../ClockInput.h"
+#include "../Util.h"
+
+HOST_SERIAL Serial;
+
+uint32_t micros()
+{
+  return ARM_DWT_CYCCNT / ( F_CPU / 1000000 );
+}
+
+volatile uint32_t ARM_DEMCR       = 0;
+volatile uint32_t ARM_DWT_CTRL    = 0;
+volatile uint32_t ARM_DWT_CYCCNT  = 0;
+
+static constexpr const int CLOCK_PIN  = 1;
+static constexpr const int RESET_PIN  = 2;
+
+static void (*clock_isr)()  = nullptr;
+static void (*reset_isr)()  = nullptr;
+
+void pinMode( int /*pin*/, int /*mode*/ )
+{
+}
+
+void attachInterrupt( int interrupt, void (*function)(), int /*mode*/ )
+{
+  if( interrupt == CLOCK_PIN )
+  {
+    clock_isr = function;
+  }
+  else if( interrupt == RESET_PIN )
+  {
+    reset_isr = function;
+  }
+}
+
+//////////////////////////////////////
+
+static int num_failures = 0;
+
+#define CHECK(x) check( (x), #x, __LINE__ )
+
+static void check( bool ok, const char* expression, int line )
+{
+  if( !ok )
+  {
+    printf( "  FAILED line %d: %s\n", line, expression );
+    ++num_failures;
+  }
+}
+
+//////////////////////////////////////
+
+// a clock source, with the timing in seconds so the cycle counter wraps as it does on the hardware
+class CLOCK_SOURCE
+{
+public:
+
+  double                m_time            = 0.0;
+  double                m_period          = 0.0;      // seconds
+  double                m_drift           = 0.0;      // change in the period per edge
+  double                m_jitter          = 0.0;      // peak, seconds, of the source and the interrupt latency together
+  std::mt19937          m_random;
+
+  explicit CLOCK_SOURCE( double start_time ) :
+    m_time( start_time ),
+    m_random( 1234 )
+  {
+  }
+
+  static uint32_t cycles( double time )
+  {
+    return static_cast<uint32_t>( static_cast<uint64_t>( time * F_CPU ) );
+  }
+
+  // true period, in samples
+  float period_samples() const
+  {
+    return static_cast<float>( m_period * AUDIO_SAMPLE_RATE_EXACT );
+  }
+
+  // one edge, then the main loop update
+  void edge( CLOCK_INPUT& clock )
+  {
+    std::uniform_real_distribution<double> jitter( -m_jitter, m_jitter );
+
+    ARM_DWT_CYCCNT = cycles( m_time + jitter( m_random ) );
+    clock_isr();
+    clock.update();
+
+    m_time    += m_period;
+    m_period  += m_drift;
+  }
+
+  // no edges, the main loop keeps updating
+  void stop( CLOCK_INPUT& clock, double duration )
+  {
+    const double end_time = m_time + duration;
+    for( ; m_time < end_time; m_time += 0.001 )
+    {
+      ARM_DWT_CYCCNT = cycles( m_time );
+      clock.update();
+    }
+  }
+};
+
+// edges until the clock locks, or -1
+static int edges_to_lock( CLOCK_INPUT& clock, CLOCK_SOURCE& source, int max_edges )
+{
+  for( int e = 1; e <= max_edges; ++e )
+  {
+    source.edge( clock );
+    if( clock.locked() )
+    {
+      return e;
+    }
+  }
+  return -1;
+}
+
+static float period_error( const CLOCK_INPUT& clock, const CLOCK_SOURCE& source )
+{
+  return fabsf( clock.period_samples() - source.period_samples() ) / source.period_samples();
+}
+
+// worst period error, and whether the clock stayed locked, over a run of edges
+static float track( CLOCK_INPUT& clock, CLOCK_SOURCE& source, int num_edges, bool& stayed_locked )
+{
+  float max_error = 0.0f;
+  stayed_locked   = true;
+  for( int e = 0; e < num_edges; ++e )
+  {
+    source.edge( clock );
+    max_error     = max_val( max_error, period_error( clock, source ) );
+    stayed_locked = stayed_locked && clock.locked();
+  }
+  return max_error;
+}
+
+static void report( int lock_edges, float error )
+{
+  printf( "  lock edges: %d, period error: %.4f%%\n", lock_edges, error * 100.0f );
+}
+
+// the clock and source live across the scenarios, as the clock input does on the hardware
+static void test_steady( CLOCK_INPUT& clock, CLOCK_SOURCE& source )
+{
+  printf( "steady 24ppqn at 120bpm\n" );
+  source.m_period = 60.0 / ( 120.0 * 24.0 );
+
+  const int lock_edges = edges_to_lock( clock, source, 16 );
+  CHECK( lock_edges > 0 && lock_edges <= 8 );
+
+  bool stayed_locked  = false;
+  const float error   = track( clock, source, 100, stayed_locked );
+  report( lock_edges, error );
+  CHECK( stayed_locked );
+  CHECK( error < 0.001f );
+}
+
+static void test_stopped( CLOCK_INPUT& clock, CLOCK_SOURCE& source )
+{
+  printf( "stopped\n" );
+
+  source.stop( clock, source.m_period * CLOCK_INPUT::TIMEOUT_PERIODS + 0.01 );
+  CHECK( !clock.locked() );
+  CHECK( clock.period_samples() == 0.0f );
+}
+
+static void test_jitter( CLOCK_INPUT& clock, CLOCK_SOURCE& source )
+{
+  printf( "jittered, 4ppqn at 90bpm +-1ms\n" );
+  source.m_period = 60.0 / ( 90.0 * 4.0 );
+  source.m_jitter = 0.001;
+
+  const int lock_edges = edges_to_lock( clock, source, 32 );
+  CHECK( lock_edges > 0 && lock_edges <= 24 );
+
+  // the filter averages the jitter, so the period is much closer than any one interval
+  bool stayed_locked  = false;
+  const float error   = track( clock, source, 200, stayed_locked );
+  report( lock_edges, error );
+  CHECK( stayed_locked );
+  CHECK( error < 0.005f );
+
+  source.m_jitter = 0.0;
+}
+
+static void test_drift( CLOCK_INPUT& clock, CLOCK_SOURCE& source )
+{
+  printf( "drifting, 4ppqn from 90bpm down 2%% over 200 edges\n" );
+  source.m_drift = source.m_period * 0.02 / 200.0;
+
+  bool stayed_locked  = false;
+  const float error   = track( clock, source, 200, stayed_locked );
+  report( 0, error );
+  CHECK( stayed_locked );
+  CHECK( error < 0.002f );
+
+  source.m_drift = 0.0;
+}
+
+static void test_tempo_change( CLOCK_INPUT& clock, CLOCK_SOURCE& source )
+{
+  printf( "tempo change, 4ppqn to 120bpm\n" );
+  source.m_period = 60.0 / ( 120.0 * 4.0 );
+
+  // the next edge is still a period of the old tempo away, the one after it is early
+  source.edge( clock );
+  source.edge( clock );
+  CHECK( !clock.locked() );
+
+  const int lock_edges = edges_to_lock( clock, source, 16 );
+  CHECK( lock_edges > 0 && lock_edges <= 8 );
+
+  bool stayed_locked  = false;
+  const float error   = track( clock, source, 50, stayed_locked );
+  report( lock_edges, error );
+  CHECK( stayed_locked );
+  CHECK( error < 0.001f );
+}
+
+static void test_reset( CLOCK_INPUT& clock )
+{
+  printf( "reset\n" );
+
+  CHECK( !clock.reset_triggered() );
+  reset_isr();
+  CHECK( clock.reset_triggered() );
+  CHECK( !clock.reset_triggered() );
+}
+
+int main()
+{
+#ifdef DEBUG_OUTPUT
+  serial_port_initialised = true;
+#endif
+
+  CLOCK_INPUT clock;
+  clock.begin( CLOCK_PIN, RESET_PIN );
+  CHECK( clock_isr != nullptr && reset_isr != nullptr );
+  CHECK( ( ARM_DWT_CTRL & ARM_DWT_CTRL_CYCCNTENA ) != 0 );
+
+  // start a few seconds before the cycle counter wraps
+  CLOCK_SOURCE source( ( 0x100000000ull - 3ull * F_CPU ) / static_cast<double>( F_CPU ) );
+
+  test_steady( clock, source );
+  test_stopped( clock, source );
+  test_jitter( clock, source );
+  test_drift( clock, source );
+  test_tempo_change( clock, source );
+  test_stopped( clock, source );
+  test_reset( clock );
+
+  printf( num_failures == 0 ? "passed\n" : "%d checks failed\n", num_failures );
+  return num_failures == 0 ? 0 : 1;
+}
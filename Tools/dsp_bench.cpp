@@ -0,0 +1,31 @@
+// Host build of the DSP, output stage and queue kernel benchmarks in DSPBenchmark.cpp
+//
+// Build:   g++ -O2 -std=c++14 -Wall -Wextra -I host -o dsp_bench dsp_bench.cpp ../DSPBenchmark.cpp ../AudioOutputStage.cpp ../Util.cpp
+// Usage:   dsp_bench
+//
+// Times are in nanoseconds per 128 sample block. Set BENCHMARK_DSP in CompileSwitches.h for cycles on the Teensy.
+
+#include <chrono>
+
+#include <Arduino.h>
+#include "../DSPBenchmark.h"
+#include "../Util.h"
+
+HOST_SERIAL Serial;
+
+uint32_t micros()
+{
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint32_t>( std::chrono::duration_cast<std::chrono::microseconds>( now ).count() );
+}
+
+int main()
+{
+#ifdef DEBUG_OUTPUT
+  serial_port_initialised = true;
+#endif
+
+  DSP_BENCHMARK::run();
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+// Minimal stand-in for the Teensy core, enough to build the DSP kernels, I2C_ASYNC, CLOCK_INPUT, SCHEDULER, SD_ASYNC_IO and their host tests
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define HOST_BUILD
+
+#define HEX 16
+
+class HOST_SERIAL
+{
+public:
+
+  void print( const char* s )           { printf( "%s", s ); }
+  void print( int v )                   { printf( "%d", v ); }
+  void print( unsigned int v )          { printf( "%u", v ); }
+  void print( long v )                  { printf( "%ld", v ); }
+  void print( unsigned long v )         { printf( "%lu", v ); }
+  void print( double v )                { printf( "%.2f", v ); }
+
+  template< typename T >
+  void println( T v )                   { print( v ); printf( "\n" ); }
+  template< typename T >
+  void println( T v, int /*format*/ )   { println( v ); }
+};
+
+extern HOST_SERIAL Serial;
+
+uint32_t micros();
+uint32_t millis();
+
+#define F_CPU           180000000
+
+// cycle counter and pin interrupts, for CLOCK_INPUT - the test defines them, and drives the edges
+#define ARM_DEMCR_TRCENA        (1 << 24)
+#define ARM_DWT_CTRL_CYCCNTENA  1
+
+extern volatile uint32_t ARM_DEMCR;
+extern volatile uint32_t ARM_DWT_CTRL;
+extern volatile uint32_t ARM_DWT_CYCCNT;
+
+#define INPUT           0
+#define RISING          3
+
+#define digitalPinToInterrupt( pin ) ( pin )
+
+void pinMode( int pin, int mode );
+void attachInterrupt( int interrupt, void (*function)(), int mode );
+
+// I2C0, for I2C_ASYNC - the registers are defined by the test, which simulates the bus behind them
+#define I2C_C1_IICEN    0x80
+#define I2C_C1_IICIE    0x40
+#define I2C_C1_MST      0x20
+#define I2C_C1_TX       0x10
+#define I2C_C1_TXAK     0x08
+
+#define I2C_S_BUSY      0x20
+#define I2C_S_ARBL      0x10
+#define I2C_S_IICIF     0x02
+#define I2C_S_RXAK      0x01
+
+extern volatile uint8_t host_i2c0_c1;
+extern volatile uint8_t host_i2c0_s;
+extern volatile uint8_t host_i2c0_f;
+volatile uint8_t*       host_i2c0_d();    // every access is seen by the bus, reading D clocks in the next byte
+
+#define I2C0_C1         host_i2c0_c1
+#define I2C0_S          host_i2c0_s
+#define I2C0_F          host_i2c0_f
+#define I2C0_D          (*host_i2c0_d())
+
+#define IRQ_I2C0        0
+
+void attachInterruptVector( int irq, void (*function)() );
+void NVIC_ENABLE_IRQ( int irq );
+void NVIC_DISABLE_IRQ( int irq );
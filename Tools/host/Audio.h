@@ -0,0 +1,36 @@
+// Minimal stand-in for the Teensy Audio library, enough to build the DSP kernels and their benchmark on the host
+
+#pragma once
+
+#include <Arduino.h>
+
+#define AUDIO_BLOCK_SAMPLES     128
+#define AUDIO_SAMPLE_RATE_EXACT 44117.64706f
+
+struct audio_block_t
+{
+  uint8_t   ref_count;
+  uint8_t   reserved1;
+  uint16_t  memory_pool_index;
+  int16_t   data[AUDIO_BLOCK_SAMPLES];
+};
+
+// the benchmarks call the nodes' static kernels, update() isn't run on the host
+class AudioStream
+{
+public:
+
+  AudioStream( int /*num_inputs*/, audio_block_t** /*input_queue*/ )  {}
+  virtual ~AudioStream()                                              {}
+
+  virtual void update() = 0;
+
+protected:
+
+  audio_block_t*        receiveReadOnly( int /*index*/ )              { return nullptr; }
+  audio_block_t*        receiveWritable( int /*index*/ )              { return nullptr; }
+  void                  transmit( audio_block_t* /*block*/, int /*index*/ ) {}
+
+  static audio_block_t* allocate()                                    { return nullptr; }
+  static void           release( audio_block_t* /*block*/ )           {}
+};
@@ -0,0 +1,93 @@
+// Minimal stand-in for the Teensy SD library, enough to build SD_ASYNC_IO and its host test
+
+#pragma once
+
+#include <Arduino.h>
+
+// a file held in memory, the test owns the data
+class File
+{
+public:
+
+  File() = default;
+  File( uint8_t* data, uint32_t size ) : m_data( data ), m_size( size ) {}
+
+  explicit operator bool() const        { return m_data != nullptr; }
+
+  uint32_t size() const                 { return m_size; }
+  uint32_t position() const             { return m_position; }
+
+  bool seek( uint32_t position )
+  {
+    if( position > m_size )
+    {
+      return false;
+    }
+    m_position = position;
+    return true;
+  }
+
+  int read( void* buffer, size_t size )
+  {
+    const uint32_t n = m_position + size > m_size ? m_size - m_position : static_cast<uint32_t>( size );
+    memcpy( buffer, m_data + m_position, n );
+    m_position += n;
+    ++m_num_transfers;
+    return static_cast<int>( n );
+  }
+
+  size_t write( const void* buffer, size_t size )
+  {
+    const uint32_t n = m_position + size > m_size ? m_size - m_position : static_cast<uint32_t>( size );
+    memcpy( m_data + m_position, buffer, n );
+    m_position += n;
+    ++m_num_transfers;
+    return n;
+  }
+
+  void close()                          { m_data = nullptr; }
+
+  int                   m_num_transfers = 0;      // reads and writes, for the test to count
+
+private:
+
+  uint8_t*              m_data          = nullptr;
+  uint32_t              m_size          = 0;
+  uint32_t              m_position      = 0;
+};
+
+class FsFile
+{
+public:
+
+  explicit operator bool() const        { return false; }
+  void close()                          {}
+};
+
+// the test decides when the card is busy programming a write
+class SdCardInterface
+{
+public:
+
+  bool isBusy() const                   { return m_busy; }
+
+  bool                  m_busy          = false;
+};
+
+class SdFs
+{
+public:
+
+  SdCardInterface* card()               { return &m_card; }
+
+  SdCardInterface       m_card;
+};
+
+class SDClass
+{
+public:
+
+  SdFs                  sdfs;
+};
+
+extern SDClass SD;
@@ -0,0 +1,40 @@
+// Portable versions of the Teensy Audio library's Cortex-M4 DSP instruction wrappers, for the host builds
+
+#pragma once
+
+#include <cstdint>
+
+// computes limit((val >> rshift), 2**bits)
+static inline int32_t signed_saturate_rshift( int32_t val, int bits, int rshift )
+{
+  const int32_t max = ( 1 << ( bits - 1 ) ) - 1;
+  const int32_t min = -( 1 << ( bits - 1 ) );
+  const int32_t out = val >> rshift;
+  return out > max ? max : ( out < min ? min : out );
+}
+
+// computes ((a[31:0] * b[15:0]) >> 16)
+static inline int32_t signed_multiply_32x16b( int32_t a, uint32_t b )
+{
+  return static_cast<int32_t>( ( static_cast<int64_t>( a ) * static_cast<int16_t>( b & 0xFFFF ) ) >> 16 );
+}
+
+// computes ((a[31:0] * b[31:16]) >> 16)
+static inline int32_t signed_multiply_32x16t( int32_t a, uint32_t b )
+{
+  return static_cast<int32_t>( ( static_cast<int64_t>( a ) * static_cast<int16_t>( b >> 16 ) ) >> 16 );
+}
+
+// computes (a[15:0] << 16) | b[15:0]
+static inline uint32_t pack_16b_16b( int32_t a, int32_t b )
+{
+  return ( static_cast<uint32_t>( a ) << 16 ) | ( static_cast<uint32_t>( b ) & 0xFFFF );
+}
+
+// computes saturated ((a[31:16] + b[31:16]) << 16) | (a[15:0] + b[15:0])
+static inline uint32_t signed_add_16_and_16( uint32_t a, uint32_t b )
+{
+  const int32_t bottom  = signed_saturate_rshift( static_cast<int16_t>( a & 0xFFFF ) + static_cast<int16_t>( b & 0xFFFF ), 16, 0 );
+  const int32_t top     = signed_saturate_rshift( static_cast<int16_t>( a >> 16 ) + static_cast<int16_t>( b >> 16 ), 16, 0 );
+  return pack_16b_16b( top, bottom );
+}
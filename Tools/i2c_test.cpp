@@ -0,0 +1,394 @@
+// Host test of the I2C_ASYNC interrupt state machine, against a simulated I2C0 bus and device
+//
+// Build:   g++ -O2 -std=c++14 -Wall -Wextra -I host -o i2c_test i2c_test.cpp ../I2CAsync.cpp ../Util.cpp
+// Usage:   i2c_test
+//
+// The bus watches the registers the driver writes (and every access of D), and raises the I2C0 interrupt as the
+// hardware would once each byte has been transferred. Returns non-zero if any check fails.
+
+#include <vector>
+
+#include <Arduino.h>
+#include "../I2CAsync.h"
+#include "../Util.h"
+
+HOST_SERIAL Serial;
+
+static uint32_t time_us = 0;
+
+uint32_t micros()
+{
+  return time_us;
+}
+
+//////////////////////////////////////
+
+volatile uint8_t host_i2c0_c1 = 0;
+volatile uint8_t host_i2c0_s  = 0;
+volatile uint8_t host_i2c0_f  = 0;
+
+static volatile uint8_t i2c0_d  = 0;
+static bool d_accessed          = false;
+
+volatile uint8_t* host_i2c0_d()
+{
+  d_accessed = true;
+  return &i2c0_d;
+}
+
+static void (*i2c0_vector)()  = nullptr;
+static bool irq_enabled       = false;
+
+void attachInterruptVector( int /*irq*/, void (*function)() )
+{
+  i2c0_vector = function;
+}
+
+void NVIC_ENABLE_IRQ( int /*irq*/ )
+{
+  irq_enabled = true;
+}
+
+void NVIC_DISABLE_IRQ( int /*irq*/ )
+{
+  irq_enabled = false;
+}
+
+//////////////////////////////////////
+
+// a single device, and how it misbehaves
+class I2C_BUS
+{
+public:
+
+  uint8_t               m_device_address  = 0x01;
+  int                   m_nack_data_byte  = -1;       // index of a written byte the device doesn't acknowledge
+  bool                  m_hold            = false;    // stop responding after the address, so the transaction times out
+  bool                  m_lose_arbitration = false;
+  bool                  m_hold_busy       = false;    // the stop stays on the bus until release_busy()
+  std::vector<uint8_t>  m_read_data;
+
+  // what the master did
+  std::vector<uint8_t>  m_written;
+  std::vector<bool>     m_master_acks;                // per byte read, false for the final NACK
+  int                   m_num_starts      = 0;
+  int                   m_num_stops       = 0;
+
+  void reset()
+  {
+    *this = I2C_BUS();
+    host_i2c0_c1  = I2C_C1_IICEN;
+    host_i2c0_s   = 0;
+    d_accessed    = false;
+  }
+
+  void release_busy()
+  {
+    m_hold_busy   = false;
+    host_i2c0_s   = host_i2c0_s & ~I2C_S_BUSY;
+  }
+
+  // responds to what the driver has just done, raising interrupts until the bus is waiting on the driver again
+  void run()
+  {
+    while( true )
+    {
+      const bool master = host_i2c0_c1 & I2C_C1_MST;
+      if( master && !m_started )
+      {
+        m_started         = true;
+        m_address_phase   = true;
+        m_read_index      = 0;
+        ++m_num_starts;
+      }
+
+      if( d_accessed )
+      {
+        d_accessed = false;
+        if( m_started && master && ( host_i2c0_c1 & I2C_C1_TX ) )
+        {
+          byte_written( i2c0_d );
+        }
+        else if( m_started && master )
+        {
+          // reading D releases the bus to clock in the next byte
+          const uint8_t value = m_read_index < static_cast<int>( m_read_data.size() ) ? m_read_data[m_read_index] : 0xFF;
+          ++m_read_index;
+          m_master_acks.push_back( ( host_i2c0_c1 & I2C_C1_TXAK ) == 0 );
+          i2c0_d          = value;
+          raise( I2C_S_IICIF | I2C_S_BUSY );
+        }
+      }
+
+      if( !master && m_started )
+      {
+        m_started = false;
+        ++m_num_stops;
+        host_i2c0_s = m_hold_busy ? ( host_i2c0_s | I2C_S_BUSY ) : ( host_i2c0_s & ~I2C_S_BUSY );
+      }
+
+      if( m_interrupt_pending && irq_enabled && i2c0_vector != nullptr )
+      {
+        m_interrupt_pending = false;
+        host_i2c0_s         = m_pending_status;
+        i2c0_vector();
+        continue;
+      }
+
+      return;
+    }
+  }
+
+private:
+
+  bool                  m_started           = false;
+  bool                  m_address_phase     = false;
+  bool                  m_addressed         = false;
+  int                   m_read_index        = 0;
+  bool                  m_interrupt_pending = false;
+  uint8_t               m_pending_status    = 0;
+
+  void raise( uint8_t status )
+  {
+    m_interrupt_pending = true;
+    m_pending_status    = status;
+  }
+
+  void byte_written( uint8_t value )
+  {
+    if( m_lose_arbitration )
+    {
+      raise( I2C_S_IICIF | I2C_S_ARBL );
+      return;
+    }
+
+    if( m_address_phase )
+    {
+      m_address_phase = false;
+      m_addressed     = ( value >> 1 ) == m_device_address;
+      if( m_addressed && m_hold )
+      {
+        // no interrupt
+        return;
+      }
+      raise( I2C_S_IICIF | I2C_S_BUSY | ( m_addressed ? 0 : I2C_S_RXAK ) );
+      return;
+    }
+
+    const bool ack = static_cast<int>( m_written.size() ) != m_nack_data_byte;
+    m_written.push_back( value );
+    raise( I2C_S_IICIF | I2C_S_BUSY | ( ack ? 0 : I2C_S_RXAK ) );
+  }
+};
+
+static I2C_BUS bus;
+
+//////////////////////////////////////
+
+static int num_failures = 0;
+
+#define CHECK(x) check( (x), #x, __LINE__ )
+
+static void check( bool ok, const char* expression, int line )
+{
+  if( !ok )
+  {
+    printf( "  FAILED line %d: %s\n", line, expression );
+    ++num_failures;
+  }
+}
+
+// polls update() as the main loop would, until the transaction completes or the time runs out
+static bool run_until_complete( I2C_ASYNC& i2c, int transaction, uint32_t max_time_us = 10000 )
+{
+  const uint32_t end_time_us = time_us + max_time_us;
+  while( time_us < end_time_us )
+  {
+    i2c.update();
+    bus.run();
+    if( i2c.complete( transaction ) )
+    {
+      return true;
+    }
+    time_us += 100;
+  }
+  return false;
+}
+
+static void test_write( I2C_ASYNC& i2c )
+{
+  printf( "write\n" );
+  bus.reset();
+
+  const uint8_t data[] = { 0xA5, 0x3C };
+  const int transaction = i2c.submit_write( bus.m_device_address, data, 2 );
+  CHECK( transaction != I2C_ASYNC::INVALID_TRANSACTION );
+  CHECK( run_until_complete( i2c, transaction ) );
+  CHECK( i2c.finish( transaction ) == 2 );
+  CHECK( bus.m_written.size() == 2 && bus.m_written[0] == 0xA5 && bus.m_written[1] == 0x3C );
+  CHECK( bus.m_num_starts == 1 && bus.m_num_stops == 1 );
+}
+
+static void test_read( I2C_ASYNC& i2c, int size )
+{
+  printf( "read %d\n", size );
+  bus.reset();
+  bus.m_read_data = { 0x11, 0x22, 0x33, 0x44 };
+
+  const int transaction = i2c.submit_read( bus.m_device_address, size );
+  CHECK( run_until_complete( i2c, transaction ) );
+
+  uint8_t data[I2C_ASYNC::MAX_DATA_SIZE] = {};
+  CHECK( i2c.finish( transaction, data ) == size );
+  for( int i = 0; i < size; ++i )
+  {
+    CHECK( data[i] == bus.m_read_data[i] );
+  }
+
+  // every byte but the last is acknowledged, and no byte is clocked in after the last
+  CHECK( static_cast<int>( bus.m_master_acks.size() ) == size );
+  for( int i = 0; i < static_cast<int>( bus.m_master_acks.size() ); ++i )
+  {
+    CHECK( bus.m_master_acks[i] == ( i < size - 1 ) );
+  }
+  CHECK( bus.m_num_stops == 1 );
+}
+
+static void test_address_nack( I2C_ASYNC& i2c )
+{
+  printf( "address nack\n" );
+  bus.reset();
+
+  const uint32_t errors = i2c.num_errors();
+  const int transaction = i2c.submit_read( bus.m_device_address + 1, 1 );
+  CHECK( run_until_complete( i2c, transaction ) );
+  CHECK( i2c.finish( transaction ) == -1 );
+  CHECK( i2c.num_errors() == errors + 1 );
+  CHECK( bus.m_master_acks.empty() );
+  CHECK( bus.m_num_stops == 1 );
+}
+
+static void test_data_nack( I2C_ASYNC& i2c )
+{
+  printf( "data nack\n" );
+  bus.reset();
+  bus.m_nack_data_byte = 0;
+
+  const uint8_t data[] = { 0x01, 0x02, 0x03 };
+  const int transaction = i2c.submit_write( bus.m_device_address, data, 3 );
+  CHECK( run_until_complete( i2c, transaction ) );
+  CHECK( i2c.finish( transaction ) == -1 );
+  CHECK( bus.m_written.size() == 1 );
+  CHECK( bus.m_num_stops == 1 );
+}
+
+static void test_arbitration_lost( I2C_ASYNC& i2c )
+{
+  printf( "arbitration lost\n" );
+  bus.reset();
+  bus.m_lose_arbitration = true;
+
+  const uint8_t data[] = { 0x01 };
+  const int transaction = i2c.submit_write( bus.m_device_address, data, 1 );
+  CHECK( run_until_complete( i2c, transaction ) );
+  CHECK( i2c.finish( transaction ) == -1 );
+}
+
+static void test_timeout( I2C_ASYNC& i2c )
+{
+  printf( "timeout\n" );
+  bus.reset();
+  bus.m_hold = true;
+
+  const uint32_t errors = i2c.num_errors();
+  const int transaction = i2c.submit_read( bus.m_device_address, 2 );
+
+  // still waiting just inside the timeout
+  CHECK( !run_until_complete( i2c, transaction, I2C_ASYNC::TRANSACTION_TIMEOUT_US - 200 ) );
+
+  CHECK( run_until_complete( i2c, transaction ) );
+  CHECK( i2c.finish( transaction ) == -1 );
+  CHECK( i2c.num_errors() == errors + 1 );
+  CHECK( bus.m_num_stops == 1 );
+  CHECK( irq_enabled );
+
+  // the bus is usable again
+  bus.m_hold = false;
+  bus.m_read_data = { 0x5A };
+  const int next = i2c.submit_read( bus.m_device_address, 1 );
+  CHECK( run_until_complete( i2c, next ) );
+  uint8_t data = 0;
+  CHECK( i2c.finish( next, &data ) == 1 && data == 0x5A );
+}
+
+static void test_queue( I2C_ASYNC& i2c )
+{
+  printf( "queue\n" );
+  bus.reset();
+  bus.m_hold_busy = true;
+  bus.m_read_data = { 0x77 };
+
+  const uint8_t data[] = { 0x10 };
+  const int first   = i2c.submit_write( bus.m_device_address, data, 1 );
+  const int second  = i2c.submit_read( bus.m_device_address, 1 );
+  CHECK( first != I2C_ASYNC::INVALID_TRANSACTION && second != I2C_ASYNC::INVALID_TRANSACTION );
+
+  CHECK( run_until_complete( i2c, first ) );
+
+  // the second waits for the previous stop to clear the bus
+  CHECK( !run_until_complete( i2c, second, 1000 ) );
+  CHECK( bus.m_num_starts == 1 );
+  bus.release_busy();
+  CHECK( run_until_complete( i2c, second ) );
+  CHECK( bus.m_num_starts == 2 );
+
+  uint8_t value = 0;
+  CHECK( i2c.finish( first ) == 1 );
+  CHECK( i2c.finish( second, &value ) == 1 && value == 0x77 );
+
+  // full until the results are collected
+  bus.reset();
+  bus.m_hold = true;
+  int transactions[I2C_ASYNC::MAX_TRANSACTIONS];
+  for( int t = 0; t < I2C_ASYNC::MAX_TRANSACTIONS; ++t )
+  {
+    transactions[t] = i2c.submit_read( bus.m_device_address, 1 );
+    CHECK( transactions[t] != I2C_ASYNC::INVALID_TRANSACTION );
+  }
+  CHECK( i2c.submit_read( bus.m_device_address, 1 ) == I2C_ASYNC::INVALID_TRANSACTION );
+
+  // each times out in turn
+  for( int t = 0; t < I2C_ASYNC::MAX_TRANSACTIONS; ++t )
+  {
+    CHECK( run_until_complete( i2c, transactions[t] ) );
+    CHECK( i2c.finish( transactions[t] ) == -1 );
+  }
+}
+
+int main()
+{
+#ifdef DEBUG_OUTPUT
+  serial_port_initialised = true;
+#endif
+
+  // as set by Wire.begin()
+  host_i2c0_f = 0x27;
+
+  I2C_ASYNC i2c;
+  i2c.begin();
+  bus.reset();
+
+  test_write( i2c );
+  for( int size = 1; size <= I2C_ASYNC::MAX_DATA_SIZE; ++size )
+  {
+    test_read( i2c, size );
+  }
+  test_address_nack( i2c );
+  test_data_nack( i2c );
+  test_arbitration_lost( i2c );
+  test_timeout( i2c );
+  test_queue( i2c );
+
+  printf( num_failures == 0 ? "passed\n" : "%d checks failed\n", num_failures );
+  return num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+// Host test of the SCHEDULER, with the main loop tasks of the looper against a simulated clock
+//
+// Build:   g++ -O2 -std=c++14 -Wall -Wextra -I host -o scheduler_test scheduler_test.cpp ../Scheduler.cpp ../Util.cpp
+// Usage:   scheduler_test
+//
+// Each task advances the clock by its run time. The sd task is always busy - every run polls the card, whether or not
+// it reads - and its play queue is drained by the audio interrupt once per block, as SD_AUDIO_RECORDER's is. Checks the
+// periodic tasks still run within their periods, and the play queue never runs dry. Returns non-zero if any check fails.
+
+#include <Arduino.h>
+#include <Audio.h>
+#include "../Scheduler.h"
+#include "../Util.h"
+
+HOST_SERIAL Serial;
+
+static uint32_t time_us = 0;
+
+uint32_t micros()
+{
+  return time_us;
+}
+
+uint32_t millis()
+{
+  return time_us / 1000;
+}
+
+//////////////////////////////////////
+
+static int num_failures = 0;
+
+#define CHECK(x) check( (x), #x, __LINE__ )
+
+static void check( bool ok, const char* expression, int line )
+{
+  if( !ok )
+  {
+    printf( "  FAILED line %d: %s\n", line, expression );
+    ++num_failures;
+  }
+}
+
+//////////////////////////////////////
+
+static constexpr const uint32_t BLOCK_TIME_US     = static_cast<uint32_t>( AUDIO_BLOCK_SAMPLES * 1000000.0f / AUDIO_SAMPLE_RATE_EXACT );
+static constexpr const uint32_t LOOP_OVERHEAD_US  = 5;
+
+// the recorder's play queue, as the sd task and the audio interrupt see it
+class PLAY_QUEUE
+{
+public:
+
+  int                   m_refill_target   = 0;
+  uint32_t              m_read_us         = 0;      // the sd task's run time when it reads a block
+  uint32_t              m_poll_us         = 0;      // and when it doesn't
+
+  int                   m_queued          = 0;
+  int                   m_min_queued      = 0;
+  int                   m_underruns       = 0;
+  uint32_t              m_next_block_us   = 0;
+
+  void start( int refill_target, uint32_t read_us, uint32_t poll_us )
+  {
+    m_refill_target = refill_target;
+    m_read_us       = read_us;
+    m_poll_us       = poll_us;
+    m_queued        = refill_target;
+    m_min_queued    = refill_target;
+    m_underruns     = 0;
+    m_next_block_us = time_us + BLOCK_TIME_US;
+  }
+
+  // the audio interrupts since the last call
+  void update_interrupt()
+  {
+    for( ; static_cast<int32_t>( time_us - m_next_block_us ) >= 0; m_next_block_us += BLOCK_TIME_US )
+    {
+      if( m_queued > 0 )
+      {
+        --m_queued;
+      }
+      else
+      {
+        ++m_underruns;
+      }
+      m_min_queued = min_val( m_min_queued, m_queued );
+    }
+  }
+
+  float urgency()
+  {
+    update_interrupt();
+    return SCHEDULER::refill_urgency( m_queued, m_refill_target );
+  }
+
+  // as SD_AUDIO_RECORDER::update_playing_sd(), reads while at or below the refill target
+  void update_sd()
+  {
+    update_interrupt();
+    if( m_queued < m_refill_target )
+    {
+      ++m_queued;
+      time_us += m_read_us;
+    }
+    else
+    {
+      time_us += m_poll_us;
+    }
+  }
+};
+
+static PLAY_QUEUE play_queue;
+
+// the looper's periodic tasks
+struct PERIODIC_TASK
+{
+  const char*           m_name;
+  uint32_t              m_period_us;
+  uint32_t              m_run_us;
+
+  uint32_t              m_last_run_us;
+  uint32_t              m_max_interval_us;
+  int                   m_num_runs;
+};
+
+static PERIODIC_TASK periodic_tasks[] =
+{
+  { "interface",      2000,   150,  0, 0, 0 },
+  { "button strip",   5000,   300,  0, 0, 0 },
+  { "clock",          1000,   20,   0, 0, 0 },
+};
+
+static constexpr const int NUM_PERIODIC_TASKS = sizeof(periodic_tasks) / sizeof(periodic_tasks[0]);
+
+template< int TASK >
+void periodic_task( uint32_t /*time_ms*/ )
+{
+  PERIODIC_TASK& task = periodic_tasks[TASK];
+  if( task.m_num_runs > 0 )
+  {
+    task.m_max_interval_us = max_val( task.m_max_interval_us, time_us - task.m_last_run_us );
+  }
+  task.m_last_run_us = time_us;
+  ++task.m_num_runs;
+
+  time_us += task.m_run_us;
+}
+
+void sd_task( uint32_t /*time_ms*/ )
+{
+  play_queue.update_sd();
+}
+
+float sd_task_urgency()
+{
+  return play_queue.urgency();
+}
+
+//////////////////////////////////////
+
+static void run( const char* name, int refill_target, uint32_t read_us, uint32_t poll_us )
+{
+  printf( "%s, refill target %d blocks, %uus per read\n", name, refill_target, read_us );
+
+  for( PERIODIC_TASK& task : periodic_tasks )
+  {
+    task.m_max_interval_us  = 0;
+    task.m_num_runs         = 0;
+  }
+
+  SCHEDULER scheduler;
+  scheduler.add_periodic_task( periodic_tasks[0].m_name, periodic_task<0>, periodic_tasks[0].m_period_us );
+  scheduler.add_periodic_task( periodic_tasks[1].m_name, periodic_task<1>, periodic_tasks[1].m_period_us );
+  scheduler.add_periodic_task( periodic_tasks[2].m_name, periodic_task<2>, periodic_tasks[2].m_period_us );
+  scheduler.add_deadline_task( "sd", sd_task, sd_task_urgency );
+
+  play_queue.start( refill_target, read_us, poll_us );
+
+  // 10 seconds
+  const uint32_t end_us = time_us + 10000000;
+  while( static_cast<int32_t>( end_us - time_us ) > 0 )
+  {
+    scheduler.update();
+    time_us += LOOP_OVERHEAD_US;
+  }
+
+  // each periodic task keeps to its period, held up by no more than an sd read and a run of each of the others
+  uint32_t hold_up_us = read_us;
+  for( const PERIODIC_TASK& task : periodic_tasks )
+  {
+    hold_up_us += task.m_run_us;
+  }
+
+  for( const PERIODIC_TASK& task : periodic_tasks )
+  {
+    printf( "  %s runs: %d, max interval: %uus\n", task.m_name, task.m_num_runs, task.m_max_interval_us );
+    CHECK( task.m_num_runs >= static_cast<int>( 10000000 / task.m_period_us ) * 99 / 100 );
+    CHECK( task.m_max_interval_us <= task.m_period_us + hold_up_us );
+  }
+
+  printf( "  min queued: %d, underruns: %d\n", play_queue.m_min_queued, play_queue.m_underruns );
+  CHECK( play_queue.m_underruns == 0 );
+  CHECK( play_queue.m_min_queued > 0 );
+}
+
+int main()
+{
+#ifdef DEBUG_OUTPUT
+  serial_port_initialised = true;
+#endif
+
+  static_assert( NUM_PERIODIC_TASKS == 3, "add_periodic_task() calls don't match the tasks" );
+
+  // PLAY keeps 7 blocks queued, RECORD_PLAY and RECORD_OVERDUB keep 32
+  run( "playing", 7, 400, 200 );
+  run( "playing, slow card", 7, 1000, 500 );
+  run( "recording", 32, 400, 200 );
+
+  printf( num_failures == 0 ? "passed\n" : "%d checks failed\n", num_failures );
+  return num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,321 @@
+// Host test of SD_ASYNC_IO, with the recorder's play reads in both directions, through File and raw streams
+//
+// Build:   g++ -O2 -std=c++14 -Wall -Wextra -I host -o sd_async_test sd_async_test.cpp ../SDAsyncIO.cpp ../Util.cpp
+// Usage:   sd_async_test
+//
+// The play reads are submitted as SD_AUDIO_RECORDER::update_playing_sd() submits them - a block at a time from the play
+// position, backwards when reversed - and collected as collect_sd_io() collects them, reversing the samples of backward
+// reads. Looping, the block holding the end of the file (the start, when reversed) is completed from the other end, as
+// the recorder carries it over the wrap. Checks the blocks are the file's samples in play order, padded only once the
+// last pass ends, that each update() transfers no more than it's allowed to, and nothing while the card is busy.
+// Returns non-zero if any check fails.
+
+#include <algorithm>
+#include <vector>
+
+#include <Arduino.h>
+#include <Audio.h>
+#include "../SDAsyncIO.h"
+#include "../Util.h"
+
+HOST_SERIAL Serial;
+SDClass SD;
+
+// the raw stream reads the card image directly, there's no file system to resolve a sector range from
+static std::vector<uint8_t> card_image;
+static int raw_transfers = 0;
+
+SD_RAW_STREAM::SD_RAW_STREAM() :
+  m_file(),
+  m_first_sector(0),
+  m_num_sectors(0),
+  m_size(0),
+  m_writing(false),
+  m_sector_buffer()
+{
+}
+
+bool SD_RAW_STREAM::read( uint32_t position, void* buffer, uint32_t size )
+{
+  ++raw_transfers;
+  if( position + size > card_image.size() )
+  {
+    return false;
+  }
+  memcpy( buffer, card_image.data() + position, size );
+  return true;
+}
+
+bool SD_RAW_STREAM::write( uint32_t position, const void* buffer, uint32_t size )
+{
+  ++raw_transfers;
+  if( position + size > card_image.size() )
+  {
+    return false;
+  }
+  memcpy( card_image.data() + position, buffer, size );
+  return true;
+}
+
+//////////////////////////////////////
+
+static int num_failures = 0;
+
+#define CHECK(x) check( (x), #x, __LINE__ )
+
+static void check( bool ok, const char* expression, int line )
+{
+  if( !ok )
+  {
+    printf( "  FAILED line %d: %s\n", line, expression );
+    ++num_failures;
+  }
+}
+
+//////////////////////////////////////
+
+static constexpr const uint32_t DATA_OFFSET               = 44;       // a wav header
+static constexpr const uint32_t NUM_SAMPLES               = 5000;
+static constexpr const int      MAX_PLAY_READS_IN_FLIGHT  = 4;
+static constexpr const int      BUSY_EVERY                = 3;        // updates, the card is busy on every third
+
+// sample i of the file is i + 1, so padding can't be mistaken for a sample
+static int16_t file_sample( uint32_t i )
+{
+  return static_cast<int16_t>( i + 1 );
+}
+
+// the recorder's play reads, as update_playing_sd() and collect_sd_io() submit and collect them
+class PLAY_READS
+{
+public:
+
+  struct PLAY_READ
+  {
+    int16_t*            m_block;
+    int                 m_block_offset;
+    uint32_t            m_size;
+    int                 m_request;
+    bool                m_reversed;
+  };
+
+  SD_ASYNC_IO           m_sd_io;
+  File*                 m_file            = nullptr;
+  SD_RAW_STREAM*        m_stream          = nullptr;
+  uint32_t              m_offset          = 0;      // bytes into the sample data
+  uint32_t              m_size            = 0;
+  bool                  m_reversed        = false;
+  int                   m_wraps           = 0;      // passes still to start once this one ends
+
+  PLAY_READ             m_reads[MAX_PLAY_READS_IN_FLIGHT];
+  int                   m_read_head       = 0;
+  int                   m_num_reads       = 0;
+
+  // a block for each read in flight, and the end of the file carried over the wrap
+  int16_t               m_blocks[MAX_PLAY_READS_IN_FLIGHT + 1][AUDIO_BLOCK_SAMPLES];
+  bool                  m_block_in_use[MAX_PLAY_READS_IN_FLIGHT + 1] = {};
+  int16_t*              m_partial_block   = nullptr;
+  int                   m_partial_samples = 0;
+
+  std::vector<int16_t>  m_played;
+
+  bool more_to_read() const
+  {
+    return m_reversed ? m_offset > 0 : m_offset < m_size;
+  }
+
+  bool finished() const
+  {
+    return !more_to_read() && m_num_reads == 0 && m_wraps == 0;
+  }
+
+  int16_t* allocate()
+  {
+    for( int b = 0; b <= MAX_PLAY_READS_IN_FLIGHT; ++b )
+    {
+      if( !m_block_in_use[b] )
+      {
+        m_block_in_use[b] = true;
+        return m_blocks[b];
+      }
+    }
+    return nullptr;
+  }
+
+  void queue( int16_t* block, int num_samples )
+  {
+    for( int i = num_samples; i < AUDIO_BLOCK_SAMPLES; ++i )
+    {
+      block[i] = 0;
+    }
+    m_played.insert( m_played.end(), block, block + AUDIO_BLOCK_SAMPLES );
+    m_block_in_use[ ( block - m_blocks[0] ) / AUDIO_BLOCK_SAMPLES ] = false;
+  }
+
+  void submit()
+  {
+    if( !more_to_read() && m_num_reads == 0 && m_wraps > 0 )
+    {
+      // as wrap_play_back_sd()
+      m_offset = m_reversed ? m_size & ~1u : 0;
+      --m_wraps;
+    }
+
+    while( more_to_read() && m_num_reads < MAX_PLAY_READS_IN_FLIGHT )
+    {
+      int16_t* block                = m_partial_block != nullptr ? m_partial_block : allocate();
+      const int block_offset        = m_partial_samples;
+      CHECK( block != nullptr );
+      m_partial_block               = nullptr;
+      m_partial_samples             = 0;
+
+      const uint32_t bytes_to_read  = min_val<uint32_t>( ( AUDIO_BLOCK_SAMPLES - block_offset ) * 2, m_reversed ? m_offset : m_size - m_offset );
+      const uint32_t read_start     = m_reversed ? m_offset - bytes_to_read : m_offset;
+      PLAY_READ& play_read          = m_reads[ ( m_read_head + m_num_reads ) % MAX_PLAY_READS_IN_FLIGHT ];
+      play_read.m_request           = m_stream != nullptr ? m_sd_io.submit_read( *m_stream, DATA_OFFSET + read_start, block + block_offset, bytes_to_read ) :
+                                                            m_sd_io.submit_read( *m_file, DATA_OFFSET + read_start, block + block_offset, bytes_to_read );
+      CHECK( play_read.m_request != SD_ASYNC_IO::INVALID_REQUEST );
+      play_read.m_block             = block;
+      play_read.m_block_offset      = block_offset;
+      play_read.m_size              = bytes_to_read;
+      play_read.m_reversed          = m_reversed;
+      m_offset                      = m_reversed ? read_start : read_start + bytes_to_read;
+      ++m_num_reads;
+    }
+  }
+
+  void collect()
+  {
+    while( m_num_reads > 0 && m_sd_io.complete( m_reads[m_read_head].m_request ) )
+    {
+      PLAY_READ& play_read  = m_reads[m_read_head];
+      const int32_t n       = m_sd_io.finish( play_read.m_request );
+      CHECK( n > 0 );
+
+      int16_t* samples      = play_read.m_block + play_read.m_block_offset;
+      const int num_samples = max_val<int32_t>( n, 0 ) / 2;
+      if( play_read.m_reversed )
+      {
+        std::reverse( samples, samples + num_samples );
+      }
+
+      const int block_samples = play_read.m_block_offset + num_samples;
+      m_read_head             = ( m_read_head + 1 ) % MAX_PLAY_READS_IN_FLIGHT;
+      --m_num_reads;
+
+      if( n == static_cast<int32_t>(play_read.m_size) && block_samples < AUDIO_BLOCK_SAMPLES )
+      {
+        m_partial_block   = play_read.m_block;
+        m_partial_samples = block_samples;
+        continue;
+      }
+
+      queue( play_read.m_block, block_samples );
+    }
+
+    if( finished() && m_partial_block != nullptr )
+    {
+      // the last pass has ended, as queue_partial_play_block_sd()
+      queue( m_partial_block, m_partial_samples );
+      m_partial_block   = nullptr;
+      m_partial_samples = 0;
+    }
+  }
+};
+
+// plays from start_sample to the end of the file, or back to the start, then wraps for whole passes, and checks the
+// blocks and the transfers
+static void play( const char* name, bool raw, bool reversed, uint32_t start_sample, int wraps = 0 )
+{
+  printf( "%s, %s from sample %u, %d wraps\n", name, reversed ? "reversed" : "forwards", start_sample, wraps );
+
+  card_image.assign( DATA_OFFSET + NUM_SAMPLES * 2, 0xAA );
+  for( uint32_t i = 0; i < NUM_SAMPLES; ++i )
+  {
+    const int16_t sample = file_sample( i );
+    memcpy( card_image.data() + DATA_OFFSET + i * 2, &sample, 2 );
+  }
+
+  File file( card_image.data(), static_cast<uint32_t>( card_image.size() ) );
+  SD_RAW_STREAM stream;
+  raw_transfers = 0;
+
+  PLAY_READS play_reads;
+  play_reads.m_file     = &file;
+  play_reads.m_stream   = raw ? &stream : nullptr;
+  play_reads.m_offset   = start_sample * 2;
+  play_reads.m_size     = NUM_SAMPLES * 2;
+  play_reads.m_reversed = reversed;
+  play_reads.m_wraps    = wraps;
+
+  int max_transfers       = 0;
+  int busy_transfers      = 0;
+  int num_busy_updates    = 0;
+  for( int u = 0; u < 10000 && !play_reads.finished(); ++u )
+  {
+    play_reads.submit();
+
+    SD.sdfs.m_card.m_busy = u % BUSY_EVERY == BUSY_EVERY - 1;
+    const int transfers_before = file.m_num_transfers + raw_transfers;
+    play_reads.m_sd_io.update();
+    const int transfers = file.m_num_transfers + raw_transfers - transfers_before;
+
+    if( SD.sdfs.m_card.m_busy )
+    {
+      busy_transfers += transfers;
+      ++num_busy_updates;
+    }
+    max_transfers = max_val( max_transfers, transfers );
+
+    play_reads.collect();
+  }
+  SD.sdfs.m_card.m_busy = false;
+
+  // the samples in play order, continuous over the wraps, then padding to the end of the last block
+  std::vector<int16_t> expected;
+  uint32_t sample = start_sample;
+  for( int pass = 0; pass <= wraps; ++pass )
+  {
+    for( ; reversed ? sample > 0 : sample < NUM_SAMPLES; reversed ? --sample : ++sample )
+    {
+      expected.push_back( file_sample( reversed ? sample - 1 : sample ) );
+    }
+    sample = reversed ? NUM_SAMPLES : 0;
+  }
+  expected.resize( ( ( expected.size() + AUDIO_BLOCK_SAMPLES - 1 ) / AUDIO_BLOCK_SAMPLES ) * AUDIO_BLOCK_SAMPLES, 0 );
+
+  printf( "  blocks: %u, max transfers per update: %d, busy deferrals: %u\n",
+          static_cast<uint32_t>( play_reads.m_played.size() / AUDIO_BLOCK_SAMPLES ), max_transfers, play_reads.m_sd_io.num_busy_deferrals() );
+  CHECK( play_reads.finished() && play_reads.m_partial_block == nullptr );
+  CHECK( play_reads.m_played == expected );
+  CHECK( max_transfers > 0 && max_transfers <= SD_ASYNC_IO::MAX_TRANSFERS_PER_UPDATE );
+  CHECK( busy_transfers == 0 );
+  CHECK( play_reads.m_sd_io.num_busy_deferrals() > 0 && play_reads.m_sd_io.num_busy_deferrals() <= static_cast<uint32_t>( num_busy_updates ) );
+  CHECK( play_reads.m_sd_io.idle() );
+}
+
+int main()
+{
+#ifdef DEBUG_OUTPUT
+  serial_port_initialised = true;
+#endif
+
+  // an unaligned start, so the read at the end of the file (the start, when reversed) is short
+  play( "file", false, true, 3333 );
+  play( "file", false, false, 3333 );
+  play( "raw stream", true, true, 3333 );
+  play( "raw stream", true, false, 3333 );
+
+  // a whole number of blocks, no padding at all
+  play( "file", false, true, AUDIO_BLOCK_SAMPLES * 20 );
+  play( "raw stream", true, true, AUDIO_BLOCK_SAMPLES * 20 );
+
+  // looping, the file isn't a whole number of blocks so every wrap falls part way through one
+  play( "file", false, false, 3333, 3 );
+  play( "file", false, true, 3333, 3 );
+  play( "raw stream", true, false, 0, 2 );
+  play( "raw stream", true, true, NUM_SAMPLES, 2 );
+
+  printf( num_failures == 0 ? "passed\n" : "%d checks failed\n", num_failures );
+  return num_failures == 0 ? 0 : 1;
+}
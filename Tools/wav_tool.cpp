@@ -0,0 +1,251 @@
+// Host tool for inspecting and converting looper audio files
+//
+// Build:   g++ -O2 -std=c++14 -o wav_tool wav_tool.cpp
+// Usage:   wav_tool info <file.wav>
+//          wav_tool to-wav <in.raw> <out.wav> [sample_rate] [num_segments]
+//          wav_tool to-raw <in.wav> <out.raw>
+//
+// Files are mapped with mmap() so large loops are converted without intermediate copies
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../WavFormat.h"
+
+namespace
+{
+  constexpr const uint32_t DEFAULT_SAMPLE_RATE  = WAV_FORMAT::LOOPER_SAMPLE_RATE;
+  constexpr const int      DEFAULT_NUM_SEGMENTS = 8;
+
+  class MAPPED_FILE
+  {
+    int               m_fd    = -1;
+    uint8_t*          m_data  = nullptr;
+    size_t            m_size  = 0;
+
+  public:
+
+    ~MAPPED_FILE()
+    {
+      if( m_data != nullptr )
+      {
+        munmap( m_data, m_size );
+      }
+      if( m_fd >= 0 )
+      {
+        close( m_fd );
+      }
+    }
+
+    bool open_read( const char* filename )
+    {
+      m_fd = open( filename, O_RDONLY );
+      struct stat st;
+      if( m_fd < 0 || fstat( m_fd, &st ) != 0 )
+      {
+        return false;
+      }
+
+      m_size = st.st_size;
+      if( m_size == 0 )
+      {
+        return true;
+      }
+
+      void* data = mmap( nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0 );
+      if( data == MAP_FAILED )
+      {
+        return false;
+      }
+      m_data = static_cast<uint8_t*>(data);
+      madvise( m_data, m_size, MADV_SEQUENTIAL );
+
+      return true;
+    }
+
+    bool open_write( const char* filename, size_t size )
+    {
+      m_fd = open( filename, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+      if( m_fd < 0 || ftruncate( m_fd, size ) != 0 )
+      {
+        return false;
+      }
+
+      m_size = size;
+      if( m_size == 0 )
+      {
+        return true;
+      }
+
+      void* data = mmap( nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0 );
+      if( data == MAP_FAILED )
+      {
+        return false;
+      }
+      m_data = static_cast<uint8_t*>(data);
+
+      return true;
+    }
+
+    uint8_t*          data() const    { return m_data; }
+    size_t            size() const    { return m_size; }
+  };
+
+  bool read_wav_info( const MAPPED_FILE& file, WAV_FORMAT::WAV_INFO& info )
+  {
+    auto memory_reader = [&file]( uint32_t offset, void* dest, uint32_t size ) -> bool
+    {
+      if( size > file.size() || offset > file.size() - size )
+      {
+        return false;
+      }
+      memcpy( dest, file.data() + offset, size );
+      return true;
+    };
+
+    return WAV_FORMAT::read_header( memory_reader, file.size(), info );
+  }
+
+  int info( const char* filename )
+  {
+    MAPPED_FILE file;
+    if( !file.open_read( filename ) )
+    {
+      fprintf( stderr, "Unable to open %s\n", filename );
+      return 1;
+    }
+
+    WAV_FORMAT::WAV_INFO info;
+    if( !read_wav_info( file, info ) )
+    {
+      fprintf( stderr, "%s is not a PCM WAV file\n", filename );
+      return 1;
+    }
+
+    printf( "File:            %s\n", filename );
+    printf( "Sample rate:     %u\n", info.m_sample_rate );
+    printf( "Channels:        %u\n", info.m_channels );
+    printf( "Bits:            %u\n", info.m_bits_per_sample );
+    printf( "Data offset:     %u%s\n", info.m_data_offset, info.m_data_offset % WAV_FORMAT::SECTOR_SIZE == 0 ? " (sector aligned)" : " (NOT sector aligned)" );
+    printf( "Data size:       %u bytes, %u frames", info.m_data_size, info.num_frames() );
+    if( info.m_sample_rate > 0 )
+    {
+      printf( ", %.3f s", info.num_frames() / static_cast<double>(info.m_sample_rate) );
+    }
+    printf( "\n" );
+
+    if( info.m_has_loop_chunk )
+    {
+      printf( "Loop length:     %u frames\n", info.m_loop.m_loop_length );
+      printf( "Segments:        %u\n", info.m_loop.m_num_segments );
+      for( int s = 0; s < info.m_loop.m_num_segments && s < WAV_FORMAT::MAX_SEGMENT_POINTS; ++s )
+      {
+        printf( "  %2d:           %u\n", s, info.m_loop.m_segment_points[s] );
+      }
+    }
+    else
+    {
+      printf( "No LOOP chunk\n" );
+    }
+
+    return 0;
+  }
+
+  int to_wav( const char* in_filename, const char* out_filename, uint32_t sample_rate, int num_segments )
+  {
+    MAPPED_FILE in_file;
+    if( !in_file.open_read( in_filename ) )
+    {
+      fprintf( stderr, "Unable to open %s\n", in_filename );
+      return 1;
+    }
+
+    WAV_FORMAT::WAV_INFO info;
+    info.m_sample_rate  = sample_rate;
+    info.m_data_size    = in_file.size() & ~1u;
+    WAV_FORMAT::set_equal_segments( info, info.num_frames(), num_segments );
+
+    MAPPED_FILE out_file;
+    if( !out_file.open_write( out_filename, WAV_FORMAT::HEADER_SIZE + info.m_data_size ) )
+    {
+      fprintf( stderr, "Unable to create %s\n", out_filename );
+      return 1;
+    }
+
+    WAV_FORMAT::write_header( out_file.data(), info );
+    if( info.m_data_size > 0 )
+    {
+      memcpy( out_file.data() + WAV_FORMAT::HEADER_SIZE, in_file.data(), info.m_data_size );
+    }
+
+    return 0;
+  }
+
+  int to_raw( const char* in_filename, const char* out_filename )
+  {
+    MAPPED_FILE in_file;
+    if( !in_file.open_read( in_filename ) )
+    {
+      fprintf( stderr, "Unable to open %s\n", in_filename );
+      return 1;
+    }
+
+    WAV_FORMAT::WAV_INFO info;
+    if( !read_wav_info( in_file, info ) )
+    {
+      fprintf( stderr, "%s is not a PCM WAV file\n", in_filename );
+      return 1;
+    }
+
+    MAPPED_FILE out_file;
+    if( !out_file.open_write( out_filename, info.m_data_size ) )
+    {
+      fprintf( stderr, "Unable to create %s\n", out_filename );
+      return 1;
+    }
+
+    if( info.m_data_size > 0 )
+    {
+      memcpy( out_file.data(), in_file.data() + info.m_data_offset, info.m_data_size );
+    }
+
+    return 0;
+  }
+
+  int usage()
+  {
+    fprintf( stderr, "usage: wav_tool info <file.wav>\n" );
+    fprintf( stderr, "       wav_tool to-wav <in.raw> <out.wav> [sample_rate] [num_segments]\n" );
+    fprintf( stderr, "       wav_tool to-raw <in.wav> <out.raw>\n" );
+    return 1;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  if( argc >= 3 && strcmp( argv[1], "info" ) == 0 )
+  {
+    int result = 0;
+    for( int f = 2; f < argc; ++f )
+    {
+      result |= info( argv[f] );
+    }
+    return result;
+  }
+  else if( argc >= 4 && strcmp( argv[1], "to-wav" ) == 0 )
+  {
+    const uint32_t sample_rate  = argc >= 5 ? strtoul( argv[4], nullptr, 10 ) : DEFAULT_SAMPLE_RATE;
+    const int num_segments      = argc >= 6 ? atoi( argv[5] ) : DEFAULT_NUM_SEGMENTS;
+    return to_wav( argv[2], argv[3], sample_rate, num_segments );
+  }
+  else if( argc == 4 && strcmp( argv[1], "to-raw" ) == 0 )
+  {
+    return to_raw( argv[2], argv[3] );
+  }
+
+  return usage();
+}
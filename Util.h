@@ -196,7 +196,7 @@ public:
 namespace DSP_UTILS
 {
 
-  inline int16_t soft_clip_sample( int16_t sample, float clip_coefficient, bool debug = false )
+  inline int16_t soft_clip_sample( int16_t sample, float clip_coefficient )
   {
     // scale input sample to the range [-1,1]
     const float sample_f = static_cast<float>(sample) / static_cast<float>(std::numeric_limits<int16_t>::max());
@@ -209,6 +209,15 @@ namespace DSP_UTILS
     return output_sample;
   }
 
+  // t is 0..1 through the crossfade, gains are sin/cos so the summed power stays constant for uncorrelated material
+  inline int16_t crossfade_equal_power( int16_t sample_out, int16_t sample_in, float t )
+  {
+    const float angle   = t * ( static_cast<float>(M_PI) * 0.5f );
+    const float mixed   = ( sample_out * cosf( angle ) ) + ( sample_in * sinf( angle ) );
+
+    return clamp<int32_t>( round_to_int( mixed ), std::numeric_limits<int16_t>::lowest(), std::numeric_limits<int16_t>::max() );
+  }
+
   // from http://polymathprogrammer.com/2008/09/29/linear-and-cubic-interpolation/
   inline float cubic_interpolation( float p0, float p1, float p2, float p3, float t )
   {
@@ -267,5 +276,29 @@ namespace DSP_UTILS
     return round_to_int( sampf );
   }
 
+  // sums the played samples into the mix samples in 32 bits (to avoid wrap-around), then clamps and soft clips
+  inline void mix_overdub( int16_t* mix_samples, const int16_t* played_samples, int num_samples, float clip_coefficient )
+  {
+    for( int i = 0; i < num_samples; ++i )
+    {
+      const int32_t summed_sample = mix_samples[i] + played_samples[i];
+      const int16_t sample16      = clamp<int32_t>( summed_sample, std::numeric_limits<int16_t>::lowest(), std::numeric_limits<int16_t>::max() );
+      mix_samples[i]              = soft_clip_sample( sample16, clip_coefficient );
+      ASSERT_MSG( mix_samples[i] < std::numeric_limits<int16_t>::max() && mix_samples[i] > std::numeric_limits<int16_t>::min(), "CLIPPING" );
+    }
+  }
+
+  // varispeed read, until either the source is consumed or the target reaches write_limit
+  inline void read_with_speed( const int16_t* source, int source_size, int16_t* target, float speed, float& read_head, int& write_head, int write_limit )
+  {
+    while( trunc_to_int( read_head ) < source_size && write_head < write_limit )
+    {
+      //target[write_head] = source[trunc_to_int(read_head)]; // no interpolation
+      target[write_head] = read_sample_cubic( read_head, source, source_size );
+      ++write_head;
+      read_head += speed;
+    }
+  }
+
 }
 // DSP_UTILS
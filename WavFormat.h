@@ -0,0 +1,219 @@
+// RIFF/WAV container used for loops and samples
+// Layout written by the looper (header is exactly one SD sector, so audio data is always sector aligned):
+//   RIFF header | "fmt " chunk | "LOOP" chunk | "JUNK" padding | "data" chunk header | 16-bit PCM samples...
+// Only depends on the standard library so it can be shared with host tools (see Tools/wav_tool.cpp)
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace WAV_FORMAT
+{
+  constexpr const uint32_t SECTOR_SIZE            = 512;
+  constexpr const uint32_t HEADER_SIZE            = SECTOR_SIZE;   // data starts on the first sector boundary
+  constexpr const int      MAX_SEGMENT_POINTS     = 16;
+  constexpr const uint16_t LOOP_CHUNK_VERSION     = 1;
+  constexpr const uint16_t PCM_FORMAT             = 1;
+  constexpr const uint32_t LOOPER_SAMPLE_RATE     = 44117;          // AUDIO_SAMPLE_RATE_EXACT truncated, as the looper writes it
+
+  constexpr uint32_t make_chunk_id( char a, char b, char c, char d )
+  {
+    return static_cast<uint32_t>(a) | ( static_cast<uint32_t>(b) << 8 ) | ( static_cast<uint32_t>(c) << 16 ) | ( static_cast<uint32_t>(d) << 24 );
+  }
+
+  constexpr const uint32_t RIFF_ID                = make_chunk_id( 'R', 'I', 'F', 'F' );
+  constexpr const uint32_t WAVE_ID                = make_chunk_id( 'W', 'A', 'V', 'E' );
+  constexpr const uint32_t FMT_ID                 = make_chunk_id( 'f', 'm', 't', ' ' );
+  constexpr const uint32_t LOOP_ID                = make_chunk_id( 'L', 'O', 'O', 'P' );
+  constexpr const uint32_t JUNK_ID                = make_chunk_id( 'J', 'U', 'N', 'K' );
+  constexpr const uint32_t DATA_ID                = make_chunk_id( 'd', 'a', 't', 'a' );
+
+  // all structures are little endian, which matches both the Teensy and x86 hosts
+  struct __attribute__((packed)) CHUNK_HEADER
+  {
+    uint32_t        m_id;
+    uint32_t        m_size;
+  };
+
+  struct __attribute__((packed)) FMT_CHUNK
+  {
+    uint16_t        m_format;
+    uint16_t        m_channels;
+    uint32_t        m_sample_rate;
+    uint32_t        m_byte_rate;
+    uint16_t        m_block_align;
+    uint16_t        m_bits_per_sample;
+  };
+
+  // custom chunk - loop details which are not expressible in a standard WAV
+  struct __attribute__((packed)) LOOP_CHUNK
+  {
+    uint16_t        m_version;
+    uint16_t        m_num_segments;
+    uint32_t        m_loop_length;                            // in sample frames
+    uint32_t        m_segment_points[MAX_SEGMENT_POINTS];     // sample frame offset of the start of each segment
+  };
+
+  static_assert( sizeof(CHUNK_HEADER) == 8, "Unexpected CHUNK_HEADER packing" );
+  static_assert( sizeof(FMT_CHUNK) == 16, "Unexpected FMT_CHUNK packing" );
+  static_assert( 12 + 3 * sizeof(CHUNK_HEADER) + sizeof(FMT_CHUNK) + sizeof(LOOP_CHUNK) + sizeof(CHUNK_HEADER) <= HEADER_SIZE, "Header does not fit in a sector" );
+
+  struct WAV_INFO
+  {
+    uint32_t        m_sample_rate         = 0;
+    uint16_t        m_channels            = 1;
+    uint16_t        m_bits_per_sample     = 16;
+    uint32_t        m_data_offset         = 0;      // in bytes from the start of the file
+    uint32_t        m_data_size           = 0;      // in bytes
+    bool            m_has_loop_chunk      = false;
+    LOOP_CHUNK      m_loop                = {};
+
+    uint32_t        bytes_per_frame() const
+    {
+      return m_channels * ( m_bits_per_sample / 8 );
+    }
+
+    uint32_t        num_frames() const
+    {
+      const uint32_t frame_size = bytes_per_frame();
+      return frame_size > 0 ? m_data_size / frame_size : 0;
+    }
+  };
+
+  // fill in the loop chunk with a loop of the given length divided into equal segments
+  inline void set_equal_segments( WAV_INFO& info, uint32_t loop_length, int num_segments )
+  {
+    if( num_segments > MAX_SEGMENT_POINTS )
+    {
+      num_segments = MAX_SEGMENT_POINTS;
+    }
+
+    info.m_has_loop_chunk       = true;
+    info.m_loop.m_version       = LOOP_CHUNK_VERSION;
+    info.m_loop.m_num_segments  = num_segments;
+    info.m_loop.m_loop_length   = loop_length;
+
+    for( int s = 0; s < MAX_SEGMENT_POINTS; ++s )
+    {
+      info.m_loop.m_segment_points[s] = s < num_segments ? static_cast<uint32_t>( ( static_cast<uint64_t>(loop_length) * s ) / num_segments ) : 0;
+    }
+  }
+
+  // write a HEADER_SIZE header into buffer, the audio data follows immediately at HEADER_SIZE
+  inline void write_header( uint8_t* buffer, const WAV_INFO& info )
+  {
+    memset( buffer, 0, HEADER_SIZE );
+
+    uint32_t offset = 0;
+    auto write = [buffer, &offset]( const void* src, uint32_t size )
+    {
+      memcpy( buffer + offset, src, size );
+      offset += size;
+    };
+    auto write_u32 = [&write]( uint32_t value )
+    {
+      write( &value, sizeof(value) );
+    };
+    auto write_chunk_header = [&write]( uint32_t id, uint32_t size )
+    {
+      const CHUNK_HEADER header = { id, size };
+      write( &header, sizeof(header) );
+    };
+
+    write_u32( RIFF_ID );
+    write_u32( HEADER_SIZE - 8 + info.m_data_size );
+    write_u32( WAVE_ID );
+
+    FMT_CHUNK fmt;
+    fmt.m_format            = PCM_FORMAT;
+    fmt.m_channels          = info.m_channels;
+    fmt.m_sample_rate       = info.m_sample_rate;
+    fmt.m_byte_rate         = info.m_sample_rate * info.bytes_per_frame();
+    fmt.m_block_align       = info.bytes_per_frame();
+    fmt.m_bits_per_sample   = info.m_bits_per_sample;
+    write_chunk_header( FMT_ID, sizeof(fmt) );
+    write( &fmt, sizeof(fmt) );
+
+    if( info.m_has_loop_chunk )
+    {
+      write_chunk_header( LOOP_ID, sizeof(LOOP_CHUNK) );
+      write( &info.m_loop, sizeof(LOOP_CHUNK) );
+    }
+
+    // pad so the data chunk header ends exactly on the sector boundary
+    const uint32_t junk_size = HEADER_SIZE - offset - 2 * sizeof(CHUNK_HEADER);
+    write_chunk_header( JUNK_ID, junk_size );
+    offset += junk_size;
+
+    write_chunk_header( DATA_ID, info.m_data_size );
+  }
+
+  // walk the RIFF chunks using READER, which must implement
+  //      bool              operator()( uint32_t offset, void* dest, uint32_t size );
+  // returns false if this is not a PCM WAV file
+  template< typename READER >
+  bool read_header( READER& reader, uint32_t file_size, WAV_INFO& info )
+  {
+    info = WAV_INFO();
+
+    uint32_t riff[3];
+    if( file_size < sizeof(riff) || !reader( 0, riff, sizeof(riff) ) || riff[0] != RIFF_ID || riff[2] != WAVE_ID )
+    {
+      return false;
+    }
+
+    bool found_fmt    = false;
+    uint32_t offset   = sizeof(riff);
+    while( offset <= file_size && file_size - offset >= sizeof(CHUNK_HEADER) )
+    {
+      const uint32_t chunk_offset = offset;
+      CHUNK_HEADER chunk;
+      if( !reader( offset, &chunk, sizeof(chunk) ) )
+      {
+        return false;
+      }
+      offset += sizeof(chunk);
+
+      if( chunk.m_id == FMT_ID && chunk.m_size >= sizeof(FMT_CHUNK) )
+      {
+        FMT_CHUNK fmt;
+        if( !reader( offset, &fmt, sizeof(fmt) ) || fmt.m_format != PCM_FORMAT )
+        {
+          return false;
+        }
+        info.m_sample_rate      = fmt.m_sample_rate;
+        info.m_channels         = fmt.m_channels;
+        info.m_bits_per_sample  = fmt.m_bits_per_sample;
+        found_fmt               = true;
+      }
+      else if( chunk.m_id == LOOP_ID && chunk.m_size >= sizeof(LOOP_CHUNK) )
+      {
+        info.m_has_loop_chunk   = reader( offset, &info.m_loop, sizeof(LOOP_CHUNK) ) && info.m_loop.m_version == LOOP_CHUNK_VERSION;
+      }
+      else if( chunk.m_id == DATA_ID )
+      {
+        info.m_data_offset      = offset;
+        // recordings interrupted before the header was finalised have a data size of 0, so trust the file size
+        const uint32_t available = file_size - offset;
+        info.m_data_size        = ( chunk.m_size == 0 || chunk.m_size > available ) ? available : chunk.m_size;
+        return found_fmt;
+      }
+
+      // chunks are word aligned, a chunk running past the end of the file is corrupt (and would wrap the offset)
+      if( chunk.m_size > file_size - offset )
+      {
+        return false;
+      }
+      const uint64_t next_offset = static_cast<uint64_t>(offset) + chunk.m_size + ( chunk.m_size & 1 );
+      if( next_offset <= chunk_offset )
+      {
+        return false;
+      }
+      offset = static_cast<uint32_t>( next_offset );
+    }
+
+    return false;
+  }
+}
+// WAV_FORMAT